@@ -1,14 +1,66 @@
 #include "BamEntry.hpp"
 
-char const* read_group(BamEntry const& e) {
-    uint8_t const* rg = bam_aux_get(e, "RG");
-    if (!rg)
+#include <cstring>
+
+namespace {
+    // Value sizes of the fixed size aux types (0 for the others)
+    struct AuxSizes {
+        AuxSizes() {
+            memset(size, 0, sizeof(size));
+            size['A'] = size['c'] = size['C'] = 1;
+            size['s'] = size['S'] = 2;
+            size['i'] = size['I'] = size['f'] = size['F'] = 4;
+            size['d'] = 8;
+        }
+
+        uint8_t size[256];
+    };
+
+    AuxSizes const aux_sizes;
+
+    // Value of the string tag (type Z) named tag in the aux block [p, end),
+    // or 0. Tags are visited in order since any other way of finding one
+    // can be fooled by bytes inside the values before it (B arrays of
+    // base modification probabilities can hold anything). Strings, the
+    // usual long tags (MD, SA, XA), are skipped with memchr.
+    char const* find_string_tag(uint8_t const* p, uint8_t const* end, char const tag[2]) {
+        while (end - p >= 3) {
+            uint8_t type = p[2];
+            if (p[0] == tag[0] && p[1] == tag[1])
+                return type == 'Z' ? reinterpret_cast<char const*>(p + 3) : 0;
+            p += 3;
+
+            if (type == 'Z' || type == 'H') {
+                void const* nul = memchr(p, 0, end - p);
+                if (!nul)
+                    return 0;
+                p = static_cast<uint8_t const*>(nul) + 1;
+            }
+            else if (type == 'B') {
+                if (end - p < 5)
+                    return 0;
+                uint32_t n;
+                memcpy(&n, p + 1, sizeof(n));
+                uint64_t skip = 5 + uint64_t(aux_sizes.size[p[0]]) * n;
+                if (aux_sizes.size[p[0]] == 0 || skip > uint64_t(end - p))
+                    return 0;
+                p += skip;
+            }
+            else {
+                if (aux_sizes.size[type] == 0)
+                    return 0;
+                p += aux_sizes.size[type];
+            }
+        }
         return 0;
-    return reinterpret_cast<char const*>(rg + 1);
+    }
+}
+
+char const* read_group(BamEntry const& e) {
+    uint8_t const* aux = bam1_aux(e);
+    return find_string_tag(aux, e->data + e->data_len, "RG");
 }
 
 char const* name(BamEntry const& e) {
     return bam1_qname(e);
 }
-
-
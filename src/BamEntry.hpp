@@ -62,3 +62,35 @@ inline
 int sam_flag(BamEntry const& e) {
     return e->core.flag;
 }
+
+// The fixed length part of a record. This is all that BamReader has
+// decoded when it asks the filter about a read: the name, CIGAR and tags
+// are only read in for reads that pass.
+struct BamCoreView {
+    explicit BamCoreView(bam1_core_t const& core)
+        : core(core)
+    {
+    }
+
+    bam1_core_t const& core;
+};
+
+inline
+uint32_t first_pos(BamCoreView const& v) {
+    return v.core.pos;
+}
+
+inline
+uint32_t length(BamCoreView const& v) {
+    return v.core.l_qseq;
+}
+
+inline
+int mapping_quality(BamCoreView const& v) {
+    return v.core.qual;
+}
+
+inline
+int sam_flag(BamCoreView const& v) {
+    return v.core.flag;
+}
@@ -1,10 +1,13 @@
 #pragma once
 
+#include "BamEntry.hpp"
+#include "ExcludedRegions.hpp"
 #include "Options.hpp"
 
 struct BamFilter {
-    BamFilter(Options const& opts)
+    BamFilter(Options const& opts, ExcludedRegions const* excluded = 0)
         : opts_(opts)
+        , excluded_(excluded)
     {}
 
     template<typename T>
@@ -16,6 +19,27 @@ struct BamFilter {
             && (flag & opts_.forbidden_flags) == 0;
     }
 
+    // Excluded regions (--exclude-bed) drop the reads that would be counted
+    // in them: those overlapping one, or with -s, starting in one. Reads
+    // must be checked in coordinate order.
+    bool has_exclusions() const {
+        return excluded_.active();
+    }
+
+    // Reads starting in an excluded region; this only needs the core of
+    // the record.
+    bool excludes_start(bam1_core_t const& core) {
+        return excluded_.overlaps(core.tid, core.pos, core.pos + 1);
+    }
+
+    // Reads reaching into an excluded region from before it (once decoded,
+    // since that takes the CIGAR)
+    bool excludes_span(BamEntry const& e) {
+        if (opts_.leftmost)
+            return false;
+        return excluded_.overlaps(e->core.tid, first_pos(e), last_pos(e));
+    }
+
     Options const& opts_;
+    ExcludedRegions::Cursor excluded_;
 };
-
@@ -78,3 +78,7 @@ int32_t BamHeader::seq_idx(std::string const& seq_name) const {
         return -1;
     return found->second;
 }
+
+std::string BamHeader::text() const {
+    return std::string(header_->text, header_->l_text);
+}
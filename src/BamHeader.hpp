@@ -19,6 +19,8 @@ public:
     uint32_t seq_length(int32_t seq_idx) const;
     RgToLibMap const& rg_to_lib_map() const;
     int32_t seq_idx(std::string const& seq_name) const;
+    // The SAM text of the header
+    std::string text() const;
 
 private:
     bam_header_t* header_;
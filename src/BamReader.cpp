@@ -8,13 +8,21 @@
 
 using boost::format;
 
-BamReader::BamReader(std::string path)
+BamReader::BamReader(std::string path, bool streaming)
     : path_(std::move(path))
     , in_(samopen(path_.c_str(), "rb", 0))
-    , index_(bam_index_load(path_.c_str()))
+    , index_(streaming ? 0 : bam_index_load(path_.c_str()))
+    , region_beg_(0)
     , iter_(0)
+    , streaming_(streaming)
+    , stream_stop_(false)
+    , last_tid_(0)
+    , last_pos_(0)
+    , filter_(0)
+    , skip_fields_(BAM_SKIP_SEQ)
     , total_(0)
     , filtered_(0)
+    , excluded_(0)
 {
     if (!in_ || !in_->header)
         throw std::runtime_error(str(format("Failed to open samfile %1%") % path_));
@@ -22,7 +30,7 @@ BamReader::BamReader(std::string path)
     if (!in_->x.bam)
         throw std::runtime_error(str(format("%1% is not a valid bam file") % path_));
 
-    if (!index_)
+    if (!index_ && !streaming_)
         throw std::runtime_error(str(format("Failed to load bam index for %1%") % path_));
 
     header_.reset(new BamHeader(in_->header));
@@ -43,38 +51,122 @@ void BamReader::set_filter(BamFilter* filter) {
     filter_ = filter;
 }
 
+bool BamReader::use_mmap() {
+    return bgzf_mmap(in_->x.bam) == 0;
+}
+
+bool BamReader::set_prefetch(int queue_depth, int64_t prefetch_size) {
+    return bgzf_prefetch(in_->x.bam, queue_depth, prefetch_size) == 0;
+}
+
+void BamReader::set_decompression_threads(int n_threads) {
+    if (n_threads <= 1)
+        return;
+
+    // Each worker keeps this many blocks in flight (~128kb apiece).
+    static int const blocks_per_thread = 16;
+    if (samthreads(in_, n_threads, blocks_per_thread) != 0) {
+        throw std::runtime_error(str(format(
+            "Failed to start %1% decompression threads for %2%"
+            ) % n_threads % path_));
+    }
+}
+
 void BamReader::clear_region() {
+    assert(!streaming_);
     if (iter_)
         bam_iter_destroy(iter_);
     iter_ = 0;
+    region_beg_ = 0;
+    bam_iter_prefetch(in_->x.bam, 0);
+}
+
+void BamReader::set_position(uint64_t voffset) {
+    clear_region();
+    if (bam_seek(in_->x.bam, voffset, SEEK_SET) < 0) {
+        throw std::runtime_error(str(format(
+            "Failed to seek to offset %1% in %2%"
+            ) % voffset % path_));
+    }
 }
 
 void BamReader::set_sequence_idx(int32_t tid) {
+    set_region(tid, 0, header().seq_length(tid));
+}
+
+void BamReader::set_region(int32_t tid, uint32_t beg, uint32_t end) {
+    assert(!streaming_);
     tid_ = tid;
     clear_region();
-    iter_ = bam_iter_query(index_, tid_, 0, header().seq_length(tid));
+    region_beg_ = beg;
+    iter_ = bam_iter_query(index_, tid_, beg, end);
+    bam_iter_prefetch(in_->x.bam, iter_);
 }
 
 void BamReader::clear_counts() {
     total_ = 0;
     filtered_ = 0;
+    excluded_ = 0;
 }
 
-int BamReader::raw_next(BamEntry& entry) {
-    if (iter_)
-        return bam_iter_read(in_->x.bam, iter_, entry);
+void BamReader::set_read_tags(bool value) {
+    if (value)
+        skip_fields_ &= ~BAM_SKIP_AUX;
     else
-        return bam_read1(in_->x.bam, entry);
+        skip_fields_ |= BAM_SKIP_AUX;
+}
+
+int BamReader::want_record(bam1_t const* b, void* data) {
+    BamReader* self = static_cast<BamReader*>(data);
+    if (self->iter_ && b->core.pos < self->region_beg_)
+        return 0;
+
+    if (self->streaming_ && !self->in_order(b->core))
+        return 1;
+
+    ++self->total_;
+    if (self->filter_) {
+        if (!self->filter_->want_entry(BamCoreView(b->core))) {
+            ++self->filtered_;
+            return 0;
+        }
+        if (self->filter_->has_exclusions() && self->filter_->excludes_start(b->core)) {
+            ++self->excluded_;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+bool BamReader::in_order(bam1_core_t const& core) {
+    if (core.tid < 0 || core.tid >= header().num_seqs()
+        || core.tid < last_tid_ || (core.tid == last_tid_ && core.pos < last_pos_))
+    {
+        stream_stop_ = true;
+        return false;
+    }
+    last_tid_ = core.tid;
+    last_pos_ = core.pos;
+    return true;
 }
 
 bool BamReader::next(BamEntry& entry) {
-    int rv;
-    while ((rv = raw_next(entry)) > 0) {
-        ++total_;
-        if (!filter_ || filter_->want_entry(entry))
-            break;
-        ++filtered_;
+    if (!filter_ || !filter_->has_exclusions())
+        return read_next(entry);
+
+    while (read_next(entry)) {
+        if (!filter_->excludes_span(entry))
+            return true;
+        ++excluded_;
     }
+    return false;
+}
+
+bool BamReader::read_next(BamEntry& entry) {
+    if (stream_stop_)
+        return false;
+
+    int rv = bam_iter_read2(in_->x.bam, iter_, entry, &BamReader::want_record, this, skip_fields_);
 
     // From the samtools source code:
     // (for bam_iter_read)
@@ -87,9 +179,31 @@ bool BamReader::next(BamEntry& entry) {
             "probably a truncated file)."
             ) % path() % rv));
     }
+
+    if (rv >= 0 && stream_stop_) {
+        int32_t tid = entry->core.tid;
+        if (tid >= header().num_seqs()) {
+            throw std::runtime_error(str(format(
+                "Read %1% in %2% refers to sequence #%3%, which is not in the header."
+                ) % name(entry) % path() % tid));
+        }
+
+        if (tid >= 0) {
+            throw std::runtime_error(str(format(
+                "%1% is not sorted by coordinate: read %2% at %3%:%4% comes after %5%:%6%."
+                ) % path() % name(entry) % header().seq_name(tid) % (entry->core.pos + 1)
+                % header().seq_name(last_tid_) % (last_pos_ + 1)));
+        }
+        // reads without coordinates come last
+        return false;
+    }
     return rv >= 0;
 }
 
+double BamReader::io_stall_seconds() const {
+    return bgzf_prefetch_stall(in_->x.bam);
+}
+
 BamHeader const& BamReader::header() const {
     assert(header_);
     return *header_;
@@ -13,36 +13,83 @@ struct BamFilter;
 
 class BamReader {
 public:
-    explicit BamReader(std::string path);
+    // A streaming reader does not need an index (path may be "-" for
+    // stdin) but can only be read from front to back: the region functions
+    // must not be used. It stops at the first read without a coordinate and
+    // throws if the input is not sorted by coordinate.
+    explicit BamReader(std::string path, bool streaming = false);
     ~BamReader();
 
     void set_filter(BamFilter* filter);
+    // Read the rest of the file through a memory mapping shared by every
+    // reader of the same file in this process; blocks stored uncompressed
+    // are parsed in place. Returns false (and changes nothing) if the file
+    // cannot be mapped. Must be called before set_decompression_threads.
+    bool use_mmap();
+    // Keep up to prefetch_size bytes of compressed data in flight ahead of
+    // the reader using queue_depth concurrent reads, following the chunks
+    // of each region. Returns false (and changes nothing) if the file does
+    // not support it. Must be called before set_decompression_threads.
+    bool set_prefetch(int queue_depth, int64_t prefetch_size);
+    // Inflate bgzf blocks ahead of the reader on n_threads worker threads.
+    // Records are still returned in file order. A value <= 1 is a no-op.
+    void set_decompression_threads(int n_threads);
     void set_sequence_idx(int32_t tid);
+    // Read only alignments on sequence tid that start in [beg, end).
+    // Reads that start before beg but overlap it are skipped (and not
+    // counted) since they belong to whoever read the region before.
+    void set_region(int32_t tid, uint32_t beg, uint32_t end);
     void clear_region();
+    // Read from the virtual file offset voffset (e.g., one taken from the
+    // index) to the end of the file.
+    void set_position(uint64_t voffset);
     void clear_counts();
+    // Whether to read in aux tags (e.g., RG); on by default. Without them,
+    // read_group() returns null for every entry. Sequences and qualities
+    // are never read in.
+    void set_read_tags(bool value);
 
     bool next(BamEntry& entry);
 
     BamHeader const& header() const;
+    bam_index_t const* index() const { return index_; }
 
     std::string const& path() const { return path_; }
 
     std::size_t total_read() const { return total_; }
     std::size_t total_filtered() const {return filtered_; }
+    // Reads that passed the filter but lie in its excluded regions
+    std::size_t total_excluded() const { return excluded_; }
+    // Seconds spent waiting for read-ahead (see set_prefetch)
+    double io_stall_seconds() const;
 
 private:
-    int raw_next(BamEntry& entry);
+    // Called by samtools with just the core of each record decoded; the
+    // rest of the record is skipped unless this returns non-zero.
+    static int want_record(bam1_t const* b, void* data);
+    // For streaming readers: false for the first record that is unsorted or
+    // has no coordinate, which next() then deals with.
+    bool in_order(bam1_core_t const& core);
+    // next() before the checks that need the whole record
+    bool read_next(BamEntry& entry);
 
 private:
     std::string path_;
     samfile_t* in_;
     bam_index_t* index_;
     int32_t tid_;
+    int32_t region_beg_;
     std::unique_ptr<BamHeader> header_;
     bam_iter_t iter_;
+    bool streaming_;
+    bool stream_stop_;
+    int32_t last_tid_;
+    int32_t last_pos_;
 
     BamFilter* filter_;
+    int skip_fields_;
 
     std::size_t total_;
     std::size_t filtered_;
+    std::size_t excluded_;
 };
@@ -4,18 +4,46 @@
 #include "BamFilter.hpp"
 #include "BamHeader.hpp"
 #include "BamReader.hpp"
+#include "BgzfOutput.hpp"
+#include "BinaryTablePrinter.hpp"
+#include "CohortTable.hpp"
 #include "ColumnAssigner.hpp"
+#include "CountCache.hpp"
+#include "DeferredTable.hpp"
+#include "ExcludedRegions.hpp"
+#include "IndexEstimator.hpp"
+#include "MultiResolutionPrinter.hpp"
+#include "MurmurHash2.hpp"
+#include "OrderedOutput.hpp"
+#include "ReadBatch.hpp"
 #include "RowAssigner.hpp"
+#include "RunRowPrinter.hpp"
+#include "ShardMerger.hpp"
+#include "TabixIndex.hpp"
 #include "TableBuilder.hpp"
 #include "WarningCollector.hpp"
+#include "WorkStealingQueue.hpp"
 
 #include <boost/format.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <unordered_set>
 
+#include <stdio.h>
+#include <sys/stat.h>
+
 using boost::format;
 
 namespace {
@@ -45,30 +73,1250 @@ namespace {
         }
         return rv;
     }
+
+    // With --count-cache, reads are counted into the cache and the tables
+    // are made from it (see print_cached())
+    bool uses_cache(Options const& opts) {
+        return !opts.count_cache.empty();
+    }
+
+    // Each window size as a multiple of the smallest one. Reads counted
+    // for the cache only make rows of the smallest.
+    std::vector<uint32_t> window_factors(Options const& opts) {
+        std::vector<uint32_t> rv;
+        if (uses_cache(opts)) {
+            rv.push_back(1);
+            return rv;
+        }
+        for (auto i = opts.window_sizes.begin(); i != opts.window_sizes.end(); ++i)
+            rv.push_back(*i / opts.window_size);
+        return rv;
+    }
+
+    // Coarser tables are built from the finest one (or later from the
+    // cache); unless reads only count where they start, that needs to know
+    // where they start.
+    bool count_starts(Options const& opts) {
+        return (opts.window_sizes.size() > 1 || uses_cache(opts)) && !opts.leftmost;
+    }
+
+    // Rows for the cache keep the read starts; MultiResolutionPrinter
+    // takes them out of all others.
+    bool splits_starts(Options const& opts) {
+        return count_starts(opts) && !uses_cache(opts);
+    }
+
+    uint32_t gcd(uint32_t a, uint32_t b) {
+        while (b != 0) {
+            uint32_t r = a % b;
+            a = b;
+            b = r;
+        }
+        return a;
+    }
+
+    // Rows are held in a DeferredTable (encoded by DeferredRowEncoder) until
+    // counting is done if the columns are not known yet, or for binary
+    // output, which is then written a sequence at a time.
+    bool defers_rows(Options const& opts, ColumnAssignerBase const& col_assigner) {
+        return !col_assigner.fixed_columns() || opts.binary_output();
+    }
+
+    // Standard input and pipes can only be read from front to back
+    bool is_stream(Options const& opts, std::string const& path) {
+        struct stat st;
+        return opts.stream || path == "-"
+            || (stat(path.c_str(), &st) == 0 && !S_ISREG(st.st_mode));
+    }
+
+    // Apply the input options to a freshly opened reader.
+    void configure_reader(BamReader& reader, Options const& opts) {
+        if (opts.mmap)
+            reader.use_mmap();
+        if (opts.prefetch_depth > 0)
+            reader.set_prefetch(opts.prefetch_depth, int64_t(opts.prefetch_size) << 20);
+        reader.set_decompression_threads(opts.num_threads);
+    }
+
+    uint32_t fold_seed(long seed) {
+        uint64_t s = seed;
+        return uint32_t(s ^ (s >> 32));
+    }
+
+    // Decides which reads to keep when downsampling. By default, draws come
+    // from the global drand48 stream seeded in configure_downsampling().
+    // Workers instead give each shard its own erand48 stream derived from
+    // the seed so that results do not depend on scheduling.
+    //
+    // by_name() keeps a read if the hash of its name (seeded) falls below
+    // the rate. That needs no state at all: the same reads are kept however
+    // and in whatever order they are counted, and mates go together.
+    class Downsampler {
+    public:
+        explicit Downsampler(float rate)
+            : rate_(rate)
+            , mode_(GLOBAL)
+        {
+        }
+
+        Downsampler(float rate, long seed, int32_t tid, uint32_t begin_row)
+            : rate_(rate)
+            , mode_(LOCAL)
+        {
+            uint32_t mixed = fold_seed(seed)
+                ^ (uint32_t(tid) * 0x9e3779b9u)
+                ^ (begin_row * 0x85ebca6bu);
+            state_[0] = 0x330e;
+            state_[1] = mixed & 0xffff;
+            state_[2] = mixed >> 16;
+        }
+
+        static Downsampler by_name(float rate, long seed) {
+            Downsampler rv(rate);
+            rv.mode_ = BY_NAME;
+            rv.name_seed_ = fold_seed(seed);
+            // hashes are uniform in [0, 2^32)
+            rv.threshold_ = uint64_t(double(rate) * 4294967296.0);
+            return rv;
+        }
+
+        bool keep(BamEntry const& e) {
+            if (rate_ >= 1.0f)
+                return true;
+
+            switch (mode_) {
+            case BY_NAME: {
+                char const* qname = name(e);
+                return murmurhash2(qname, strlen(qname), name_seed_) < threshold_;
+            }
+            case LOCAL:
+                return erand48(state_) < rate_;
+            default:
+                return drand48() < rate_;
+            }
+        }
+
+    private:
+        enum Mode { GLOBAL, LOCAL, BY_NAME };
+
+        float rate_;
+        Mode mode_;
+        unsigned short state_[3];
+        uint32_t name_seed_;
+        uint64_t threshold_;
+    };
+
+    template<typename BuilderType>
+    void configure_builder(BuilderType& builder, Options const& opts) {
+        builder.set_count_starts(count_starts(opts));
+        builder.set_promote_rows(opts.counter_bits == 0);
+    }
+
+    // Reads go to TableBuilders in batches when their columns depend on
+    // read groups: a batch looks up each distinct read group once (see
+    // ReadBatch), which BenchTableBuilder puts at 1.2-1.5x the reads per
+    // second. Otherwise the reads are counted as they come, which is
+    // cheaper than copying them into a batch. Returns null in that case.
+    std::unique_ptr<ReadBatch> make_batch(Options const& opts, ColumnAssignerBase const& col_assigner) {
+        std::unique_ptr<ReadBatch> rv;
+        if (col_assigner.needs_read_group())
+            rv.reset(new ReadBatch(!opts.leftmost, true));
+        return rv;
+    }
+
+    template<typename BuilderType>
+    void flush_batch(BuilderType& builder, ReadBatch* batch) {
+        if (batch) {
+            builder.add_batch(*batch);
+            batch->clear();
+        }
+    }
+
+    template<typename BuilderType>
+    void add_read(BuilderType& builder, ReadBatch* batch, BamEntry const& e) {
+        if (!batch) {
+            builder(e);
+            return;
+        }
+
+        batch->push_back(e);
+        if (batch->full())
+            flush_batch(builder, batch);
+    }
+
+    // Count the reads starting in rows [begin_row, end_row) of sequence tid
+    // (end_row is clamped to the number of windows in the sequence).
+    template<typename CellType, typename PrinterType>
+    void count_rows_as(
+              int32_t tid
+            , uint32_t begin_row
+            , uint32_t end_row
+            , BamReader& reader
+            , Options const& opts
+            , ColumnAssignerBase const& col_assigner
+            , PrinterType& printer
+            , WarningCollector& warnings
+            , Downsampler& sampler
+            )
+    {
+        auto const& header = reader.header();
+        char const* seq_name = header.seq_name(tid);
+        assert(seq_name != 0);
+        uint32_t seq_len = header.seq_length(tid);
+        RowAssigner row_assigner(seq_len, opts.window_size);
+        row_assigner.set_start_only(opts.leftmost);
+        end_row = std::min(end_row, row_assigner.num_wins);
+
+        uint64_t end_pos = std::min(uint64_t(end_row) * opts.window_size, uint64_t(seq_len));
+        reader.set_region(tid, begin_row * opts.window_size, end_pos);
+
+        TableBuilder<PrinterType, WarningCollector, CellType> builder(
+              seq_name
+            , row_assigner
+            , col_assigner
+            , printer
+            , warnings);
+        builder.set_row_range(begin_row, end_row);
+        configure_builder(builder, opts);
+
+        auto batch = make_batch(opts, col_assigner);
+        BamEntry e;
+        while (reader.next(e)) {
+            if (sampler.keep(e))
+                add_read(builder, batch.get(), e);
+        }
+        flush_batch(builder, batch.get());
+    }
+
+    // count_rows_as() with the counter width from opts (auto starts narrow)
+    template<typename PrinterType>
+    void count_rows(
+              int32_t tid
+            , uint32_t begin_row
+            , uint32_t end_row
+            , BamReader& reader
+            , Options const& opts
+            , ColumnAssignerBase const& col_assigner
+            , PrinterType& printer
+            , WarningCollector& warnings
+            , Downsampler& sampler
+            )
+    {
+        switch (opts.counter_bits) {
+        case 32:
+            count_rows_as<int32_t>(tid, begin_row, end_row, reader, opts,
+                col_assigner, printer, warnings, sampler);
+            break;
+        case 64:
+            count_rows_as<int64_t>(tid, begin_row, end_row, reader, opts,
+                col_assigner, printer, warnings, sampler);
+            break;
+        default:
+            count_rows_as<int16_t>(tid, begin_row, end_row, reader, opts,
+                col_assigner, printer, warnings, sampler);
+            break;
+        }
+    }
+
+    template<typename PrinterType>
+    void count_sequence(
+              int32_t tid
+            , BamReader& reader
+            , Options const& opts
+            , ColumnAssignerBase const& col_assigner
+            , PrinterType& printer
+            , WarningCollector& warnings
+            , Downsampler& sampler
+            )
+    {
+        count_rows(tid, 0, std::numeric_limits<uint32_t>::max(), reader, opts,
+            col_assigner, printer, warnings, sampler);
+    }
+
+    // Count every sequence in seqs from a streaming reader. Sequences are
+    // visited in header order (the order of a sorted file) so that those
+    // without any reads still get their empty rows.
+    template<typename CellType, typename PrinterType>
+    void count_stream_as(
+              std::vector<int32_t> const& seqs
+            , BamReader& reader
+            , Options const& opts
+            , ColumnAssignerBase const& col_assigner
+            , PrinterType& printer
+            , WarningCollector& warnings
+            , Downsampler& sampler
+            )
+    {
+        auto const& header = reader.header();
+        std::vector<bool> wanted(header.num_seqs(), false);
+        for (auto i = seqs.begin(); i != seqs.end(); ++i)
+            wanted[*i] = true;
+
+        auto batch = make_batch(opts, col_assigner);
+        BamEntry e;
+        bool have_entry = reader.next(e);
+        for (int32_t tid = 0; tid < header.num_seqs(); ++tid) {
+            RowAssigner row_assigner(header.seq_length(tid), opts.window_size);
+            row_assigner.set_start_only(opts.leftmost);
+
+            typedef TableBuilder<PrinterType, WarningCollector, CellType> BuilderType;
+            std::unique_ptr<BuilderType> builder;
+            if (wanted[tid]) {
+                builder.reset(new BuilderType(
+                      header.seq_name(tid)
+                    , row_assigner
+                    , col_assigner
+                    , printer
+                    , warnings));
+                configure_builder(*builder, opts);
+            }
+
+            // the reader guarantees that tids never decrease
+            for (; have_entry && e->core.tid == tid; have_entry = reader.next(e)) {
+                if (builder && sampler.keep(e))
+                    add_read(*builder, batch.get(), e);
+            }
+            if (builder)
+                flush_batch(*builder, batch.get());
+        }
+    }
+
+    template<typename PrinterType>
+    void count_stream(
+              std::vector<int32_t> const& seqs
+            , BamReader& reader
+            , Options const& opts
+            , ColumnAssignerBase const& col_assigner
+            , PrinterType& printer
+            , WarningCollector& warnings
+            , Downsampler& sampler
+            )
+    {
+        switch (opts.counter_bits) {
+        case 32:
+            count_stream_as<int32_t>(seqs, reader, opts, col_assigner, printer, warnings, sampler);
+            break;
+        case 64:
+            count_stream_as<int64_t>(seqs, reader, opts, col_assigner, printer, warnings, sampler);
+            break;
+        default:
+            count_stream_as<int16_t>(seqs, reader, opts, col_assigner, printer, warnings, sampler);
+            break;
+        }
+    }
+
+    // Passes rows on to a Printer except for those of windows that lie
+    // entirely in skipped regions (--skip-excluded-windows; null skips
+    // nothing). The rows of each sequence must come in order.
+    template<typename Printer>
+    class WindowSkipper {
+    public:
+        WindowSkipper(
+                  Printer& printer
+                , BamHeader const& header
+                , ExcludedRegions const* skipped
+                , uint32_t win_size
+                )
+            : printer_(printer)
+            , header_(header)
+            , skipped_(skipped)
+            , win_size_(win_size)
+            , seq_name_(0)
+            , tid_(-1)
+            , seq_len_(0)
+        {
+        }
+
+        void operator()(char const* seq_name, uint32_t pos) {
+            if (!skip(seq_name, pos))
+                printer_(seq_name, pos);
+        }
+
+        void operator()(
+                  char const* seq_name
+                , uint32_t pos
+                , std::vector<uint64_t> const& counts
+                )
+        {
+            if (!skip(seq_name, pos))
+                printer_(seq_name, pos, counts);
+        }
+
+    private:
+        bool skip(char const* seq_name, uint32_t pos) {
+            if (!skipped_.active())
+                return false;
+
+            // names come from the header, so each sequence has one pointer
+            if (seq_name != seq_name_) {
+                seq_name_ = seq_name;
+                tid_ = header_.seq_idx(seq_name);
+                seq_len_ = header_.seq_length(tid_);
+            }
+            uint32_t beg = pos - 1;
+            uint32_t end = uint32_t(std::min(uint64_t(beg) + win_size_, uint64_t(seq_len_)));
+            return skipped_.covers(tid_, beg, end);
+        }
+
+    private:
+        Printer& printer_;
+        BamHeader const& header_;
+        ExcludedRegions::Cursor skipped_;
+        uint32_t win_size_;
+        char const* seq_name_;
+        int32_t tid_;
+        uint32_t seq_len_;
+    };
+
+    // Row printers are made from the stream and the columns; RunRowPrinter
+    // also needs the sequences and the window size.
+    template<typename RowPrinter>
+    RowPrinter* new_row_printer(
+              std::ostream& os
+            , ColumnAssignerBase const& col_assigner
+            , BamHeader const&
+            , uint32_t
+            )
+    {
+        return new RowPrinter(os, col_assigner);
+    }
+
+    template<>
+    RunRowPrinter* new_row_printer<RunRowPrinter>(
+              std::ostream& os
+            , ColumnAssignerBase const& col_assigner
+            , BamHeader const& header
+            , uint32_t win_size
+            )
+    {
+        return new RunRowPrinter(os, col_assigner, header, win_size);
+    }
+
+    // The table for each window size, written to the matching stream in
+    // outs with RowPrinter (behind a WindowSkipper), from the rows of
+    // windows of win_size given to printer() (see MultiResolutionPrinter
+    // for factors and with_starts).
+    template<typename RowPrinter>
+    class TablePrinters {
+    public:
+        typedef WindowSkipper<RowPrinter> SkipperType;
+        typedef MultiResolutionPrinter<SkipperType> PrinterType;
+
+        TablePrinters(
+                  std::vector<std::ostream*> const& outs
+                , ColumnAssignerBase const& col_assigner
+                , BamHeader const& header
+                , Options const& opts
+                , ExcludedRegions const* skipped
+                , std::vector<uint32_t> const& factors
+                , uint32_t win_size
+                , bool with_starts
+                )
+        {
+            std::vector<SkipperType*> printer_ptrs;
+            for (std::size_t i = 0; i < outs.size(); ++i) {
+                row_printers_.emplace_back(new_row_printer<RowPrinter>(*outs[i], col_assigner,
+                    header, opts.window_sizes[i]));
+                skippers_.emplace_back(new SkipperType(*row_printers_.back(),
+                    header, skipped, opts.window_sizes[i]));
+                printer_ptrs.push_back(skippers_.back().get());
+            }
+            printer_.reset(new PrinterType(printer_ptrs, factors, win_size, with_starts));
+        }
+
+        PrinterType& printer() { return *printer_; }
+
+    private:
+        std::vector<std::unique_ptr<RowPrinter>> row_printers_;
+        std::vector<std::unique_ptr<SkipperType>> skippers_;
+        std::unique_ptr<PrinterType> printer_;
+    };
+
+    // Count the sequences in seqs on the calling thread, writing the table
+    // for each window size to the matching stream in outs with RowPrinter.
+    template<typename RowPrinter>
+    void count_serial(
+              bool streaming
+            , std::vector<int32_t> const& seqs
+            , BamReader& reader
+            , Options const& opts
+            , ColumnAssignerBase const& col_assigner
+            , std::vector<std::ostream*> const& outs
+            , WarningCollector& warnings
+            , Downsampler& sampler
+            , ExcludedRegions const* skipped
+            )
+    {
+        TablePrinters<RowPrinter> tables(outs, col_assigner, reader.header(), opts, skipped,
+            window_factors(opts), opts.window_size, splits_starts(opts));
+        auto& printer = tables.printer();
+
+        if (streaming) {
+            count_stream(seqs, reader, opts, col_assigner, printer, warnings, sampler);
+        }
+        else {
+            for (auto iter = seqs.begin(); iter != seqs.end(); ++iter) {
+                count_sequence(*iter, reader, opts, col_assigner, printer, warnings, sampler);
+            }
+        }
+        printer.flush();
+    }
+
+    // Formats rows (with RowPrinter) into a local buffer that is handed to
+    // the reorder stage in chunks of about chunk_size bytes. Only flush()
+    // flushes the row printer, so a RunRowPrinter keeps its run open
+    // across chunks (and across slots, see set_slot()).
+    template<typename RowPrinter>
+    class ChunkedRowPrinter {
+    public:
+        ChunkedRowPrinter(
+                  OrderedOutput& output
+                , std::size_t slot
+                , ColumnAssignerBase const& col_assigner
+                , BamHeader const& header
+                , uint32_t win_size
+                )
+            : output_(output)
+            , slot_(slot)
+            , printer_(new_row_printer<RowPrinter>(buffer_, col_assigner, header, win_size))
+        {
+        }
+
+        void operator()(char const* seq_name, uint32_t pos) {
+            (*printer_)(seq_name, pos);
+            maybe_flush();
+        }
+
+        void operator()(
+                  char const* seq_name
+                , uint32_t pos
+                , std::vector<uint64_t> const& counts
+                )
+        {
+            (*printer_)(seq_name, pos, counts);
+            maybe_flush();
+        }
+
+        void flush() {
+            printer_->flush();
+            hand_over();
+        }
+
+        // Hand what the row printer wrote so far to the slot
+        void hand_over() {
+            output_.append(slot_, buffer_.str());
+            buffer_.str("");
+        }
+
+        // Rows go to slot from now on; hand_over() the last slot's first
+        void set_slot(std::size_t slot) {
+            slot_ = slot;
+        }
+
+    private:
+        void maybe_flush() {
+            static std::streamoff const chunk_size = 1 << 20;
+            if (buffer_.tellp() >= chunk_size)
+                hand_over();
+        }
+
+    private:
+        OrderedOutput& output_;
+        std::size_t slot_;
+        std::stringstream buffer_;
+        std::unique_ptr<RowPrinter> printer_;
+    };
+
+    // Print the counts estimated from the index for the sequences in seqs;
+    // returns their total.
+    template<typename Printer>
+    uint64_t print_estimates(
+              IndexEstimator const& estimator
+            , std::vector<int32_t> const& seqs
+            , BamHeader const& header
+            , Options const& opts
+            , Printer& printer
+            )
+    {
+        uint64_t total = 0;
+        std::vector<uint64_t> counts(1);
+        for (auto iter = seqs.begin(); iter != seqs.end(); ++iter) {
+            char const* seq_name = header.seq_name(*iter);
+            RowAssigner row_assigner(header.seq_length(*iter), opts.window_size);
+            std::vector<double> estimates = estimator.window_counts(*iter, row_assigner);
+
+            // round the running sum so that rows add up to the rounded total
+            double sum = 0.0;
+            uint64_t printed = 0;
+            for (uint32_t row = 0; row < row_assigner.num_wins; ++row) {
+                sum += estimates[row] * opts.downsample;
+                uint64_t upto = uint64_t(sum + 0.5);
+                uint32_t pos = row_assigner.start_pos_for_row(row) + 1;
+                counts[0] = upto - printed;
+                printed = upto;
+                if (counts[0] > 0)
+                    printer(seq_name, pos, counts);
+                else
+                    printer(seq_name, pos);
+            }
+            total += printed;
+        }
+        return total;
+    }
+
+    std::vector<std::string> sequence_names(std::vector<int32_t> const& seqs, BamHeader const& header) {
+        std::vector<std::string> rv;
+        for (auto i = seqs.begin(); i != seqs.end(); ++i)
+            rv.push_back(header.seq_name(*i));
+        return rv;
+    }
+
+    // The column assigner that make_column_assigner() would give for the
+    // reads of seqs, from the columns of the cache that have counts in
+    // them (as DiscoveringColumnAssigner would find them)
+    std::unique_ptr<ColumnAssignerBase> cached_column_assigner(
+              CountCache const& cache
+            , std::vector<int32_t> const& seqs
+            , BamHeader const& header
+            , Options const& opts
+            )
+    {
+        typedef std::unique_ptr<ColumnAssignerBase> RV;
+        if (!opts.per_read_len) {
+            if (opts.per_lib)
+                return RV{new PerLibColumnAssigner(header.rg_to_lib_map())};
+            return RV{new SingleColumnAssigner};
+        }
+
+        std::vector<bool> used = cache.used_columns(sequence_names(seqs, header));
+        std::vector<uint64_t> const& keys = cache.column_keys();
+        std::vector<std::string> const& libs = cache.library_names();
+        PerLibReadLengths read_lens;
+        for (std::size_t c = 0; c < keys.size(); ++c) {
+            uint64_t lib = keys[c] >> 32;
+            if (!used[c] || (opts.per_lib && lib >= libs.size()))
+                continue;
+            read_lens[opts.per_lib ? libs[lib] : ""].insert(uint32_t(keys[c]));
+        }
+
+        if (opts.per_lib)
+            return RV{new PerLibAndLengthColumnAssigner(header.rg_to_lib_map(), read_lens)};
+
+        auto const& lens = read_lens[""];
+        return RV{new PerLengthColumnAssigner(std::vector<uint32_t>(lens.begin(), lens.end()))};
+    }
+
+    // Print the tables for the sequences in seqs from the counts in cache,
+    // as count_serial() would from the reads. Reads in columns of the cache
+    // that col_assigner has no column for go to warnings, as they would
+    // have while counting.
+    template<typename RowPrinter>
+    void print_cached(
+              CountCache& cache
+            , std::vector<int32_t> const& seqs
+            , BamHeader const& header
+            , Options const& opts
+            , ColumnAssignerBase const& col_assigner
+            , std::vector<std::ostream*> const& outs
+            , WarningCollector& warnings
+            , ExcludedRegions const* skipped
+            )
+    {
+        std::vector<uint32_t> factors;
+        for (auto i = opts.window_sizes.begin(); i != opts.window_sizes.end(); ++i)
+            factors.push_back(*i / cache.resolution());
+        TablePrinters<RowPrinter> tables(outs, col_assigner, header, opts, skipped,
+            factors, cache.resolution(), cache.with_starts());
+        auto& printer = tables.printer();
+
+        // col_assigner finds the column of a library by one of its read
+        // groups, and reads without a known one by a read group that is
+        // not in the header
+        RgToLibMap const& rg2lib = header.rg_to_lib_map();
+        std::string unknown_rg = "?";
+        while (rg2lib.count(unknown_rg))
+            unknown_rg += "?";
+
+        std::vector<uint64_t> const& keys = cache.column_keys();
+        std::vector<std::string> const& libs = cache.library_names();
+        std::vector<char const*> rgs;
+        std::vector<int> columns;
+        for (auto i = keys.begin(); i != keys.end(); ++i) {
+            uint64_t lib = *i >> 32;
+            char const* rg = unknown_rg.c_str();
+            if (lib == DiscoveringColumnAssigner::NO_READ_GROUP)
+                rg = 0;
+            for (auto j = rg2lib.begin(); lib < libs.size() && j != rg2lib.end(); ++j) {
+                if (j->second == libs[lib]) {
+                    rg = j->first.c_str();
+                    break;
+                }
+            }
+            rgs.push_back(rg);
+            columns.push_back(col_assigner.assign_column(rg, uint32_t(*i)));
+        }
+
+        // with read starts, each read starts in one window
+        std::size_t step = cache.with_starts() ? 2 : 1;
+        std::vector<uint64_t> counts(step * col_assigner.num_columns());
+        std::vector<uint64_t> dropped(keys.size(), 0);
+        std::vector<CountCache::Cell> cells;
+        for (auto iter = seqs.begin(); iter != seqs.end(); ++iter) {
+            char const* seq_name = header.seq_name(*iter);
+            uint32_t num_rows = cache.seek(seq_name);
+            for (uint32_t row = 0; row < num_rows; ++row) {
+                cache.next_row(cells);
+                uint32_t pos = row * cache.resolution() + 1;
+
+                bool has_counts = false;
+                for (auto i = cells.begin(); i != cells.end(); ++i) {
+                    int col = columns[i->column];
+                    if (col < 0) {
+                        dropped[i->column] += step == 2 ? i->starts : i->count;
+                        continue;
+                    }
+                    if (!has_counts)
+                        std::fill(counts.begin(), counts.end(), 0u);
+                    has_counts = true;
+                    counts[step * col] += i->count;
+                    if (step == 2)
+                        counts[step * col + 1] += i->starts;
+                }
+
+                if (has_counts)
+                    printer(seq_name, pos, counts);
+                else
+                    printer(seq_name, pos);
+            }
+        }
+        printer.flush();
+
+        for (std::size_t c = 0; c < keys.size(); ++c) {
+            if (dropped[c] > 0)
+                warnings.warn_invalid_col(rgs[c], uint32_t(keys[c]), dropped[c]);
+        }
+    }
+
+    // A window aligned range of rows [begin_row, end_row) in sequence tid.
+    // slot is the shard's position in the output.
+    struct Shard {
+        std::size_t slot;
+        int32_t tid;
+        uint32_t begin_row;
+        uint32_t end_row;
+    };
+
+    std::vector<Shard> make_shards(
+              std::vector<int32_t> const& seqs
+            , BamHeader const& header
+            , Options const& opts
+            , std::vector<bool>& ends_sequence
+            )
+    {
+        uint32_t win_size = opts.window_size;
+        uint32_t rows_per_shard = std::max(1u, (uint32_t(opts.shard_size) + win_size - 1) / win_size);
+
+        // keep the windows of every size within a shard
+        uint32_t align = 1;
+        std::vector<uint32_t> factors = window_factors(opts);
+        for (auto i = factors.begin(); i != factors.end(); ++i)
+            align = align / gcd(align, *i) * *i;
+        rows_per_shard = (rows_per_shard + align - 1) / align * align;
+
+        std::vector<Shard> rv;
+        for (auto i = seqs.begin(); i != seqs.end(); ++i) {
+            RowAssigner row_assigner(header.seq_length(*i), win_size);
+            uint32_t num_wins = row_assigner.num_wins;
+            uint32_t begin = 0;
+            do {
+                uint32_t end = num_wins - begin > rows_per_shard ? begin + rows_per_shard : num_wins;
+                Shard shard = {rv.size(), *i, begin, end};
+                rv.push_back(shard);
+                ends_sequence.push_back(end == num_wins);
+                begin = end;
+            } while (begin < num_wins);
+        }
+        return rv;
+    }
+
+    // With bedgraph output, a run of equal windows can go on across shards,
+    // so the rows of every shard of count_parallel() go through one
+    // RunRowPrinter per table, which keeps its open run from one shard to
+    // the next. Shards take turns in slot order; an error in one worker
+    // must abort() the turns so that the others stop waiting.
+    class SharedRunPrinters {
+    public:
+        typedef ChunkedRowPrinter<RunRowPrinter> PrinterType;
+
+        SharedRunPrinters(
+                  std::vector<OrderedOutput*> const& outputs
+                , ColumnAssignerBase const& col_assigner
+                , BamHeader const& header
+                , Options const& opts
+                , std::size_t n_slots
+                )
+            : n_slots_(n_slots)
+            , next_slot_(0)
+            , aborted_(false)
+        {
+            for (std::size_t i = 0; i < outputs.size(); ++i) {
+                printers_.emplace_back(new PrinterType(*outputs[i], 0, col_assigner, header,
+                    opts.window_sizes[i]));
+                printer_ptrs_.push_back(printers_.back().get());
+            }
+        }
+
+        // Waits for the turn of slot; false if the turns were aborted
+        bool begin_slot(std::size_t slot) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!aborted_ && next_slot_ != slot)
+                turn_.wait(lock);
+            if (aborted_)
+                return false;
+
+            for (auto i = printers_.begin(); i != printers_.end(); ++i)
+                (*i)->set_slot(slot);
+            return true;
+        }
+
+        // Hand the rows printed so far to the slot (all of them after the
+        // last slot) and pass the turn on
+        void end_slot(std::size_t slot) {
+            for (auto i = printers_.begin(); i != printers_.end(); ++i) {
+                if (slot + 1 == n_slots_)
+                    (*i)->flush();
+                else
+                    (*i)->hand_over();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++next_slot_;
+            turn_.notify_all();
+        }
+
+        void abort() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            aborted_ = true;
+            turn_.notify_all();
+        }
+
+        // One for each table; to be used between begin_slot() and end_slot()
+        std::vector<PrinterType*> const& printers() const { return printer_ptrs_; }
+
+    private:
+        std::vector<std::unique_ptr<PrinterType>> printers_;
+        std::vector<PrinterType*> printer_ptrs_;
+        std::size_t n_slots_;
+        std::size_t next_slot_;
+        bool aborted_;
+        std::mutex mutex_;
+        std::condition_variable turn_;
+    };
+
+    // Counts shards taken from a WorkStealingQueue. Each worker owns its
+    // reader (and index iterator), table builders and warnings; the column
+    // assigner is shared read-only. Finished shards go through the merger
+    // and whichever worker completes the chain of earlier shards formats
+    // them.
+    class ShardWorker {
+    public:
+        ShardWorker(
+                  std::size_t idx
+                , Options const& opts
+                , std::vector<Shard> const& shards
+                , WorkStealingQueue<std::size_t>& queue
+                , ShardMerger& merger
+                , ColumnAssignerBase const& col_assigner
+                , std::vector<OrderedOutput*> const& outputs
+                , SharedRunPrinters* run_printers
+                , RgToLibMap const& rg2lib
+                , bool downsample
+                , long seed
+                , ExcludedRegions const* excluded
+                )
+            : idx_(idx)
+            , opts_(opts)
+            , shards_(shards)
+            , queue_(queue)
+            , merger_(merger)
+            , col_assigner_(col_assigner)
+            , outputs_(outputs)
+            , run_printers_(run_printers)
+            , downsample_(downsample)
+            , seed_(seed)
+            , excluded_(excluded)
+            , warnings(opts, rg2lib)
+            , total_read(0)
+            , total_filtered(0)
+            , total_excluded(0)
+            , io_stall(0.0)
+        {
+        }
+
+        void run() {
+            try {
+                BamFilter filter(opts_, excluded_);
+                BamReader reader(opts_.input_file);
+                reader.set_filter(&filter);
+                configure_reader(reader, opts_);
+                reader.set_read_tags(col_assigner_.needs_read_group());
+
+                std::size_t slot;
+                std::vector<ShardMerger::MergedShard> ready;
+                while (queue_.pop(idx_, slot)) {
+                    Shard const& shard = shards_[slot];
+                    Downsampler sampler(1.0f);
+                    if (downsample_ && opts_.downsample_by_name)
+                        sampler = Downsampler::by_name(opts_.downsample, seed_);
+                    else if (downsample_)
+                        sampler = Downsampler(opts_.downsample, seed_, shard.tid, shard.begin_row);
+
+                    ShardCounts counts;
+                    counts.rows.swap(spare_rows_);
+                    ShardRowCollector collector(counts, shard.end_row - shard.begin_row);
+                    count_rows(shard.tid, shard.begin_row, shard.end_row, reader, opts_,
+                        col_assigner_, collector, warnings, sampler);
+
+                    ready.clear();
+                    merger_.submit(slot, counts, ready);
+                    for (auto i = ready.begin(); i != ready.end(); ++i) {
+                        print_shard(*i, reader.header());
+                        // keep a buffer for the next shard
+                        i->rows.clear();
+                        spare_rows_.swap(i->rows);
+                    }
+                }
+
+                total_read = reader.total_read();
+                total_filtered = reader.total_filtered();
+                total_excluded = reader.total_excluded();
+                io_stall = reader.io_stall_seconds();
+            }
+            catch (...) {
+                for (auto i = outputs_.begin(); i != outputs_.end(); ++i)
+                    (*i)->abort(std::current_exception());
+                if (run_printers_)
+                    run_printers_->abort();
+            }
+        }
+
+    private:
+        void print_shard(ShardMerger::MergedShard const& merged, BamHeader const& header) {
+            if (defers_rows(opts_, col_assigner_))
+                print_shard<DeferredRowEncoder>(merged, header);
+            else if (run_printers_)
+                print_shard_runs(merged, header);
+            else
+                print_shard<DefaultRowPrinter>(merged, header);
+        }
+
+        template<typename RowPrinter>
+        void print_shard(ShardMerger::MergedShard const& merged, BamHeader const& header) {
+            typedef ChunkedRowPrinter<RowPrinter> ChunkedType;
+            std::vector<std::unique_ptr<ChunkedType>> chunked;
+            std::vector<ChunkedType*> chunked_ptrs;
+            for (std::size_t i = 0; i < outputs_.size(); ++i) {
+                chunked.emplace_back(new ChunkedType(*outputs_[i], merged.slot, col_assigner_,
+                    header, opts_.window_sizes[i]));
+                chunked_ptrs.push_back(chunked.back().get());
+            }
+
+            print_rows(merged, header, chunked_ptrs);
+
+            for (std::size_t i = 0; i < chunked.size(); ++i) {
+                chunked[i]->flush();
+                outputs_[i]->finish(merged.slot);
+            }
+        }
+
+        void print_shard_runs(ShardMerger::MergedShard const& merged, BamHeader const& header) {
+            // another worker failed
+            if (!run_printers_->begin_slot(merged.slot))
+                return;
+
+            print_rows(merged, header, run_printers_->printers());
+            run_printers_->end_slot(merged.slot);
+            for (auto i = outputs_.begin(); i != outputs_.end(); ++i)
+                (*i)->finish(merged.slot);
+        }
+
+        // Print the rows of merged to chunked (one for each table)
+        template<typename ChunkedType>
+        void print_rows(
+                  ShardMerger::MergedShard const& merged
+                , BamHeader const& header
+                , std::vector<ChunkedType*> const& chunked
+                )
+        {
+            Shard const& shard = shards_[merged.slot];
+            char const* seq_name = header.seq_name(shard.tid);
+            RowAssigner row_assigner(header.seq_length(shard.tid), opts_.window_size);
+
+            typedef WindowSkipper<ChunkedType> SkipperType;
+            // the cache has every window
+            bool skips = opts_.skip_excluded_windows && !uses_cache(opts_);
+            ExcludedRegions const* skipped = skips ? excluded_ : 0;
+            std::vector<std::unique_ptr<SkipperType>> skippers;
+            std::vector<SkipperType*> skipper_ptrs;
+            for (std::size_t i = 0; i < chunked.size(); ++i) {
+                skippers.emplace_back(new SkipperType(*chunked[i], header,
+                    skipped, opts_.window_sizes[i]));
+                skipper_ptrs.push_back(skippers.back().get());
+            }
+            MultiResolutionPrinter<SkipperType> printer(skipper_ptrs,
+                window_factors(opts_), opts_.window_size, splits_starts(opts_));
+
+            for (std::size_t i = 0; i < merged.rows.size(); ++i) {
+                auto pos = row_assigner.start_pos_for_row(shard.begin_row + i) + 1;
+                if (merged.rows.width(i) == 0) {
+                    printer(seq_name, pos);
+                }
+                else {
+                    merged.rows.get_row(i, row_counts_);
+                    printer(seq_name, pos, row_counts_);
+                }
+            }
+            printer.flush();
+        }
+
+    private:
+        std::size_t idx_;
+        Options const& opts_;
+        std::vector<Shard> const& shards_;
+        WorkStealingQueue<std::size_t>& queue_;
+        ShardMerger& merger_;
+        ColumnAssignerBase const& col_assigner_;
+        std::vector<OrderedOutput*> const& outputs_;
+        // null unless the rows are printed as a bedgraph
+        SharedRunPrinters* run_printers_;
+        bool downsample_;
+        long seed_;
+        ExcludedRegions const* excluded_;
+        // the rows of a shard printed earlier, to count the next one into
+        ShardRows spare_rows_;
+        ShardRows::Counts row_counts_;
+
+    public:
+        WarningCollector warnings;
+        std::size_t total_read;
+        std::size_t total_filtered;
+        std::size_t total_excluded;
+        double io_stall;
+    };
+
+    // Writes one table of count_parallel() as its slots come in, so that
+    // no table piles up in memory while another is written. An error
+    // stops the writers of the other tables too.
+    class TableWriter {
+    public:
+        TableWriter(OrderedOutput& output, std::vector<OrderedOutput*> const& outputs)
+            : output_(output)
+            , outputs_(outputs)
+        {
+        }
+
+        void run() {
+            try {
+                output_.write_all();
+            }
+            catch (...) {
+                error = std::current_exception();
+                for (auto i = outputs_.begin(); i != outputs_.end(); ++i)
+                    (*i)->abort(error);
+            }
+        }
+
+    private:
+        OrderedOutput& output_;
+        std::vector<OrderedOutput*> const& outputs_;
+
+    public:
+        std::exception_ptr error;
+    };
+
+    // Counts one input of a cohort table (see BamWindow::count_cohort) on
+    // a thread of its own, handing its rows to the merger through queue.
+    // The reader is opened up front for its header; prepare() then sets
+    // up the columns and filters as exec() would for a single input.
+    class SampleWorker {
+    public:
+        SampleWorker(Options const& opts, std::string const& path)
+            : opts_(opts)
+            , streaming_(is_stream(opts, path))
+            , reader_(path, streaming_)
+            , sampler_(1.0f)
+        {
+            configure_reader(reader_, opts_);
+        }
+
+        BamReader& reader() { return reader_; }
+        bool streaming() const { return streaming_; }
+        ColumnAssignerBase const& col_assigner() const { return *col_assigner_; }
+
+        void prepare(
+                  std::vector<int32_t> const& seqs
+                , ExcludedRegions const* excluded
+                , Downsampler const& sampler
+                )
+        {
+            seqs_ = seqs;
+            seq_names_ = sequence_names(seqs, reader_.header());
+            filter_.reset(new BamFilter(opts_, excluded));
+            reader_.set_filter(filter_.get());
+            col_assigner_ = make_column_assigner(opts_, reader_);
+            reader_.set_read_tags(col_assigner_->needs_read_group());
+            warnings.reset(new WarningCollector(opts_, reader_.header().rg_to_lib_map()));
+            sampler_ = sampler;
+        }
+
+        void run() {
+            try {
+                SampleRowCollector collector(queue, seq_names_);
+                if (streaming_) {
+                    count_stream(seqs_, reader_, opts_, *col_assigner_, collector,
+                        *warnings, sampler_);
+                }
+                else {
+                    // the rest is not wanted if the merger stopped
+                    for (auto i = seqs_.begin(); i != seqs_.end() && !queue.cancelled(); ++i) {
+                        count_sequence(*i, reader_, opts_, *col_assigner_, collector,
+                            *warnings, sampler_);
+                    }
+                }
+                collector.finish();
+            }
+            catch (...) {
+                queue.abort(std::current_exception());
+            }
+        }
+
+    private:
+        Options const& opts_;
+        bool streaming_;
+        BamReader reader_;
+        std::unique_ptr<BamFilter> filter_;
+        std::unique_ptr<ColumnAssignerBase> col_assigner_;
+        std::vector<int32_t> seqs_;
+        std::vector<std::string> seq_names_;
+        Downsampler sampler_;
+
+    public:
+        SampleRowQueue queue;
+        std::unique_ptr<WarningCollector> warnings;
+    };
+
+    // Print the cohort table merged from the rows in queues (one for each
+    // input, see SampleWorker), as count_serial() prints the table of a
+    // single input.
+    template<typename RowPrinter>
+    void merge_cohort(
+              std::vector<SampleRowQueue*> const& queues
+            , CohortColumnAssigner& col_assigner
+            , std::vector<int32_t> const& seqs
+            , BamHeader const& header
+            , Options const& opts
+            , std::vector<std::ostream*> const& outs
+            , ExcludedRegions const* skipped
+            )
+    {
+        TablePrinters<RowPrinter> tables(outs, col_assigner, header, opts, skipped,
+            window_factors(opts), opts.window_size, splits_starts(opts));
+
+        std::vector<char const*> seq_names;
+        for (auto i = seqs.begin(); i != seqs.end(); ++i)
+            seq_names.push_back(header.seq_name(*i));
+
+        merge_sample_rows(queues, col_assigner, seq_names, count_starts(opts) ? 2 : 1,
+            tables.printer());
+        tables.printer().flush();
+    }
+
+    // The inputs of a cohort share the window grid; that needs the same
+    // sequences, of the same lengths, in the same order.
+    void check_same_sequences(
+              BamHeader const& header
+            , BamHeader const& other
+            , std::string const& path
+            , std::string const& other_path
+            )
+    {
+        bool same = header.num_seqs() == other.num_seqs();
+        for (int32_t i = 0; same && i < header.num_seqs(); ++i) {
+            same = strcmp(header.seq_name(i), other.seq_name(i)) == 0
+                && header.seq_length(i) == other.seq_length(i);
+        }
+        if (!same) {
+            throw std::runtime_error(str(format(
+                "%1% does not have the same sequences as %2%; the input files "
+                "of a cohort table must be aligned to the same reference."
+                ) % other_path % path));
+        }
+    }
 }
 
 BamWindow::BamWindow(Options const& opts)
     : opts_(opts)
+    , rng_seed_(0)
 {
     open_output_file();
 }
 
+BamWindow::~BamWindow() {
+}
+
 void BamWindow::open_output_file() {
-    if (!opts_.output_file.empty() && opts_.output_file != "-") {
-        output_file_ptr_.reset(new std::ofstream(opts_.output_file));
-        if (!output_file_ptr_->is_open()) {
-            throw std::runtime_error(str(format(
-                "Failed to open output file %1%"
-                ) % opts_.output_file));
+    if (opts_.bgzip) {
+        for (std::size_t i = 0; i < opts_.window_sizes.size(); ++i) {
+            std::string path = opts_.output_file.empty() ? "-" : opts_.output_file_for(i);
+            bgzf_outputs_.emplace_back(new BgzfOutput(path, opts_.bgzip_threads));
+            if (path != "-") {
+                bgzf_outputs_.back()->set_index(new TabixIndex(opts_.bedgraph_output()
+                    ? TabixIndex::bed_format() : TabixIndex::tsv_format()));
+            }
+            outs_.push_back(&bgzf_outputs_.back()->stream());
+        }
+    }
+    else if (!opts_.output_file.empty() && opts_.output_file != "-") {
+        for (std::size_t i = 0; i < opts_.window_sizes.size(); ++i) {
+            std::string path = opts_.output_file_for(i);
+            output_files_.emplace_back(new std::ofstream(path));
+            if (!output_files_.back()->is_open()) {
+                throw std::runtime_error(str(format(
+                    "Failed to open output file %1%"
+                    ) % path));
+            }
+            outs_.push_back(output_files_.back().get());
         }
-        out_ptr_ = output_file_ptr_.get();
     }
     else {
-        out_ptr_ = &std::cout;
+        outs_.push_back(&std::cout);
+    }
+}
+
+void BamWindow::close_output_files() {
+    for (auto i = bgzf_outputs_.begin(); i != bgzf_outputs_.end(); ++i)
+        (*i)->close();
+}
+
+void BamWindow::load_excluded_regions(BamHeader const& header) {
+    if (opts_.exclude_bed.empty())
+        return;
+
+    std::ifstream bed(opts_.exclude_bed.c_str());
+    if (!bed.is_open()) {
+        throw std::runtime_error(str(format(
+            "Failed to open excluded regions %1%"
+            ) % opts_.exclude_bed));
+    }
+    excluded_.reset(new ExcludedRegions(bed, header));
+
+    if (excluded_->num_ignored() > 0) {
+        std::cerr << "Ignored " << excluded_->num_ignored() << " excluded regions "
+            << "on sequences not in " << opts_.input_file << ".\n";
     }
 }
 
-bool BamWindow::configure_downsampling() const {
+bool BamWindow::configure_downsampling() {
     bool downsampling = opts_.downsample < 1.0f;
     if (downsampling) {
         auto now = std::chrono::system_clock::now().time_since_epoch();
@@ -79,54 +1327,482 @@ bool BamWindow::configure_downsampling() const {
             seed = opts_.seed;
 
         srand48(seed);
+        rng_seed_ = seed;
         std::clog << "RNG seed: " << seed << "\n";
     }
     return downsampling;
 }
 
-void BamWindow::exec() {
-    BamFilter filter(opts_);
-    BamReader reader(opts_.input_file);
-    reader.set_filter(&filter);
+void BamWindow::count_parallel(
+          std::vector<int32_t> const& seqs
+        , BamHeader const& header
+        , ColumnAssignerBase const& col_assigner
+        , bool downsample
+        , std::vector<std::ostream*> const& outs
+        , WarningCollector& warnings
+        , std::size_t& total_read
+        , std::size_t& total_filtered
+        , std::size_t& total_excluded
+        , double& io_stall
+        )
+{
+    std::vector<bool> ends_sequence;
+    std::vector<Shard> shards = make_shards(seqs, header, opts_, ends_sequence);
+    ShardMerger merger(ends_sequence);
+    std::vector<std::unique_ptr<OrderedOutput>> outputs;
+    std::vector<OrderedOutput*> output_ptrs;
+    for (auto i = outs.begin(); i != outs.end(); ++i) {
+        outputs.emplace_back(new OrderedOutput(**i, shards.size()));
+        output_ptrs.push_back(outputs.back().get());
+    }
+
+    std::size_t n_workers = std::min(std::size_t(opts_.num_workers), shards.size());
+    WorkStealingQueue<std::size_t> queue(n_workers);
+    for (std::size_t i = 0; i < shards.size(); ++i)
+        queue.push(i % n_workers, i);
+
+    std::unique_ptr<SharedRunPrinters> run_printers;
+    if (opts_.bedgraph_output() && !defers_rows(opts_, col_assigner)) {
+        run_printers.reset(new SharedRunPrinters(output_ptrs, col_assigner, header, opts_,
+            shards.size()));
+    }
+
+    std::vector<std::unique_ptr<ShardWorker>> workers;
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < n_workers; ++i) {
+        workers.emplace_back(new ShardWorker(i, opts_, shards, queue, merger,
+            col_assigner, output_ptrs, run_printers.get(), header.rg_to_lib_map(),
+            downsample, rng_seed_, excluded_.get()));
+        threads.push_back(std::thread(&ShardWorker::run, workers.back().get()));
+    }
+
+    // the finest table is written here, any others on threads of their own
+    std::vector<std::unique_ptr<TableWriter>> writers;
+    std::vector<std::thread> writer_threads;
+    for (auto i = outputs.begin(); i != outputs.end(); ++i)
+        writers.emplace_back(new TableWriter(**i, output_ptrs));
+    for (std::size_t i = 1; i < writers.size(); ++i)
+        writer_threads.push_back(std::thread(&TableWriter::run, writers[i].get()));
+    writers[0]->run();
+    for (auto i = writer_threads.begin(); i != writer_threads.end(); ++i)
+        i->join();
+
+    for (auto i = writers.begin(); i != writers.end(); ++i) {
+        if ((*i)->error) {
+            queue.cancel();
+            for (auto j = threads.begin(); j != threads.end(); ++j)
+                j->join();
+            std::rethrow_exception((*i)->error);
+        }
+    }
+
+    for (auto i = threads.begin(); i != threads.end(); ++i)
+        i->join();
+
+    for (auto i = workers.begin(); i != workers.end(); ++i) {
+        warnings.merge((*i)->warnings);
+        total_read += (*i)->total_read;
+        total_filtered += (*i)->total_filtered;
+        total_excluded += (*i)->total_excluded;
+        io_stall += (*i)->io_stall;
+    }
+}
 
+void BamWindow::count_reads(
+          bool streaming
+        , std::vector<int32_t> const& seqs
+        , BamReader& reader
+        , ColumnAssignerBase const& col_assigner
+        , bool downsample
+        , std::vector<std::ostream*> const& outs
+        , WarningCollector& warnings
+        , std::size_t& total_read
+        , std::size_t& total_filtered
+        , std::size_t& total_excluded
+        , double& io_stall
+        )
+{
+    if (opts_.num_workers > 1 && !streaming) {
+        count_parallel(seqs, reader.header(), col_assigner, downsample, outs,
+            warnings, total_read, total_filtered, total_excluded, io_stall);
+        return;
+    }
+
+    Downsampler sampler(downsample ? opts_.downsample : 1.0f);
+    if (downsample && opts_.downsample_by_name)
+        sampler = Downsampler::by_name(opts_.downsample, rng_seed_);
+    // the cache has every window
+    bool skips = opts_.skip_excluded_windows && !uses_cache(opts_);
+    ExcludedRegions const* skipped = skips ? excluded_.get() : 0;
+    if (defers_rows(opts_, col_assigner)) {
+        count_serial<DeferredRowEncoder>(streaming, seqs, reader, opts_,
+            col_assigner, outs, warnings, sampler, skipped);
+    }
+    else if (opts_.bedgraph_output()) {
+        count_serial<RunRowPrinter>(streaming, seqs, reader, opts_,
+            col_assigner, outs, warnings, sampler, skipped);
+    }
+    else {
+        count_serial<DefaultRowPrinter>(streaming, seqs, reader, opts_,
+            col_assigner, outs, warnings, sampler, skipped);
+    }
+    total_read = reader.total_read();
+    total_filtered = reader.total_filtered();
+    total_excluded = reader.total_excluded();
+    io_stall = reader.io_stall_seconds();
+}
+
+std::unique_ptr<CountCache> BamWindow::open_count_cache(
+          std::vector<int32_t> const& seqs
+        , BamHeader const& header
+        )
+{
+    std::unique_ptr<CountCache> rv;
+    struct stat st;
+    if (stat(opts_.count_cache.c_str(), &st) != 0)
+        return rv;
+
+    std::string reason;
+    try {
+        rv.reset(new CountCache(opts_.count_cache));
+        if (rv->can_answer(CountCache::key_for(opts_, header), opts_.window_sizes,
+                sequence_names(seqs, header), reason))
+        {
+            return rv;
+        }
+    }
+    catch (std::exception const& e) {
+        reason = e.what();
+    }
+    rv.reset();
+    std::cerr << "Not using count cache " << opts_.count_cache << ": " << reason << "\n";
+    return rv;
+}
+
+std::unique_ptr<CountCache> BamWindow::build_count_cache(
+          bool streaming
+        , std::vector<int32_t> const& seqs
+        , BamReader& reader
+        , WarningCollector& warnings
+        , std::size_t& total_read
+        , std::size_t& total_filtered
+        , std::size_t& total_excluded
+        , double& io_stall
+        )
+{
     auto const& header = reader.header();
-    WarningCollector warnings(opts_, header.rg_to_lib_map());
+    CountCache::Key key = CountCache::key_for(opts_, header);
 
-    std::unique_ptr<ColumnAssignerBase> col_assigner = make_column_assigner(opts_, reader);
-    col_assigner->print_header(*out_ptr_);
+    // counted by library and read length (keeping reads without a
+    // library), whatever the columns of the tables
+    DiscoveringColumnAssigner cache_columns(header.rg_to_lib_map(), true, true);
+    reader.set_read_tags(true);
+    DeferredTable rows;
+    std::vector<std::ostream*> outs(1, &rows.rows());
+    count_reads(streaming, seqs, reader, cache_columns, false, outs,
+        warnings, total_read, total_filtered, total_excluded, io_stall);
 
-    DefaultRowPrinter printer(*out_ptr_, *col_assigner);
+    // written next to the old cache and moved over it when complete
+    std::string tmp_path = opts_.count_cache + ".tmp";
+    try {
+        CountCache::Writer writer(tmp_path, key, opts_.window_size, count_starts(opts_),
+            cache_columns.library_names(), cache_columns.column_keys(),
+            sequence_names(seqs, header));
+        rows.replay_stored(writer);
+        writer.finish();
+    }
+    catch (...) {
+        unlink(tmp_path.c_str());
+        throw;
+    }
+    if (rename(tmp_path.c_str(), opts_.count_cache.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        throw std::runtime_error(str(format(
+            "Failed to write count cache %1%: %2%"
+            ) % opts_.count_cache % strerror(errno)));
+    }
+
+    return std::unique_ptr<CountCache>(new CountCache(opts_.count_cache));
+}
+
+void BamWindow::estimate_counts() {
+    BamReader reader(opts_.input_file);
+    auto const& header = reader.header();
+    auto seqs = configure_sequences(opts_.sequence_names, header);
+
+    SingleColumnAssigner col_assigner;
+    IndexEstimator estimator(reader.index());
+
+    uint64_t total = 0;
+    if (opts_.binary_output()) {
+        BinaryTablePrinter printer(*outs_[0], col_assigner, header, opts_.window_size);
+        total = print_estimates(estimator, seqs, header, opts_, printer);
+        printer.finish();
+    }
+    else if (opts_.bedgraph_output()) {
+        RunRowPrinter::print_header(*outs_[0], col_assigner, header, seqs, opts_.window_size);
+        RunRowPrinter printer(*outs_[0], col_assigner, header, opts_.window_size);
+        total = print_estimates(estimator, seqs, header, opts_, printer);
+    }
+    else {
+        col_assigner.print_header(*outs_[0]);
+        DefaultRowPrinter printer(*outs_[0], col_assigner);
+        total = print_estimates(estimator, seqs, header, opts_, printer);
+    }
+
+    close_output_files();
+    std::cerr << "Estimated " << total << " reads from the index.\n";
+}
+
+void BamWindow::count_cohort() {
+    std::vector<std::unique_ptr<SampleWorker>> inputs;
+    bool streaming = false;
+    for (auto i = opts_.input_files.begin(); i != opts_.input_files.end(); ++i) {
+        inputs.emplace_back(new SampleWorker(opts_, *i));
+        streaming = streaming || inputs.back()->streaming();
+    }
+
+    auto const& header = inputs[0]->reader().header();
+    for (std::size_t i = 1; i < inputs.size(); ++i) {
+        check_same_sequences(header, inputs[i]->reader().header(),
+            opts_.input_files[0], opts_.input_files[i]);
+    }
+    load_excluded_regions(header);
+
+    auto seqs = configure_sequences(opts_.sequence_names, header);
+    // streams give their sequences in header order; the others follow
+    if (streaming)
+        std::sort(seqs.begin(), seqs.end());
     bool downsample = configure_downsampling();
 
-    BamEntry e;
+    std::vector<std::string> sample_names;
+    std::vector<ColumnAssignerBase const*> input_columns;
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+        // each input draws from a stream of its own
+        Downsampler sampler(1.0f);
+        if (downsample && opts_.downsample_by_name)
+            sampler = Downsampler::by_name(opts_.downsample, rng_seed_);
+        else if (downsample)
+            sampler = Downsampler(opts_.downsample, rng_seed_, int32_t(i), 0);
+
+        inputs[i]->prepare(seqs, excluded_.get(), sampler);
+        sample_names.push_back(opts_.sample_name_for(i));
+        input_columns.push_back(&inputs[i]->col_assigner());
+    }
+    CohortColumnAssigner col_assigner(sample_names, input_columns);
+
+    std::vector<std::unique_ptr<DeferredTable>> deferred;
+    std::vector<std::ostream*> rows_outs = start_tables(col_assigner, header, seqs, deferred);
+
+    std::vector<SampleRowQueue*> queues;
+    std::vector<std::thread> threads;
+    for (auto i = inputs.begin(); i != inputs.end(); ++i) {
+        queues.push_back(&(*i)->queue);
+        threads.push_back(std::thread(&SampleWorker::run, i->get()));
+    }
+
+    try {
+        ExcludedRegions const* skipped = opts_.skip_excluded_windows ? excluded_.get() : 0;
+        if (!deferred.empty()) {
+            merge_cohort<DeferredRowEncoder>(queues, col_assigner, seqs, header, opts_,
+                rows_outs, skipped);
+        }
+        else if (opts_.bedgraph_output()) {
+            merge_cohort<RunRowPrinter>(queues, col_assigner, seqs, header, opts_,
+                rows_outs, skipped);
+        }
+        else {
+            merge_cohort<DefaultRowPrinter>(queues, col_assigner, seqs, header, opts_,
+                rows_outs, skipped);
+        }
+    }
+    catch (...) {
+        for (auto i = queues.begin(); i != queues.end(); ++i)
+            (*i)->cancel();
+        for (auto i = threads.begin(); i != threads.end(); ++i)
+            i->join();
+        throw;
+    }
+    for (auto i = threads.begin(); i != threads.end(); ++i)
+        i->join();
+
+    finish_tables(col_assigner, header, seqs, deferred);
+    close_output_files();
+
+    std::size_t total_read = 0;
+    std::size_t total_filtered = 0;
+    std::size_t total_excluded = 0;
+    double io_stall = 0.0;
+    for (auto i = inputs.begin(); i != inputs.end(); ++i) {
+        BamReader& reader = (*i)->reader();
+        total_read += reader.total_read();
+        total_filtered += reader.total_filtered();
+        total_excluded += reader.total_excluded();
+        io_stall += reader.io_stall_seconds();
+    }
+    print_totals(total_read, total_filtered, total_excluded, io_stall);
+
+    // the warnings of each input are about its own read groups
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+        std::stringstream ss;
+        inputs[i]->warnings->print(ss);
+        std::string line;
+        while (std::getline(ss, line))
+            std::cerr << sample_names[i] << ": " << line << "\n";
+    }
+}
+
+void BamWindow::exec() {
+    if (opts_.estimate) {
+        estimate_counts();
+        return;
+    }
+
+    if (opts_.cohort()) {
+        count_cohort();
+        return;
+    }
+
+    bool streaming = is_stream(opts_, opts_.input_file);
+    BamReader reader(opts_.input_file, streaming);
+    configure_reader(reader, opts_);
+
+    auto const& header = reader.header();
+    load_excluded_regions(header);
+    BamFilter filter(opts_, excluded_.get());
+    reader.set_filter(&filter);
+    WarningCollector warnings(opts_, header.rg_to_lib_map());
+
     auto seqs = configure_sequences(opts_.sequence_names, header);
-    reader.clear_counts();
-    for (auto iter = seqs.begin(); iter != seqs.end(); ++iter) {
-        auto i = *iter;
-        reader.set_sequence_idx(i);
-        char const* seq_name = header.seq_name(i);
-        assert(seq_name != 0);
-        uint32_t seq_len = header.seq_length(i);
-        RowAssigner row_assigner(seq_len, opts_.window_size);
-        row_assigner.set_start_only(opts_.leftmost);
-        TableBuilder<> builder(
-              seq_name
-            , row_assigner
-            , *col_assigner
-            , printer
-            , warnings);
+    bool downsample = configure_downsampling();
 
-        while (reader.next(e)) {
-            if (!downsample || (drand48() < opts_.downsample))
-                builder(e);
+    std::size_t total_read = 0;
+    std::size_t total_filtered = 0;
+    std::size_t total_excluded = 0;
+    double io_stall = 0.0;
+
+    std::unique_ptr<CountCache> cache;
+    std::unique_ptr<ColumnAssignerBase> col_assigner;
+    bool reads_counted = true;
+    if (uses_cache(opts_)) {
+        cache = open_count_cache(seqs, header);
+        reads_counted = !cache;
+        if (!cache) {
+            cache = build_count_cache(streaming, seqs, reader, warnings,
+                total_read, total_filtered, total_excluded, io_stall);
         }
+        col_assigner = cached_column_assigner(*cache, seqs, header, opts_);
     }
+    else {
+        col_assigner = make_column_assigner(opts_, reader);
+        reader.set_read_tags(col_assigner->needs_read_group());
+    }
+
+    std::vector<std::unique_ptr<DeferredTable>> deferred;
+    std::vector<std::ostream*> rows_outs = start_tables(*col_assigner, header, seqs, deferred);
 
-    std::cerr << "Processed " << reader.total_read() << " reads";
-    auto nfilt = reader.total_filtered();
-    if (nfilt) {
-        std::cerr << " (" << nfilt << " filtered).";
+    if (cache) {
+        ExcludedRegions const* skipped = opts_.skip_excluded_windows ? excluded_.get() : 0;
+        if (!deferred.empty()) {
+            print_cached<DeferredRowEncoder>(*cache, seqs, header, opts_,
+                *col_assigner, rows_outs, warnings, skipped);
+        }
+        else if (opts_.bedgraph_output()) {
+            print_cached<RunRowPrinter>(*cache, seqs, header, opts_,
+                *col_assigner, rows_outs, warnings, skipped);
+        }
+        else {
+            print_cached<DefaultRowPrinter>(*cache, seqs, header, opts_,
+                *col_assigner, rows_outs, warnings, skipped);
+        }
     }
-    std::cerr << "\n";
+    else {
+        count_reads(streaming, seqs, reader, *col_assigner, downsample, rows_outs,
+            warnings, total_read, total_filtered, total_excluded, io_stall);
+    }
+
+    finish_tables(*col_assigner, header, seqs, deferred);
+    close_output_files();
+
+    if (!reads_counted) {
+        std::cerr << "Counted from " << opts_.count_cache << " without reading any alignments.\n";
+        warnings.print(std::cerr);
+        return;
+    }
+
+    print_totals(total_read, total_filtered, total_excluded, io_stall);
     warnings.print(std::cerr);
 }
+
+std::vector<std::ostream*> BamWindow::start_tables(
+          ColumnAssignerBase const& col_assigner
+        , BamHeader const& header
+        , std::vector<int32_t> const& seqs
+        , std::vector<std::unique_ptr<DeferredTable>>& deferred
+        )
+{
+    std::vector<std::ostream*> rv(outs_);
+    for (std::size_t i = 0; i < outs_.size(); ++i) {
+        if (defers_rows(opts_, col_assigner)) {
+            deferred.emplace_back(new DeferredTable);
+            rv[i] = &deferred.back()->rows();
+        }
+        else if (opts_.bedgraph_output()) {
+            RunRowPrinter::print_header(*outs_[i], col_assigner, header, seqs,
+                opts_.window_sizes[i]);
+        }
+        else {
+            col_assigner.print_header(*outs_[i]);
+        }
+    }
+    return rv;
+}
+
+void BamWindow::finish_tables(
+          ColumnAssignerBase const& col_assigner
+        , BamHeader const& header
+        , std::vector<int32_t> const& seqs
+        , std::vector<std::unique_ptr<DeferredTable>>& deferred
+        )
+{
+    for (std::size_t i = 0; i < deferred.size(); ++i) {
+        if (opts_.binary_output()) {
+            BinaryTablePrinter printer(*outs_[i], col_assigner, header, opts_.window_sizes[i]);
+            deferred[i]->replay(printer, col_assigner);
+            printer.finish();
+        }
+        else if (opts_.bedgraph_output()) {
+            RunRowPrinter::print_header(*outs_[i], col_assigner, header, seqs,
+                opts_.window_sizes[i]);
+            RunRowPrinter printer(*outs_[i], col_assigner, header, opts_.window_sizes[i]);
+            deferred[i]->replay(printer, col_assigner);
+        }
+        else {
+            deferred[i]->write(*outs_[i], col_assigner);
+        }
+    }
+}
+
+void BamWindow::print_totals(
+          std::size_t total_read
+        , std::size_t total_filtered
+        , std::size_t total_excluded
+        , double io_stall
+        )
+{
+    std::cerr << "Processed " << total_read << " reads";
+    if (total_filtered && excluded_) {
+        std::cerr << " (" << total_filtered << " filtered, "
+            << total_excluded << " in excluded regions).";
+    }
+    else if (total_filtered) {
+        std::cerr << " (" << total_filtered << " filtered).";
+    }
+    else if (excluded_) {
+        std::cerr << " (" << total_excluded << " in excluded regions).";
+    }
+    std::cerr << "\n";
+    if (opts_.prefetch_depth > 0) {
+        std::cerr << format("Stalled %.3f seconds waiting for read-ahead.\n") % io_stall;
+    }
+}
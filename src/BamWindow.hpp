@@ -1,5 +1,6 @@
 #pragma once
 
+#include "BamHeader.hpp"
 #include "Options.hpp"
 
 #include <cstdint>
@@ -7,22 +8,122 @@
 #include <memory>
 #include <vector>
 
+class BamReader;
+class BgzfOutput;
+struct ColumnAssignerBase;
+class CountCache;
+class DeferredTable;
+class ExcludedRegions;
+class WarningCollector;
+
 class BamWindow {
 public:
     BamWindow(Options const& opts);
+    ~BamWindow();
 
     void exec();
 
 protected:
-    bool configure_downsampling() const;
+    bool configure_downsampling();
     void open_output_file();
+    // Finish compressed output (with -z), which reports errors writing it
+    void close_output_files();
+    // Read --exclude-bed, if given, into excluded_
+    void load_excluded_regions(BamHeader const& header);
+
+    // Count the reads of seqs into outs (one per window size), on workers
+    // (see count_parallel) unless streaming
+    void count_reads(
+              bool streaming
+            , std::vector<int32_t> const& seqs
+            , BamReader& reader
+            , ColumnAssignerBase const& col_assigner
+            , bool downsample
+            , std::vector<std::ostream*> const& outs
+            , WarningCollector& warnings
+            , std::size_t& total_read
+            , std::size_t& total_filtered
+            , std::size_t& total_excluded
+            , double& io_stall
+            );
+
+    // The count cache (--count-cache) if it can answer this run, null if
+    // it cannot or does not exist
+    std::unique_ptr<CountCache> open_count_cache(
+              std::vector<int32_t> const& seqs
+            , BamHeader const& header
+            );
+    // Count the reads of seqs into a new count cache, replacing the old one
+    std::unique_ptr<CountCache> build_count_cache(
+              bool streaming
+            , std::vector<int32_t> const& seqs
+            , BamReader& reader
+            , WarningCollector& warnings
+            , std::size_t& total_read
+            , std::size_t& total_filtered
+            , std::size_t& total_excluded
+            , double& io_stall
+            );
+
+    // Print approximate counts from the bam index (see IndexEstimator)
+    // instead of reading the alignments.
+    void estimate_counts();
+
+    // Count several inputs into one table (see CohortTable.hpp): each
+    // input is counted on a thread of its own and their rows are merged
+    // as they come.
+    void count_cohort();
+
+    // Print the header of each table (one per window size) in outs_, or
+    // hold its rows in a DeferredTable added to deferred until
+    // finish_tables(). Returns the streams that rows go to.
+    std::vector<std::ostream*> start_tables(
+              ColumnAssignerBase const& col_assigner
+            , BamHeader const& header
+            , std::vector<int32_t> const& seqs
+            , std::vector<std::unique_ptr<DeferredTable>>& deferred
+            );
+    // Write out the tables held back by start_tables()
+    void finish_tables(
+              ColumnAssignerBase const& col_assigner
+            , BamHeader const& header
+            , std::vector<int32_t> const& seqs
+            , std::vector<std::unique_ptr<DeferredTable>>& deferred
+            );
+    void print_totals(
+              std::size_t total_read
+            , std::size_t total_filtered
+            , std::size_t total_excluded
+            , double io_stall
+            );
+
+    // Split sequences into shards of about opts_.shard_size bases and count
+    // them on opts_.num_workers threads, each with its own reader. Rows go
+    // to outs (one per window size) just as they would on the serial path.
+    void count_parallel(
+              std::vector<int32_t> const& seqs
+            , BamHeader const& header
+            , ColumnAssignerBase const& col_assigner
+            , bool downsample
+            , std::vector<std::ostream*> const& outs
+            , WarningCollector& warnings
+            , std::size_t& total_read
+            , std::size_t& total_filtered
+            , std::size_t& total_excluded
+            , double& io_stall
+            );
 
 private:
     Options const& opts_;
+    long rng_seed_;
+    std::unique_ptr<ExcludedRegions> excluded_;
 
-    // optional output file ptr
-    std::unique_ptr<std::ofstream> output_file_ptr_;
+    // output files, one per window size, if -o is given
+    std::vector<std::unique_ptr<std::ofstream>> output_files_;
+    // compressed output (to files or stdout), one per window size, with -z
+    std::vector<std::unique_ptr<BgzfOutput>> bgzf_outputs_;
 
-    // will point to output_file_ptr_ if -o is given, std::cout otherwise
-    std::ostream* out_ptr_;
+    // will point to output_files_ (or bgzf_outputs_) if -o is given,
+    // std::cout otherwise
+    std::vector<std::ostream*> outs_;
 };
@@ -0,0 +1,97 @@
+#include "BgzfOutput.hpp"
+#include "TabixIndex.hpp"
+
+#include <boost/format.hpp>
+
+#include <stdexcept>
+
+#include <unistd.h>
+
+using boost::format;
+
+namespace {
+    // blocks each compression thread takes at a time
+    int const SUB_BLOCKS = 64;
+}
+
+BgzfOutput::BgzfOutput(std::string const& path, int n_threads)
+    : path_(path)
+    , fp_(0)
+    , buffer_(*this)
+    , os_(&buffer_)
+{
+    if (path == "-")
+        fp_ = bgzf_dopen(STDOUT_FILENO, "w");
+    else
+        fp_ = bgzf_open(path.c_str(), "w");
+
+    if (!fp_) {
+        throw std::runtime_error(str(format(
+            "Failed to open output file %1%"
+            ) % path));
+    }
+
+    if (n_threads > 1)
+        bgzf_mt(fp_, n_threads, SUB_BLOCKS);
+}
+
+BgzfOutput::~BgzfOutput() {
+    if (fp_)
+        bgzf_close(fp_);
+}
+
+void BgzfOutput::set_index(TabixIndex* index) {
+    index_.reset(index);
+    bgzf_set_block_callback(fp_, index ? &BgzfOutput::block_written : 0, index);
+}
+
+void BgzfOutput::close() {
+    BGZF* fp = fp_;
+    fp_ = 0;
+    if (!os_ || bgzf_close(fp) != 0) {
+        throw std::runtime_error(str(format(
+            "Failed to write output file %1%"
+            ) % path_));
+    }
+
+    if (index_error_)
+        std::rethrow_exception(index_error_);
+    if (index_)
+        index_->write(path_ + ".tbi");
+}
+
+void BgzfOutput::block_written(void* data, int64_t address, int compressed_length,
+    int uncompressed_length)
+{
+    static_cast<TabixIndex*>(data)->add_block(address, compressed_length, uncompressed_length);
+}
+
+bool BgzfOutput::write(char const* data, std::size_t n) {
+    if (bgzf_write(fp_, data, n) != ssize_t(n) || fp_->errcode)
+        return false;
+    if (!index_)
+        return true;
+
+    // the stream would turn an exception into a bad bit
+    try {
+        index_->add_text(data, n);
+    }
+    catch (...) {
+        index_error_ = std::current_exception();
+        bgzf_set_block_callback(fp_, 0, 0);
+        index_.reset();
+    }
+    return true;
+}
+
+std::streamsize BgzfOutput::Buffer::xsputn(char const* s, std::streamsize n) {
+    return output_.write(s, n) ? n : 0;
+}
+
+BgzfOutput::Buffer::int_type BgzfOutput::Buffer::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+
+    char ch = traits_type::to_char_type(c);
+    return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <bgzf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+class TabixIndex;
+
+// Output stream that writes BGZF, compressing blocks on n_threads threads
+// (see bgzf_mt; 1 compresses on the writing thread). Given a TabixIndex,
+// the text is indexed as it goes and close() writes the index to
+// path.tbi.
+class BgzfOutput {
+public:
+    // path - is standard output
+    BgzfOutput(std::string const& path, int n_threads);
+    // Closes the file if close() was not called, ignoring errors
+    ~BgzfOutput();
+
+    BgzfOutput(BgzfOutput const&) = delete;
+    BgzfOutput& operator=(BgzfOutput const&) = delete;
+
+    std::ostream& stream() { return os_; }
+
+    // Takes ownership of index
+    void set_index(TabixIndex* index);
+
+    // Write what is left, the end of file marker and the index. Throws
+    // if any of it fails, or if the text could not be indexed.
+    void close();
+
+private:
+    class Buffer : public std::streambuf {
+    public:
+        explicit Buffer(BgzfOutput& output) : output_(output) {}
+
+    protected:
+        std::streamsize xsputn(char const* s, std::streamsize n);
+        int_type overflow(int_type c);
+
+    private:
+        BgzfOutput& output_;
+    };
+
+    static void block_written(void* data, int64_t address, int compressed_length,
+        int uncompressed_length);
+
+    bool write(char const* data, std::size_t n);
+
+private:
+    std::string path_;
+    BGZF* fp_;
+    std::unique_ptr<TabixIndex> index_;
+    // why the text could not be indexed, reported by close()
+    std::exception_ptr index_error_;
+    Buffer buffer_;
+    std::ostream os_;
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+// Reader for tables written with --output-format binary. It depends on
+// nothing but the standard library and POSIX, so tools that load tables
+// can copy this header as it is.
+//
+// Layout (integers little endian):
+//
+//   "BWINTBL1"
+//   a block for each sequence: one array of num_windows cells for each
+//   column, column after column. Cells are cell_width (1, 2, 4 or 8)
+//   bytes wide, the narrowest that holds the largest count of the
+//   sequence; blocks start at multiples of 8 bytes.
+//   the index:
+//     u32 window size
+//     u32 number of columns, then the name of each
+//     u32 number of sequences, then for each:
+//       name, u32 length, u32 num_windows, u32 cell_width, u64 block offset
+//     (names are a u32 length and that many bytes)
+//   u64 offset of the index
+//   "BWINTBL1"
+//
+// The index comes last so that tables can be written front to back (to
+// a pipe, say) with one sequence in memory at a time.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class BinaryTable {
+public:
+    static char const* magic() { return "BWINTBL1"; }
+    enum { MAGIC_SIZE = 8, BLOCK_ALIGN = 8 };
+
+    struct Sequence {
+        std::string name;
+        uint32_t length;
+        uint32_t num_windows;
+        uint32_t cell_width;
+        uint64_t offset;
+    };
+
+    // The counts of one column in one sequence, left in place in the
+    // mapping (which must outlive this)
+    class Column {
+    public:
+        Column(void const* data, std::size_t size, unsigned cell_width)
+            : data_(static_cast<char const*>(data))
+            , size_(size)
+            , cell_width_(cell_width)
+        {
+        }
+
+        std::size_t size() const { return size_; }
+        unsigned cell_width() const { return cell_width_; }
+
+        uint64_t operator[](std::size_t row) const {
+            switch (cell_width_) {
+            case 1: return cells<uint8_t>()[row];
+            case 2: return cells<uint16_t>()[row];
+            case 4: return cells<uint32_t>()[row];
+            default: return cells<uint64_t>()[row];
+            }
+        }
+
+        // The cells as an array of T; null unless they are T wide
+        template<typename T>
+        T const* cells() const {
+            if (sizeof(T) != cell_width_)
+                return 0;
+            return reinterpret_cast<T const*>(data_);
+        }
+
+    private:
+        char const* data_;
+        std::size_t size_;
+        unsigned cell_width_;
+    };
+
+    explicit BinaryTable(std::string const& path)
+        : path_(path)
+        , data_(0)
+        , size_(0)
+    {
+        uint16_t one = 1;
+        if (*reinterpret_cast<uint8_t const*>(&one) != 1)
+            throw std::runtime_error("Binary tables can only be read on little endian machines.");
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open binary table " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_ = st.st_size;
+            void* addr = mmap(0, size_, PROT_READ, MAP_SHARED, fd, 0);
+            data_ = addr == MAP_FAILED ? 0 : static_cast<char const*>(addr);
+        }
+        close(fd);
+        if (!data_)
+            throw std::runtime_error("Failed to map binary table " + path);
+
+        try {
+            read_index();
+        }
+        catch (...) {
+            munmap(const_cast<char*>(data_), size_);
+            throw;
+        }
+    }
+
+    ~BinaryTable() {
+        munmap(const_cast<char*>(data_), size_);
+    }
+
+    uint32_t window_size() const { return window_size_; }
+    std::vector<std::string> const& column_names() const { return column_names_; }
+    std::vector<Sequence> const& sequences() const { return sequences_; }
+
+    // -1 if there is no such sequence (or column)
+    int find_sequence(std::string const& name) const {
+        for (std::size_t i = 0; i < sequences_.size(); ++i) {
+            if (sequences_[i].name == name)
+                return i;
+        }
+        return -1;
+    }
+
+    int find_column(std::string const& name) const {
+        for (std::size_t i = 0; i < column_names_.size(); ++i) {
+            if (column_names_[i] == name)
+                return i;
+        }
+        return -1;
+    }
+
+    Column column(std::size_t seq, std::size_t col) const {
+        Sequence const& s = sequences_.at(seq);
+        if (col >= column_names_.size())
+            throw std::out_of_range("Binary table column out of range");
+        std::size_t column_bytes = std::size_t(s.num_windows) * s.cell_width;
+        return Column(data_ + s.offset + col * column_bytes, s.num_windows, s.cell_width);
+    }
+
+private:
+    BinaryTable(BinaryTable const&);
+    BinaryTable& operator=(BinaryTable const&);
+
+    // Reads values from [pos_, end_), failing on anything past the end
+    struct Cursor {
+        char const* pos;
+        char const* end;
+        std::string const* path;
+
+        void get(void* value, std::size_t n) {
+            if (std::size_t(end - pos) < n)
+                throw std::runtime_error(*path + " is not a valid binary table (truncated index)");
+            std::memcpy(value, pos, n);
+            pos += n;
+        }
+
+        uint32_t u32() {
+            uint32_t rv;
+            get(&rv, sizeof(rv));
+            return rv;
+        }
+
+        uint64_t u64() {
+            uint64_t rv;
+            get(&rv, sizeof(rv));
+            return rv;
+        }
+
+        std::string str() {
+            uint32_t len = u32();
+            if (std::size_t(end - pos) < len)
+                throw std::runtime_error(*path + " is not a valid binary table (truncated index)");
+            std::string rv(pos, len);
+            pos += len;
+            return rv;
+        }
+    };
+
+    void read_index() {
+        std::size_t trailer = sizeof(uint64_t) + MAGIC_SIZE;
+        if (size_ < MAGIC_SIZE + trailer
+            || std::memcmp(data_, magic(), MAGIC_SIZE) != 0
+            || std::memcmp(data_ + size_ - MAGIC_SIZE, magic(), MAGIC_SIZE) != 0)
+        {
+            throw std::runtime_error(path_ + " is not a binary table");
+        }
+
+        uint64_t index_offset;
+        std::memcpy(&index_offset, data_ + size_ - trailer, sizeof(index_offset));
+        if (index_offset < MAGIC_SIZE || index_offset > size_ - trailer)
+            throw std::runtime_error(path_ + " is not a valid binary table (bad index offset)");
+
+        Cursor in = {data_ + index_offset, data_ + size_ - trailer, &path_};
+        window_size_ = in.u32();
+        uint32_t n_cols = in.u32();
+        for (uint32_t i = 0; i < n_cols; ++i)
+            column_names_.push_back(in.str());
+
+        uint32_t n_seqs = in.u32();
+        for (uint32_t i = 0; i < n_seqs; ++i) {
+            Sequence s;
+            s.name = in.str();
+            s.length = in.u32();
+            s.num_windows = in.u32();
+            s.cell_width = in.u32();
+            s.offset = in.u64();
+
+            uint64_t block_size = uint64_t(s.num_windows) * s.cell_width * n_cols;
+            bool width_ok = s.cell_width == 1 || s.cell_width == 2
+                || s.cell_width == 4 || s.cell_width == 8;
+            if (!width_ok || s.offset % BLOCK_ALIGN != 0 || s.offset > index_offset
+                || block_size > index_offset - s.offset)
+            {
+                throw std::runtime_error(path_ + " is not a valid binary table (bad block for "
+                    + s.name + ")");
+            }
+            sequences_.push_back(s);
+        }
+    }
+
+private:
+    std::string path_;
+    char const* data_;
+    std::size_t size_;
+
+    uint32_t window_size_;
+    std::vector<std::string> column_names_;
+    std::vector<Sequence> sequences_;
+};
@@ -0,0 +1,225 @@
+#include "BinaryTablePrinter.hpp"
+#include "BamHeader.hpp"
+#include "ColumnAssigner.hpp"
+#include "RowAssigner.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using boost::format;
+
+namespace {
+    unsigned cell_width_for(uint64_t max_count) {
+        if (max_count <= std::numeric_limits<uint8_t>::max())
+            return 1;
+        if (max_count <= std::numeric_limits<uint16_t>::max())
+            return 2;
+        if (max_count <= std::numeric_limits<uint32_t>::max())
+            return 4;
+        return 8;
+    }
+}
+
+BinaryTablePrinter::BinaryTablePrinter(
+          std::ostream& os
+        , ColumnAssignerBase const& col_assigner
+        , BamHeader const& header
+        , uint32_t win_size
+        )
+    : os_(os)
+    , header_(header)
+    , win_size_(win_size)
+    , column_names_(col_assigner.output_column_names())
+    , offset_(0)
+    , have_sequence_(false)
+    , num_wins_(0)
+    , stride_(0)
+{
+    uint16_t one = 1;
+    if (*reinterpret_cast<uint8_t const*>(&one) != 1)
+        throw std::runtime_error("Binary tables can only be written on little endian machines.");
+
+    write(BinaryTable::magic(), BinaryTable::MAGIC_SIZE);
+}
+
+void BinaryTablePrinter::operator()(char const* seq_name, uint32_t pos) {
+    start_sequence(seq_name);
+    cover_row((pos - 1) / win_size_);
+}
+
+void BinaryTablePrinter::operator()(
+          char const* seq_name
+        , uint32_t pos
+        , std::vector<uint64_t> const& counts
+        )
+{
+    start_sequence(seq_name);
+    uint32_t row = (pos - 1) / win_size_;
+    cover_row(row);
+    assert(counts.size() <= column_names_.size());
+
+    // cells start out 0, and with many columns most counts are; skipping
+    // them saves a write to a far apart (column-major) cell
+    for (std::size_t c = 0; c < counts.size(); ++c) {
+        if (counts[c] == 0)
+            continue;
+
+        std::size_t idx = c * stride_ + row;
+        if (!wide_.empty()) {
+            wide_[idx] = counts[c];
+        }
+        else if (counts[c] > std::numeric_limits<uint32_t>::max()) {
+            wide_.assign(cells_.begin(), cells_.end());
+            cells_.clear();
+            wide_[idx] = counts[c];
+        }
+        else {
+            cells_[idx] = uint32_t(counts[c]);
+        }
+    }
+}
+
+void BinaryTablePrinter::finish() {
+    if (have_sequence_)
+        write_sequence();
+    have_sequence_ = false;
+
+    uint64_t index_offset = offset_;
+    uint32_t n_cols = column_names_.size();
+    write(&win_size_, sizeof(win_size_));
+    write(&n_cols, sizeof(n_cols));
+    for (auto i = column_names_.begin(); i != column_names_.end(); ++i) {
+        uint32_t len = i->size();
+        write(&len, sizeof(len));
+        write(i->data(), len);
+    }
+
+    uint32_t n_seqs = sequences_.size();
+    write(&n_seqs, sizeof(n_seqs));
+    for (auto i = sequences_.begin(); i != sequences_.end(); ++i) {
+        uint32_t len = i->name.size();
+        write(&len, sizeof(len));
+        write(i->name.data(), len);
+        write(&i->length, sizeof(i->length));
+        write(&i->num_windows, sizeof(i->num_windows));
+        write(&i->cell_width, sizeof(i->cell_width));
+        write(&i->offset, sizeof(i->offset));
+    }
+
+    write(&index_offset, sizeof(index_offset));
+    write(BinaryTable::magic(), BinaryTable::MAGIC_SIZE);
+}
+
+void BinaryTablePrinter::start_sequence(char const* seq_name) {
+    if (have_sequence_ && seq_name_ == seq_name)
+        return;
+
+    if (have_sequence_)
+        write_sequence();
+
+    int32_t tid = header_.seq_idx(seq_name);
+    if (tid < 0) {
+        throw std::runtime_error(str(format(
+            "Sequence %1% not found in bam file."
+            ) % seq_name));
+    }
+
+    seq_name_ = seq_name;
+    num_wins_ = RowAssigner(header_.seq_length(tid), win_size_).num_wins;
+    stride_ = num_wins_;
+    cells_.assign(std::size_t(stride_) * column_names_.size(), 0u);
+    wide_.clear();
+    have_sequence_ = true;
+}
+
+// Reads that run off the end of a sequence put rows past its last
+// window; the block grows to hold them, as the text table prints them.
+// Columns get room for half as many rows again, so that the (up to a
+// read length of) rows one at a time do not copy everything each time.
+void BinaryTablePrinter::cover_row(uint32_t row) {
+    if (row < num_wins_)
+        return;
+
+    num_wins_ = row + 1;
+    if (num_wins_ <= stride_)
+        return;
+
+    uint32_t stride = std::max(num_wins_, stride_ + stride_ / 2);
+    if (!wide_.empty())
+        wide_ = regrid(wide_, stride);
+    else
+        cells_ = regrid(cells_, stride);
+    stride_ = stride;
+}
+
+void BinaryTablePrinter::write_sequence() {
+    BinaryTable::Sequence seq;
+    seq.name = seq_name_;
+    seq.length = header_.seq_length(header_.seq_idx(seq_name_));
+    seq.num_windows = num_wins_;
+
+    uint64_t max_count = 0;
+    if (!wide_.empty())
+        max_count = *std::max_element(wide_.begin(), wide_.end());
+    else if (!cells_.empty())
+        max_count = *std::max_element(cells_.begin(), cells_.end());
+    seq.cell_width = cell_width_for(max_count);
+
+    static char const padding[BinaryTable::BLOCK_ALIGN] = {0};
+    write(padding, (BinaryTable::BLOCK_ALIGN - offset_ % BinaryTable::BLOCK_ALIGN) % BinaryTable::BLOCK_ALIGN);
+    seq.offset = offset_;
+    sequences_.push_back(seq);
+
+    for (std::size_t c = 0; c < column_names_.size(); ++c) {
+        std::size_t first = c * stride_;
+        switch (seq.cell_width) {
+        case 1:
+            write_cells<uint8_t>(cells_.data() + first, num_wins_);
+            break;
+        case 2:
+            write_cells<uint16_t>(cells_.data() + first, num_wins_);
+            break;
+        case 4:
+            write(cells_.data() + first, num_wins_ * sizeof(uint32_t));
+            break;
+        default:
+            write(wide_.data() + first, num_wins_ * sizeof(uint64_t));
+            break;
+        }
+    }
+}
+
+// Copy column-major cells, stride_ apart, to columns stride apart
+template<typename Cell>
+std::vector<Cell> BinaryTablePrinter::regrid(std::vector<Cell> const& cells, uint32_t stride) const {
+    std::vector<Cell> rv(std::size_t(stride) * column_names_.size(), Cell(0));
+    for (std::size_t c = 0; c < column_names_.size(); ++c) {
+        std::copy(cells.begin() + c * stride_, cells.begin() + (c + 1) * stride_,
+            rv.begin() + c * stride);
+    }
+    return rv;
+}
+
+// Narrow cells to Cell through buffer_, a chunk at a time
+template<typename Cell, typename Source>
+void BinaryTablePrinter::write_cells(Source const* cells, std::size_t n) {
+    static std::size_t const chunk = 1 << 16;
+    buffer_.resize(chunk * sizeof(Cell));
+    Cell* out = reinterpret_cast<Cell*>(buffer_.data());
+    for (std::size_t i = 0; i < n; i += chunk) {
+        std::size_t m = std::min(chunk, n - i);
+        for (std::size_t j = 0; j < m; ++j)
+            out[j] = Cell(cells[i + j]);
+        write(out, m * sizeof(Cell));
+    }
+}
+
+void BinaryTablePrinter::write(void const* data, std::size_t n) {
+    os_.write(static_cast<char const*>(data), n);
+    offset_ += n;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "BinaryTable.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class BamHeader;
+struct ColumnAssignerBase;
+
+// TableBuilder printer that writes a BinaryTable (see BinaryTable.hpp for
+// the layout) to os. Rows must come a sequence at a time, in order, with
+// their final columns (e.g., replayed by a DeferredTable); the counts of
+// the current sequence are held in memory, column by column, until the
+// next one starts. Windows without a row are 0; rows past the end of
+// the sequence (from reads running off it) add windows to it. Call finish() after the
+// last row to write the index.
+class BinaryTablePrinter {
+public:
+    BinaryTablePrinter(
+              std::ostream& os
+            , ColumnAssignerBase const& col_assigner
+            , BamHeader const& header
+            , uint32_t win_size
+            );
+
+    void operator()(char const* seq_name, uint32_t pos);
+    void operator()(
+              char const* seq_name
+            , uint32_t pos
+            , std::vector<uint64_t> const& counts
+            );
+
+    void finish();
+
+private:
+    // Move on to seq_name if rows of another sequence were coming in
+    void start_sequence(char const* seq_name);
+    void cover_row(uint32_t row);
+    void write_sequence();
+
+    template<typename Cell>
+    std::vector<Cell> regrid(std::vector<Cell> const& cells, uint32_t stride) const;
+
+    template<typename Cell, typename Source>
+    void write_cells(Source const* cells, std::size_t n);
+
+    void write(void const* data, std::size_t n);
+
+private:
+    std::ostream& os_;
+    BamHeader const& header_;
+    uint32_t win_size_;
+    std::vector<std::string> column_names_;
+    uint64_t offset_;
+    std::vector<BinaryTable::Sequence> sequences_;
+
+    // the sequence being filled in; cells are column-major, stride_ rows
+    // apart, and move to wide_ if a count does not fit in 32 bits
+    bool have_sequence_;
+    std::string seq_name_;
+    uint32_t num_wins_;
+    uint32_t stride_;
+    std::vector<uint32_t> cells_;
+    std::vector<uint64_t> wide_;
+    std::vector<char> buffer_;
+};
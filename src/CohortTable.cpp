@@ -0,0 +1,204 @@
+#include "CohortTable.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+using boost::format;
+
+//////////////////////////////////////////////////////////////////////
+// SampleRows
+void SampleRows::clear() {
+    seqs.clear();
+    positions.clear();
+    offsets.assign(1, 0);
+    counts.clear();
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// SampleRowQueue
+SampleRowQueue::SampleRowQueue(std::size_t capacity)
+    : capacity_(std::max(capacity, std::size_t(1)))
+    , closed_(false)
+    , cancelled_(false)
+{
+}
+
+bool SampleRowQueue::push(SampleRows& rows) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cancelled_ && chunks_.size() >= capacity_)
+        changed_.wait(lock);
+    if (cancelled_)
+        return false;
+
+    chunks_.push_back(SampleRows());
+    std::swap(chunks_.back(), rows);
+    changed_.notify_all();
+    return true;
+}
+
+void SampleRowQueue::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    changed_.notify_all();
+}
+
+void SampleRowQueue::abort(std::exception_ptr err) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_)
+        error_ = err;
+    closed_ = true;
+    changed_.notify_all();
+}
+
+void SampleRowQueue::cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    changed_.notify_all();
+}
+
+bool SampleRowQueue::cancelled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cancelled_;
+}
+
+bool SampleRowQueue::pop(SampleRows& rows) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!error_ && chunks_.empty() && !closed_)
+        changed_.wait(lock);
+    if (error_)
+        std::rethrow_exception(error_);
+    if (chunks_.empty())
+        return false;
+
+    std::swap(rows, chunks_.front());
+    chunks_.pop_front();
+    changed_.notify_all();
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// SampleRowCollector
+SampleRowCollector::SampleRowCollector(
+          SampleRowQueue& queue
+        , std::vector<std::string> const& seq_names
+        , std::size_t chunk_rows
+        )
+    : queue_(queue)
+    , chunk_rows_(std::max(chunk_rows, std::size_t(1)))
+    , last_name_(0)
+    , last_index_(0)
+{
+    for (std::size_t i = 0; i < seq_names.size(); ++i)
+        seq_indices_[seq_names[i]] = i;
+}
+
+void SampleRowCollector::operator()(char const* seq_name, uint32_t pos) {
+    end_row(seq_name, pos);
+}
+
+void SampleRowCollector::operator()(
+          char const* seq_name
+        , uint32_t pos
+        , std::vector<uint64_t> const& counts
+        )
+{
+    rows_.counts.insert(rows_.counts.end(), counts.begin(), counts.end());
+    end_row(seq_name, pos);
+}
+
+void SampleRowCollector::end_row(char const* seq_name, uint32_t pos) {
+    if (seq_name != last_name_) {
+        auto found = seq_indices_.find(seq_name);
+        if (found == seq_indices_.end()) {
+            throw std::runtime_error(str(format(
+                "Rows of sequence %1% are not part of the cohort table."
+                ) % seq_name));
+        }
+        last_name_ = seq_name;
+        last_index_ = found->second;
+    }
+
+    rows_.seqs.push_back(last_index_);
+    rows_.positions.push_back(pos);
+    rows_.offsets.push_back(rows_.counts.size());
+    if (rows_.size() >= chunk_rows_)
+        push();
+}
+
+void SampleRowCollector::push() {
+    if (!queue_.push(rows_))
+        rows_.clear();
+}
+
+void SampleRowCollector::finish() {
+    if (rows_.size() > 0)
+        push();
+    queue_.close();
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// CohortColumnAssigner
+CohortColumnAssigner::CohortColumnAssigner(
+          std::vector<std::string> const& sample_names
+        , std::vector<ColumnAssignerBase const*> const& inputs
+        )
+    : sample_names_(sample_names)
+    , inputs_(inputs)
+    , columns_(inputs.size())
+{
+    // fixed columns are known now, and stay in input order
+    for (std::size_t i = 0; i < inputs_.size(); ++i) {
+        if (inputs_[i]->fixed_columns())
+            columns(i, inputs_[i]->num_columns());
+    }
+}
+
+bool CohortColumnAssigner::fixed_columns() const {
+    for (auto i = inputs_.begin(); i != inputs_.end(); ++i) {
+        if (!(*i)->fixed_columns())
+            return false;
+    }
+    return true;
+}
+
+std::vector<std::size_t> const& CohortColumnAssigner::columns(std::size_t idx, std::size_t n) {
+    std::vector<std::size_t>& rv = columns_[idx];
+    for (std::size_t c = rv.size(); c < n; ++c) {
+        rv.push_back(sources_.size());
+        sources_.push_back(std::make_pair(idx, c));
+    }
+    return rv;
+}
+
+std::vector<std::string> CohortColumnAssigner::output_column_names() const {
+    std::vector<std::string> rv;
+    for (std::size_t i = 0; i < inputs_.size(); ++i) {
+        std::vector<std::string> names = inputs_[i]->output_column_names();
+        for (auto j = names.begin(); j != names.end(); ++j)
+            rv.push_back(sample_names_[i] + "." + *j);
+    }
+    return rv;
+}
+
+std::vector<std::size_t> CohortColumnAssigner::column_order() const {
+    // each input's columns start where the earlier inputs' end
+    std::vector<std::size_t> first(inputs_.size(), 0);
+    std::vector<std::vector<std::size_t>> orders;
+    for (std::size_t i = 0; i < inputs_.size(); ++i) {
+        if (i > 0)
+            first[i] = first[i - 1] + columns_[i - 1].size();
+        orders.push_back(inputs_[i]->column_order());
+    }
+
+    std::vector<std::size_t> rv(sources_.size());
+    for (std::size_t c = 0; c < sources_.size(); ++c) {
+        std::size_t input = sources_[c].first;
+        rv[c] = first[input] + orders[input][sources_[c].second];
+    }
+    return rv;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "ColumnAssigner.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A cohort table has the columns of several inputs (aligned to the same
+// reference) side by side. Each input is counted on a thread of its own,
+// which hands the rows of its TableBuilders over in chunks through a
+// bounded SampleRowQueue; merge_sample_rows() takes them from every queue
+// in lockstep. The inputs share the window grid, so memory stays at a few
+// chunks per input however large the inputs are.
+
+// Rows of one input in the order they were printed. Row i is at pos[i] of
+// sequence seqs[i] (an index into the cohort's sequences); its counts are
+// counts[offsets[i], offsets[i + 1]), none for an empty row.
+struct SampleRows {
+    SampleRows() : offsets(1, 0) {}
+
+    std::size_t size() const { return seqs.size(); }
+    void clear();
+
+    std::vector<uint32_t> seqs;
+    std::vector<uint32_t> positions;
+    std::vector<std::size_t> offsets;
+    std::vector<uint64_t> counts;
+};
+
+// Chunks of rows from the thread counting an input to the thread merging
+// the table. push() waits while capacity chunks are waiting, so an input
+// that gets ahead of the others holds no more than that.
+class SampleRowQueue {
+public:
+    explicit SampleRowQueue(std::size_t capacity = 4);
+
+    // Takes the rows (leaving rows empty); false if the queue was cancelled
+    bool push(SampleRows& rows);
+    // The input has no more rows
+    void close();
+    // Counting the input failed; pop() rethrows err
+    void abort(std::exception_ptr err);
+    // The merger stopped; push() returns false from now on
+    void cancel();
+    bool cancelled() const;
+
+    // Blocks until a chunk comes; false once the input is done and every
+    // chunk has been taken
+    bool pop(SampleRows& rows);
+
+private:
+    std::size_t capacity_;
+    std::deque<SampleRows> chunks_;
+    bool closed_;
+    bool cancelled_;
+    std::exception_ptr error_;
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+};
+
+// Printer for the TableBuilders of one input: collects their rows into
+// chunks of up to chunk_rows rows for queue. seq_names are the sequences
+// of the cohort, in order. Once the queue is cancelled, rows are dropped
+// (TableBuilders print from their destructors, so this cannot throw);
+// the counting thread should check SampleRowQueue::cancelled() to stop.
+class SampleRowCollector {
+public:
+    SampleRowCollector(
+              SampleRowQueue& queue
+            , std::vector<std::string> const& seq_names
+            , std::size_t chunk_rows = 4096
+            );
+
+    void operator()(char const* seq_name, uint32_t pos);
+    void operator()(
+              char const* seq_name
+            , uint32_t pos
+            , std::vector<uint64_t> const& counts
+            );
+
+    // Hand over the last rows and close the queue
+    void finish();
+
+private:
+    void end_row(char const* seq_name, uint32_t pos);
+    void push();
+
+private:
+    SampleRowQueue& queue_;
+    std::unordered_map<std::string, uint32_t> seq_indices_;
+    std::size_t chunk_rows_;
+    // names come from the input's header, so each sequence has one pointer
+    char const* last_name_;
+    uint32_t last_index_;
+    SampleRows rows_;
+};
+
+// The columns of a cohort table: those of each input's column assigner
+// in turn, named "<sample>.<column>". Columns of inputs that find them
+// while counting (see DiscoveringColumnAssigner) get cohort columns when
+// the merger first sees them; column_order() puts them back in input
+// order. Until merge_sample_rows() is done, only fixed columns have
+// names and an order.
+struct CohortColumnAssigner : ColumnAssignerBase {
+    CohortColumnAssigner(
+              std::vector<std::string> const& sample_names
+            , std::vector<ColumnAssignerBase const*> const& inputs
+            );
+
+    // the inputs' assigners count the reads
+    int assign_column(char const*, uint32_t) const { return -1; }
+    bool needs_read_group() const { return false; }
+
+    std::size_t num_columns() const { return sources_.size(); }
+    std::vector<std::string> output_column_names() const;
+    bool fixed_columns() const;
+    std::vector<std::size_t> column_order() const;
+
+    // The number of columns of input idx so far
+    std::size_t input_columns(std::size_t idx) const { return inputs_[idx]->num_columns(); }
+    // The cohort column of each of the first n columns of input idx
+    std::vector<std::size_t> const& columns(std::size_t idx, std::size_t n);
+
+private:
+    std::vector<std::string> sample_names_;
+    std::vector<ColumnAssignerBase const*> inputs_;
+    // cohort column of each column of each input
+    std::vector<std::vector<std::size_t>> columns_;
+    // (input, column of the input) of each cohort column
+    std::vector<std::pair<std::size_t, std::size_t>> sources_;
+};
+
+// Merge the rows of the inputs in queues into the rows of the cohort
+// table for printer (in the layout of TableBuilder rows: two cells per
+// column if step is 2). seq_names are the names to print rows under.
+// Every input has every window of the sequences, in the same order; only
+// the rows that reads push past the end of a sequence may be missing
+// from some, which count 0 for them.
+template<typename Printer>
+void merge_sample_rows(
+          std::vector<SampleRowQueue*> const& queues
+        , CohortColumnAssigner& col_assigner
+        , std::vector<char const*> const& seq_names
+        , std::size_t step
+        , Printer& printer
+        )
+{
+    std::size_t n_inputs = queues.size();
+    std::vector<SampleRows> chunks(n_inputs);
+    std::vector<std::size_t> next(n_inputs, 0);
+    std::vector<bool> done(n_inputs, false);
+    std::vector<std::size_t> in_row;
+    std::vector<uint64_t> counts;
+
+    while (true) {
+        // the next row is the first of those at the head of each input
+        bool found = false;
+        uint32_t seq = 0;
+        uint32_t pos = 0;
+        for (std::size_t i = 0; i < n_inputs; ++i) {
+            while (!done[i] && next[i] == chunks[i].size()) {
+                next[i] = 0;
+                done[i] = !queues[i]->pop(chunks[i]);
+            }
+            if (done[i])
+                continue;
+
+            uint32_t s = chunks[i].seqs[next[i]];
+            uint32_t p = chunks[i].positions[next[i]];
+            if (!found || s < seq || (s == seq && p < pos)) {
+                seq = s;
+                pos = p;
+            }
+            found = true;
+        }
+        if (!found)
+            break;
+
+        in_row.clear();
+        bool has_counts = false;
+        for (std::size_t i = 0; i < n_inputs; ++i) {
+            if (done[i] || chunks[i].seqs[next[i]] != seq || chunks[i].positions[next[i]] != pos)
+                continue;
+            in_row.push_back(i);
+            std::size_t n_cells = chunks[i].offsets[next[i] + 1] - chunks[i].offsets[next[i]];
+            if (n_cells > 0) {
+                col_assigner.columns(i, n_cells / step);
+                has_counts = true;
+            }
+        }
+
+        if (has_counts) {
+            counts.assign(step * col_assigner.num_columns(), 0u);
+            for (auto i = in_row.begin(); i != in_row.end(); ++i) {
+                SampleRows const& rows = chunks[*i];
+                std::size_t begin = rows.offsets[next[*i]];
+                std::size_t n_cols = (rows.offsets[next[*i] + 1] - begin) / step;
+                std::vector<std::size_t> const& columns = col_assigner.columns(*i, n_cols);
+                for (std::size_t c = 0; c < n_cols; ++c) {
+                    for (std::size_t k = 0; k < step; ++k)
+                        counts[step * columns[c] + k] = rows.counts[begin + step * c + k];
+                }
+            }
+            printer(seq_names[seq], pos, counts);
+        }
+        else {
+            printer(seq_names[seq], pos);
+        }
+
+        for (auto i = in_row.begin(); i != in_row.end(); ++i)
+            ++next[*i];
+    }
+
+    // columns found while counting that no row reached
+    for (std::size_t i = 0; i < n_inputs; ++i)
+        col_assigner.columns(i, col_assigner.input_columns(i));
+}
@@ -1,8 +1,10 @@
 #include "ColumnAssigner.hpp"
 #include "BamEntry.hpp"
+#include "BamFilter.hpp"
 #include "BamHeader.hpp"
 #include "BamReader.hpp"
 #include "Options.hpp"
+#include "ReadBatch.hpp"
 
 #include <boost/lexical_cast.hpp>
 
@@ -12,52 +14,123 @@
 #include <stdexcept>
 
 namespace {
-    PerLibReadLengths get_per_lib_read_lengths(
-          BamReader& reader
-        , std::size_t max_entries
-        )
+    // Reads taken at each sampling point
+    std::size_t const SAMPLE_BATCH = 64;
+
+    std::vector<int32_t> sampled_sequences(Options const& opts, BamHeader const& header) {
+        std::vector<int32_t> rv;
+        for (auto i = opts.sequence_names.begin(); i != opts.sequence_names.end(); ++i) {
+            int32_t idx = header.seq_idx(*i);
+            if (idx >= 0)
+                rv.push_back(idx);
+        }
+
+        if (opts.sequence_names.empty()) {
+            for (int32_t i = 0; i < header.num_seqs(); ++i)
+                rv.push_back(i);
+        }
+        return rv;
+    }
+
+    // Up to n_points linear index offsets of the given sequences, one near
+    // the middle of each of n_points equal slices of the compressed file
+    // (so they are spread over the reads rather than the genome).
+    std::vector<uint64_t> sample_offsets(
+              bam_index_t const* index
+            , std::vector<int32_t> const& tids
+            , std::size_t n_points
+            )
     {
-        auto const& rg2lib = reader.header().rg_to_lib_map();
-        BamEntry e;
-        PerLibReadLengths lens;
+        std::vector<uint64_t> offsets;
+        for (auto i = tids.begin(); i != tids.end(); ++i) {
+            uint64_t const* linear;
+            int n_tiles = bam_index_linear(index, *i, &linear);
+            for (int j = 0; j < n_tiles; ++j) {
+                if (linear[j] != 0)
+                    offsets.push_back(linear[j]);
+            }
+        }
+        std::sort(offsets.begin(), offsets.end());
+        offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+        if (offsets.size() <= n_points)
+            return offsets;
+
+        std::vector<uint64_t> rv;
+        uint64_t first = offsets.front() >> 16;
+        uint64_t span = (offsets.back() >> 16) - first;
+        for (std::size_t i = 0; i < n_points; ++i) {
+            uint64_t target = (first + span * (2 * i + 1) / (2 * n_points)) << 16;
+            auto where = std::lower_bound(offsets.begin(), offsets.end(), target);
+            if (rv.empty() || *where != rv.back())
+                rv.push_back(*where);
+        }
+        return rv;
+    }
 
-        reader.clear_region();
-        for (std::size_t i = 0; i < max_entries && reader.next(e); ++i) {
-            char const* rg = read_group(e);
-            if (!rg)
-                continue;
+    // Read lengths (by library if per_lib, otherwise all under "") of
+    // about opts.sample_reads reads that pass the filters, taken in small
+    // batches from all over the file. reader must have an index.
+    PerLibReadLengths sample_read_lengths(
+              Options const& opts
+            , BamReader const& reader
+            , bool per_lib
+            )
+    {
+        // a reader of its own so that the seeking does not trigger
+        // read-ahead or decompression threads
+        BamReader sampler(reader.path());
+        BamFilter filter(opts);
+        sampler.set_filter(&filter);
+        sampler.set_read_tags(per_lib);
 
-            auto iter = rg2lib.find(rg);
-            if (iter == rg2lib.end())
-                continue;
+        auto const& rg2lib = reader.header().rg_to_lib_map();
+        std::size_t budget = opts.sample_reads;
+        std::size_t n_points = (budget + SAMPLE_BATCH - 1) / SAMPLE_BATCH;
+        std::vector<uint64_t> offsets = sample_offsets(reader.index(),
+            sampled_sequences(opts, reader.header()), n_points);
 
-            auto const& lib = iter->second;
-            lens[lib].insert(length(e));
+        BamEntry e;
+        PerLibReadLengths lens;
+        for (auto i = offsets.begin(); i != offsets.end() && budget > 0; ++i) {
+            sampler.set_position(*i);
+            for (std::size_t j = 0; j < SAMPLE_BATCH && budget > 0 && sampler.next(e); ++j, --budget) {
+                if (!per_lib) {
+                    lens[""].insert(length(e));
+                    continue;
+                }
+
+                char const* rg = read_group(e);
+                if (!rg)
+                    continue;
+
+                auto iter = rg2lib.find(rg);
+                if (iter == rg2lib.end())
+                    continue;
+
+                lens[iter->second].insert(length(e));
+            }
         }
 
-        if (lens.empty()) {
+        if (per_lib && lens.empty()) {
             throw std::runtime_error(
                 "Unable to determine read lengths by library. "
                 "Are RG tags missing?");
         }
-
         return lens;
     }
 
-    std::vector<uint32_t> get_read_lengths(
-              BamReader& reader
-            , std::size_t max_entries
-            )
-    {
-        BamEntry e;
-        std::unordered_set<uint32_t> lens;
+    struct KeyOrder {
+        explicit KeyOrder(std::vector<uint64_t> const& keys)
+            : keys(keys)
+        {
+        }
 
-        for (std::size_t i = 0; i < max_entries && reader.next(e); ++i) {
-            lens.insert(length(e));
+        bool operator()(std::size_t a, std::size_t b) const {
+            return keys[a] < keys[b];
         }
 
-        return std::vector<uint32_t>(lens.begin(), lens.end());
-    }
+        std::vector<uint64_t> const& keys;
+    };
 }
 
 // All of the switching based on command line flags (report by lib, len) is
@@ -71,16 +144,16 @@ std::unique_ptr<ColumnAssignerBase> make_column_assigner(
 
     auto const& header = reader.header();
     if (opts.per_read_len) {
-        std::size_t first_n_reads = 1000000;
+        // streams have no index to sample from
+        if (opts.sample_reads == 0 || !reader.index())
+            return RV{new DiscoveringColumnAssigner(header.rg_to_lib_map(), opts.per_lib)};
 
-        if (opts.per_lib) {
-            auto read_lens = get_per_lib_read_lengths(reader, first_n_reads);
+        auto read_lens = sample_read_lengths(opts, reader, opts.per_lib);
+        if (opts.per_lib)
             return RV{new PerLibAndLengthColumnAssigner(header.rg_to_lib_map(), read_lens)};
-        }
-        else {
-            auto read_lens = get_read_lengths(reader, first_n_reads);
-            return RV{new PerLengthColumnAssigner(read_lens)};
-        }
+
+        auto const& lens = read_lens[""];
+        return RV{new PerLengthColumnAssigner(std::vector<uint32_t>(lens.begin(), lens.end()))};
     }
     else {
         if (opts.per_lib)
@@ -91,10 +164,67 @@ std::unique_ptr<ColumnAssignerBase> make_column_assigner(
 }
 
 
+//////////////////////////////////////////////////////////////////////
+// Batches
+void ColumnAssignerBase::assign_columns(ReadBatch& batch) const {
+    for (std::size_t i = 0; i < batch.size(); ++i)
+        batch.columns[i] = assign_column(batch.rg_name(i), batch.lengths[i]);
+}
+
+void SingleColumnAssigner::assign_columns(ReadBatch& batch) const {
+    std::fill(batch.columns.begin(), batch.columns.end(), 0);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Read group ids
+ReadGroupIndex::ReadGroupIndex(RgToLibMap const& rg2lib) {
+    static std::atomic<uint64_t> next_generation(1);
+    generation_ = next_generation++;
+
+    for (auto i = rg2lib.begin(); i != rg2lib.end(); ++i)
+        names_.push_back(i->first);
+
+    // names_ won't change any more, so the keys can point into it
+    for (std::size_t i = 0; i < names_.size(); ++i)
+        ids_[KeyType(names_[i].c_str())] = i;
+}
+
+ReadGroupIndex::LastFound& ReadGroupIndex::last_found() {
+    static thread_local LastFound last = {0, 0};
+    return last;
+}
+
+int ReadGroupIndex::lookup(char const* rg) const {
+    auto found = ids_.find(rg);
+    if (found == ids_.end())
+        return -1;
+    return found->second;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Read length -> column
+LengthTable::LengthTable(std::set<uint32_t> const& lens, int first_col) {
+    int col = first_col;
+    for (auto i = lens.begin(); i != lens.end(); ++i, ++col) {
+        if (*i >= MAX_LEN) {
+            long_reads_[*i] = col;
+            continue;
+        }
+
+        if (columns_.size() <= *i)
+            columns_.resize(*i + 1, -1);
+        columns_[*i] = col;
+    }
+}
+
+
 //////////////////////////////////////////////////////////////////////
 // Per Length
 PerLengthColumnAssigner::PerLengthColumnAssigner(std::vector<uint32_t> const& lens)
     : read_lens(lens.begin(), lens.end())
+    , columns_(std::set<uint32_t>(lens.begin(), lens.end()), 0)
 {
     for (auto i = read_lens.begin(); i != read_lens.end(); ++i) {
         column_names.push_back(boost::lexical_cast<std::string>(*i));
@@ -102,10 +232,12 @@ PerLengthColumnAssigner::PerLengthColumnAssigner(std::vector<uint32_t> const& le
 }
 
 int PerLengthColumnAssigner::assign_column(char const* rg, uint32_t read_len) const {
-    auto found = read_lens.find(read_len);
-    if (found == read_lens.end())
-        return -1;
-    return found - read_lens.begin();
+    return columns_.find(read_len);
+}
+
+void PerLengthColumnAssigner::assign_columns(ReadBatch& batch) const {
+    for (std::size_t i = 0; i < batch.size(); ++i)
+        batch.columns[i] = columns_.find(batch.lengths[i]);
 }
 
 
@@ -113,17 +245,17 @@ int PerLengthColumnAssigner::assign_column(char const* rg, uint32_t read_len) co
 // Per Lib
 PerLibColumnAssigner::PerLibColumnAssigner(RgToLibMap rg2lib)
     : rg2lib_(std::move(rg2lib))
+    , rg_index_(rg2lib_)
 {
     boost::container::flat_set<std::string> lib_names;
     for (auto i = rg2lib_.begin(); i != rg2lib_.end(); ++i)
         lib_names.insert(i->second);
 
+    // read group ids follow the order of rg2lib_
     for (auto i = rg2lib_.begin(); i != rg2lib_.end(); ++i) {
         auto where = lib_names.find(i->second);
         assert(where != lib_names.end());
-        auto offset = std::distance(lib_names.begin(), where);
-        KeyType key{i->first.c_str()};
-        index_[key] = offset;
+        columns_.push_back(std::distance(lib_names.begin(), where));
     }
     column_names.assign(lib_names.begin(), lib_names.end());
 }
@@ -133,13 +265,21 @@ std::size_t PerLibColumnAssigner::num_columns() const {
 }
 
 int PerLibColumnAssigner::assign_column(char const* rg, uint32_t read_len) const {
-    if (!rg)
+    int id = rg_index_.find(rg);
+    if (id < 0)
         return -1;
+    return columns_[id];
+}
 
-    auto iter = index_.find(rg);
-    if (iter == index_.end())
-        return -1;
-    return iter->second;
+void PerLibColumnAssigner::assign_columns(ReadBatch& batch) const {
+    std::vector<int> rg_columns;
+    for (auto i = batch.rg_names.begin(); i != batch.rg_names.end(); ++i)
+        rg_columns.push_back(PerLibColumnAssigner::assign_column(i->c_str(), 0));
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        uint32_t id = batch.rg_ids[i];
+        batch.columns[i] = id == ReadBatch::NO_READ_GROUP ? -1 : rg_columns[id];
+    }
 }
 
 
@@ -150,56 +290,202 @@ PerLibAndLengthColumnAssigner::PerLibAndLengthColumnAssigner(
         , PerLibReadLengths const& read_lens
         )
     : rg2lib_(std::move(rg2lib))
+    , rg_index_(rg2lib_)
 {
-    // lib_name -> first column index for that lib
+    // lib_name -> index in lib_columns_
     // (each lib can have separate columns for each of its read lengths)
-    std::unordered_map<std::string, std::size_t> lib_starts;
+    std::unordered_map<std::string, int> lib_idx;
 
-    // populate lib_starts and set column names
+    // populate lib_columns_ and set column names
     for (auto i = read_lens.begin(); i != read_lens.end(); ++i) {
         auto const& lib_name = i->first;
         auto const& lens = i->second;
-        lib_starts[lib_name] = column_names.size();
+        lib_idx[lib_name] = lib_columns_.size();
+        lib_columns_.push_back(LengthTable(lens, column_names.size()));
 
         for (auto j = lens.begin(); j != lens.end(); ++j) {
             column_names.push_back(lib_name + "." + boost::lexical_cast<std::string>(*j));
         }
     }
 
-
-    // Now we can build our index mapping (rg, len) -> column_index
+    // Now we can map read group ids (in the order of rg2lib_) to libraries
     for (auto i = rg2lib_.begin(); i != rg2lib_.end(); ++i) {
         auto const& rg = i->first;
         auto const& lib = i->second;
 
-        auto lib_iter = read_lens.find(lib);
-        if (lib_iter == read_lens.end()) {
+        auto lib_iter = lib_idx.find(lib);
+        if (lib_iter == lib_idx.end()) {
             std::cerr << "WARNING: no read lengths found for read group " << rg << "\n";
+            rg_libs_.push_back(-1);
             continue;
         }
+        rg_libs_.push_back(lib_iter->second);
+    }
+}
 
-        // if it's in read_lens, it should be in lib_starts too
-        assert(lib_starts.count(lib) != 0);
-        std::size_t lib_idx = lib_starts[lib];
+int PerLibAndLengthColumnAssigner::assign_column(const char* rg, uint32_t read_len) const {
+    int id = rg_index_.find(rg);
+    if (id < 0 || rg_libs_[id] < 0)
+        return -1;
+    return lib_columns_[rg_libs_[id]].find(read_len);
+}
 
-        auto const& lens = lib_iter->second;
+void PerLibAndLengthColumnAssigner::assign_columns(ReadBatch& batch) const {
+    // the columns of each read group in the batch (null if it has none)
+    std::vector<LengthTable const*> rg_columns;
+    for (auto i = batch.rg_names.begin(); i != batch.rg_names.end(); ++i) {
+        int id = rg_index_.find(i->c_str());
+        bool known = id >= 0 && rg_libs_[id] >= 0;
+        rg_columns.push_back(known ? &lib_columns_[rg_libs_[id]] : 0);
+    }
 
-        for (auto j = lens.begin(); j != lens.end(); ++j) {
-            std::size_t len_idx = std::distance(lens.begin(), j);
-            std::size_t idx = lib_idx + len_idx;
-            KeyType key{rg.c_str(), *j};
-            index_[key] = idx;
-        }
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        uint32_t id = batch.rg_ids[i];
+        LengthTable const* columns = id == ReadBatch::NO_READ_GROUP ? 0 : rg_columns[id];
+        batch.columns[i] = columns ? columns->find(batch.lengths[i]) : -1;
     }
 }
 
-int PerLibAndLengthColumnAssigner::assign_column(const char* rg, uint32_t read_len) const {
-    if (!rg)
-        return -1;
 
-    KeyType key{rg, read_len};
-    auto found = index_.find(key);
-    if (found == index_.end())
+//////////////////////////////////////////////////////////////////////
+// Per Length (and Lib), discovered while counting
+DiscoveringColumnAssigner::DiscoveringColumnAssigner(
+          RgToLibMap rg2lib
+        , bool per_lib
+        , bool keep_unmatched
+        )
+    : rg2lib_(std::move(rg2lib))
+    , per_lib_(per_lib)
+    , keep_unmatched_(keep_unmatched)
+    , rg_index_(rg2lib_)
+    , index_(0)
+    , n_columns_(0)
+{
+    boost::container::flat_set<std::string> lib_names;
+    for (auto i = rg2lib_.begin(); i != rg2lib_.end(); ++i)
+        lib_names.insert(i->second);
+    lib_names_.assign(lib_names.begin(), lib_names.end());
+
+    // library indices follow the sort order of the names
+    for (auto i = rg2lib_.begin(); i != rg2lib_.end(); ++i) {
+        auto where = lib_names.find(i->second);
+        rg_libs_.push_back(std::distance(lib_names.begin(), where));
+    }
+
+    indices_.emplace_back(new Index);
+    index_ = indices_.back().get();
+}
+
+std::size_t DiscoveringColumnAssigner::num_columns() const {
+    return n_columns_.load(std::memory_order_acquire);
+}
+
+int64_t DiscoveringColumnAssigner::library(int id, bool has_read_group) const {
+    if (id >= 0)
+        return rg_libs_[id];
+    if (!keep_unmatched_)
         return -1;
-    return found->second;
+    return has_read_group ? UNKNOWN_READ_GROUP : NO_READ_GROUP;
+}
+
+int DiscoveringColumnAssigner::assign_column(char const* rg, uint32_t read_len) const {
+    int64_t lib = 0;
+    if (per_lib_) {
+        lib = library(rg_index_.find(rg), rg != 0);
+        if (lib < 0)
+            return -1;
+    }
+
+    uint64_t key = (uint64_t(lib) << 32) | read_len;
+    Index const* index = index_.load(std::memory_order_acquire);
+    auto found = index->find(key);
+    if (found != index->end())
+        return found->second;
+    return add_column(key);
+}
+
+void DiscoveringColumnAssigner::assign_columns(ReadBatch& batch) const {
+    // the library of each read group in the batch (-1 if unknown)
+    std::vector<int64_t> rg_libs;
+    for (auto i = batch.rg_names.begin(); per_lib_ && i != batch.rg_names.end(); ++i)
+        rg_libs.push_back(library(rg_index_.find(i->c_str()), true));
+
+    Index const* index = index_.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        int64_t lib = 0;
+        if (per_lib_) {
+            uint32_t id = batch.rg_ids[i];
+            lib = id == ReadBatch::NO_READ_GROUP ? library(-1, false) : rg_libs[id];
+        }
+        if (lib < 0) {
+            batch.columns[i] = -1;
+            continue;
+        }
+
+        uint64_t key = (uint64_t(lib) << 32) | batch.lengths[i];
+        auto found = index->find(key);
+        if (found != index->end()) {
+            batch.columns[i] = found->second;
+            continue;
+        }
+        batch.columns[i] = add_column(key);
+        index = index_.load(std::memory_order_acquire);
+    }
+}
+
+int DiscoveringColumnAssigner::add_column(uint64_t key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // someone else may have beaten us to it
+    Index const* index = index_.load(std::memory_order_relaxed);
+    auto found = index->find(key);
+    if (found != index->end())
+        return found->second;
+
+    int col = columns_.size();
+    std::unique_ptr<Index> next(new Index(*index));
+    (*next)[key] = col;
+    columns_.push_back(key);
+
+    index_.store(next.get(), std::memory_order_release);
+    n_columns_.store(columns_.size(), std::memory_order_release);
+    indices_.push_back(std::move(next));
+    return col;
+}
+
+std::vector<std::size_t> DiscoveringColumnAssigner::sorted_columns() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::size_t> rv(columns_.size());
+    for (std::size_t i = 0; i < rv.size(); ++i)
+        rv[i] = i;
+
+    // keys sort by library name, then read length
+    std::sort(rv.begin(), rv.end(), KeyOrder(columns_));
+    return rv;
+}
+
+std::vector<uint64_t> DiscoveringColumnAssigner::column_keys() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return columns_;
+}
+
+std::vector<std::size_t> DiscoveringColumnAssigner::column_order() const {
+    std::vector<std::size_t> sorted = sorted_columns();
+    std::vector<std::size_t> rv(sorted.size());
+    for (std::size_t i = 0; i < sorted.size(); ++i)
+        rv[sorted[i]] = i;
+    return rv;
+}
+
+std::vector<std::string> DiscoveringColumnAssigner::output_column_names() const {
+    std::vector<std::size_t> sorted = sorted_columns();
+    std::vector<std::string> rv;
+    for (auto i = sorted.begin(); i != sorted.end(); ++i) {
+        uint64_t key = columns_[*i];
+        std::string name = boost::lexical_cast<std::string>(uint32_t(key));
+        if (per_lib_)
+            name = lib_names_[key >> 32] + "." + name;
+        rv.push_back(name);
+    }
+    return rv;
 }
@@ -3,12 +3,16 @@
 #include "BamHeader.hpp"
 #include "MurmurHash2.hpp"
 
+#include <boost/container/flat_map.hpp>
 #include <boost/container/flat_set.hpp>
 
+#include <atomic>
+#include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <set>
 #include <string>
@@ -18,6 +22,7 @@
 #include <vector>
 
 struct Options;
+struct ReadBatch;
 class BamReader;
 
 // We'd like for these to be sorted
@@ -26,6 +31,95 @@ typedef std::map<
         , std::set<uint32_t>
         > PerLibReadLengths;
 
+// Dense ids (0, 1, ...; in name order) for the read groups of a header.
+// Reads mostly come in runs from the same read group, so find() checks
+// the last read group found on the calling thread before hashing. That
+// cache is keyed on a generation taken by each index when it is built, not
+// its address, which a later index may reuse.
+class ReadGroupIndex {
+public:
+    explicit ReadGroupIndex(RgToLibMap const& rg2lib);
+
+    // the keys of ids_ point into names_
+    ReadGroupIndex(ReadGroupIndex const&) = delete;
+    ReadGroupIndex& operator=(ReadGroupIndex const&) = delete;
+
+    // -1 for read groups that are not in the header
+    int find(char const* rg) const {
+        if (!rg)
+            return -1;
+
+        LastFound& last = last_found();
+        if (last.generation == generation_ && strcmp(rg, names_[last.id].c_str()) == 0)
+            return last.id;
+
+        int id = lookup(rg);
+        if (id >= 0) {
+            last.generation = generation_;
+            last.id = id;
+        }
+        return id;
+    }
+
+    std::size_t size() const { return names_.size(); }
+    std::string const& name(int id) const { return names_[id]; }
+
+private:
+    struct LastFound {
+        // 0 before anything is found; indices start at 1
+        uint64_t generation;
+        int id;
+    };
+
+    static LastFound& last_found();
+    int lookup(char const* rg) const;
+
+    struct KeyType {
+        KeyType(char const* x) : rg(x) {}
+        char const* rg;
+        bool operator==(KeyType const& rhs) const {
+            return strcmp(rg, rhs.rg) == 0;
+        }
+    };
+
+    struct KeyHasher {
+        std::size_t operator()(KeyType const& x) const {
+            assert(x.rg != 0);
+            char const* p = x.rg;
+            return murmurhash2(p, strlen(p), 40);
+        }
+    };
+
+    uint64_t generation_;
+    std::vector<std::string> names_;
+    std::unordered_map<KeyType, int, KeyHasher> ids_;
+};
+
+// Column for each read length below LengthTable::MAX_LEN in one flat
+// array (-1 for lengths without a column); longer ones are looked up in
+// a sorted map.
+class LengthTable {
+public:
+    enum { MAX_LEN = 1 << 16 };
+
+    // lens[i] gets column first_col + i
+    LengthTable(std::set<uint32_t> const& lens, int first_col);
+
+    int find(uint32_t read_len) const {
+        if (read_len < columns_.size())
+            return columns_[read_len];
+
+        auto found = long_reads_.find(read_len);
+        if (found == long_reads_.end())
+            return -1;
+        return found->second;
+    }
+
+private:
+    std::vector<int> columns_;
+    boost::container::flat_map<uint32_t, int> long_reads_;
+};
+
 // There are currently 4 modes for mapping (read_group, read_length) -> output
 // column:
 //      Use a single column.
@@ -33,6 +127,10 @@ typedef std::map<
 //      Report by read length.
 //      Report by library x read_length.
 //
+// The read length modes discover their columns while counting (see
+// DiscoveringColumnAssigner); the fixed read length assigners are for when
+// the lengths are known up front.
+//
 // ColumnAssignerBase is the base class for all of these methods.
 // All child classes are expected to fill in the column_names vector OR
 // override the num_columns / print_header virtual functions.
@@ -47,15 +145,35 @@ struct ColumnAssignerBase {
     // to clients so they know whether or not it will be used (if not, they
     // are free to pass nullptr for rg.
     virtual bool needs_read_group() const = 0;
+    // assign_column() for every read in batch, into batch.columns (which
+    // the caller sizes). The assigners below override this to look columns
+    // up without a virtual call per read and, where read groups matter,
+    // with one read group lookup per distinct read group in the batch.
+    virtual void assign_columns(ReadBatch& batch) const;
 
     virtual std::size_t num_columns() const { return column_names.size(); }
+    // The names of the columns in output order
+    virtual std::vector<std::string> output_column_names() const { return column_names; }
     virtual void print_header(std::ostream& os) const {
+        std::vector<std::string> names = output_column_names();
         os << "Chr\tStart";
-        for (auto i = column_names.begin(); i != column_names.end(); ++i) {
+        for (auto i = names.begin(); i != names.end(); ++i) {
             os << "\t" << *i;
         }
         os << "\n";
     }
+
+    // Assigners that add columns as they go return false here. Their rows
+    // can be narrower than num_columns() (missing values are 0) and are
+    // only printed once counting is done, in the order of column_order().
+    virtual bool fixed_columns() const { return true; }
+    // The output position of each column
+    virtual std::vector<std::size_t> column_order() const {
+        std::vector<std::size_t> rv(num_columns());
+        for (std::size_t i = 0; i < rv.size(); ++i)
+            rv[i] = i;
+        return rv;
+    }
 };
 
 // Factory function to construct the right column assigner given the command
@@ -74,6 +192,7 @@ struct SingleColumnAssigner : ColumnAssignerBase {
     }
 
     int assign_column(char const* rg, uint32_t read_len) const { return 0; }
+    void assign_columns(ReadBatch& batch) const;
     bool needs_read_group() const { return false; }
 };
 
@@ -81,9 +200,13 @@ struct PerLengthColumnAssigner : ColumnAssignerBase {
     explicit PerLengthColumnAssigner(std::vector<uint32_t> const& lens);
 
     int assign_column(char const* rg, uint32_t read_len) const;
+    void assign_columns(ReadBatch& batch) const;
     bool needs_read_group() const { return false; }
 
     boost::container::flat_set<uint32_t> read_lens;
+
+private:
+    LengthTable columns_;
 };
 
 struct PerLibColumnAssigner : ColumnAssignerBase {
@@ -91,28 +214,14 @@ struct PerLibColumnAssigner : ColumnAssignerBase {
 
     std::size_t num_columns() const;
     int assign_column(char const* rg, uint32_t read_len) const;
+    void assign_columns(ReadBatch& batch) const;
     bool needs_read_group() const { return true; }
 
 private:
-    struct KeyType {
-        KeyType(char const* x) : rg(x) {}
-        char const* rg;
-        bool operator==(KeyType const& rhs) const {
-            return strcmp(rg, rhs.rg) == 0;
-        }
-    };
-
-    struct KeyHasher {
-        std::size_t operator()(KeyType const& x) const {
-            assert(x.rg != 0);
-            char const* p = x.rg;
-            return murmurhash2(p, strlen(p), 40);
-        }
-    };
-
-
     RgToLibMap rg2lib_;
-    std::unordered_map<KeyType, uint32_t, KeyHasher> index_;
+    ReadGroupIndex rg_index_;
+    // column of each read group id
+    std::vector<int> columns_;
 };
 
 struct PerLibAndLengthColumnAssigner : ColumnAssignerBase {
@@ -122,28 +231,77 @@ struct PerLibAndLengthColumnAssigner : ColumnAssignerBase {
             );
 
     int assign_column(char const* rg, uint32_t read_len) const;
+    void assign_columns(ReadBatch& batch) const;
     bool needs_read_group() const { return true; }
 
 private:
-    struct KeyType {
-        char const* rg;
-        uint32_t len;
+    RgToLibMap rg2lib_;
+    ReadGroupIndex rg_index_;
+    // the columns of each library, and which of them each read group
+    // id uses (-1 if its library has no read lengths)
+    std::vector<LengthTable> lib_columns_;
+    std::vector<int> rg_libs_;
+};
 
-        bool operator==(KeyType const& rhs) const {
-            return strcmp(rg, rhs.rg) == 0 && len == rhs.len;
-        }
+// Per read length (and optionally per library) columns that are added as
+// new lengths show up, so every read is counted in a single pass. Columns
+// are numbered in the order they are found; the header and column_order()
+// sort them like the fixed assigners above.
+//
+// assign_column may be called from several threads. Lookups go through an
+// immutable index; adding a column takes a lock and publishes a copy.
+//
+// With keep_unmatched (and per_lib), reads without a read group or with
+// one that is not in the header get columns of their own, under the
+// library indices NO_READ_GROUP and UNKNOWN_READ_GROUP, instead of none.
+// CountCache uses this to keep every read; the column names of such an
+// assigner are not meant for output.
+struct DiscoveringColumnAssigner : ColumnAssignerBase {
+    enum : uint32_t {
+          NO_READ_GROUP = 0xffffffff
+        , UNKNOWN_READ_GROUP = 0xfffffffe
     };
 
-    struct KeyHasher {
-        std::size_t operator()(KeyType const& x) const {
-            assert(x.rg != 0);
-            char const* p = x.rg;
-            std::size_t seed = murmurhash2(p, strlen(p), x.len);
-            return seed;
-        }
-    };
+    DiscoveringColumnAssigner(RgToLibMap rg2lib, bool per_lib, bool keep_unmatched = false);
+
+    std::size_t num_columns() const;
+    int assign_column(char const* rg, uint32_t read_len) const;
+    void assign_columns(ReadBatch& batch) const;
+    bool needs_read_group() const { return per_lib_; }
+    std::vector<std::string> output_column_names() const;
+    bool fixed_columns() const { return false; }
+    std::vector<std::size_t> column_order() const;
+
+    // Library names in index order
+    std::vector<std::string> const& library_names() const { return lib_names_; }
+    // (library index << 32 | read length) of each column, in order of
+    // discovery
+    std::vector<uint64_t> column_keys() const;
 
+private:
+    // (library index << 32 | read length) -> column
+    typedef std::unordered_map<uint64_t, int> Index;
+
+    // library index of the reads of read group id (see ReadGroupIndex,
+    // ReadBatch), or -1 if they are not counted
+    int64_t library(int id, bool has_read_group) const;
+    int add_column(uint64_t key) const;
+    // Column indices in output order
+    std::vector<std::size_t> sorted_columns() const;
 
     RgToLibMap rg2lib_;
-    std::unordered_map<KeyType, uint32_t, KeyHasher> index_;
+    bool per_lib_;
+    bool keep_unmatched_;
+    std::vector<std::string> lib_names_;
+    ReadGroupIndex rg_index_;
+    // library index of each read group id
+    std::vector<uint32_t> rg_libs_;
+
+    mutable std::mutex mutex_;
+    mutable std::atomic<Index const*> index_;
+    mutable std::atomic<std::size_t> n_columns_;
+    // every index ever published, since readers may still be using them
+    mutable std::vector<std::unique_ptr<Index>> indices_;
+    // key of each column, in order of discovery
+    mutable std::vector<uint64_t> columns_;
 };
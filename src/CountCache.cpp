@@ -0,0 +1,483 @@
+#include "CountCache.hpp"
+#include "BamHeader.hpp"
+#include "MurmurHash2.hpp"
+#include "Options.hpp"
+
+#include <boost/format.hpp>
+
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+using boost::format;
+
+namespace {
+    // rows are written out in pieces of about this many bytes
+    std::size_t const BUFFER_SIZE = 1 << 20;
+
+    void put_u32(std::string& out, uint32_t x) {
+        out.append(reinterpret_cast<char const*>(&x), sizeof(x));
+    }
+
+    void put_u64(std::string& out, uint64_t x) {
+        out.append(reinterpret_cast<char const*>(&x), sizeof(x));
+    }
+
+    void put_string(std::string& out, std::string const& s) {
+        put_u32(out, s.size());
+        out += s;
+    }
+
+    void put_varint(std::string& out, uint64_t x) {
+        for (; x >= 0x80; x >>= 7)
+            out += char(x | 0x80);
+        out += char(x);
+    }
+
+    bool get_varint(std::string const& data, std::size_t& pos, uint64_t& x) {
+        x = 0;
+        for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+            unsigned char c = data[pos++];
+            x |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    // Reads the fields of the index, throwing if it runs out
+    class IndexReader {
+    public:
+        IndexReader(std::string const& data, std::string const& path)
+            : data_(data)
+            , path_(path)
+            , pos_(0)
+        {
+        }
+
+        uint32_t u32() {
+            uint32_t rv;
+            std::memcpy(&rv, take(sizeof(rv)), sizeof(rv));
+            return rv;
+        }
+
+        uint64_t u64() {
+            uint64_t rv;
+            std::memcpy(&rv, take(sizeof(rv)), sizeof(rv));
+            return rv;
+        }
+
+        std::string string() {
+            uint32_t n = u32();
+            return std::string(take(n), n);
+        }
+
+        bool done() const { return pos_ == data_.size(); }
+
+    private:
+        char const* take(std::size_t n) {
+            if (data_.size() - pos_ < n) {
+                throw std::runtime_error(str(format(
+                    "Count cache %1% is damaged."
+                    ) % path_));
+            }
+            char const* rv = data_.data() + pos_;
+            pos_ += n;
+            return rv;
+        }
+
+    private:
+        std::string const& data_;
+        std::string const& path_;
+        std::size_t pos_;
+    };
+
+    uint32_t header_hash(BamHeader const& header) {
+        std::string text = header.text();
+        uint32_t rv = murmurhash2(text.data(), text.size(), 0);
+        for (int32_t i = 0; i < header.num_seqs(); ++i) {
+            char const* name = header.seq_name(i);
+            uint32_t len = header.seq_length(i);
+            rv = murmurhash2(name, strlen(name), rv);
+            rv = murmurhash2(reinterpret_cast<char const*>(&len), sizeof(len), rv);
+        }
+        return rv;
+    }
+
+    std::string excluded_regions_hash(std::string const& path) {
+        if (path.empty())
+            return "none";
+
+        std::ifstream in(path.c_str());
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        return str(format("%08x") % murmurhash2(text.data(), text.size(), 0));
+    }
+}
+
+bool CountCache::Key::operator==(Key const& rhs) const {
+    return bam_size == rhs.bam_size
+        && bam_mtime == rhs.bam_mtime
+        && header_hash == rhs.header_hash
+        && settings == rhs.settings;
+}
+
+CountCache::Key CountCache::key_for(Options const& opts, BamHeader const& header) {
+    struct stat st;
+    if (stat(opts.input_file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        throw std::runtime_error(str(format(
+            "--count-cache needs a bam file to check the cache against, not %1%"
+            ) % opts.input_file));
+    }
+
+    Key rv;
+    rv.bam_size = st.st_size;
+    rv.bam_mtime = uint64_t(st.st_mtim.tv_sec) * 1000000000u + st.st_mtim.tv_nsec;
+    rv.header_hash = header_hash(header);
+    rv.settings = str(format(
+        "min_mapq %1%, required flags %2%, forbidden flags %3%, %4%, excluded regions %5%"
+        ) % opts.min_mapq % opts.required_flags % opts.forbidden_flags
+          % (opts.leftmost ? "read starts" : "read spans")
+          % excluded_regions_hash(opts.exclude_bed));
+    return rv;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Writer
+CountCache::Writer::Writer(
+          std::string const& path
+        , Key const& key
+        , uint32_t resolution
+        , bool with_starts
+        , std::vector<std::string> const& library_names
+        , std::vector<uint64_t> const& column_keys
+        , std::vector<std::string> const& seq_names
+        )
+    : path_(path)
+    , out_(path.c_str(), std::ios::binary | std::ios::trunc)
+    , key_(key)
+    , resolution_(resolution)
+    , with_starts_(with_starts)
+    , library_names_(library_names)
+    , column_keys_(column_keys)
+    , seq_names_(seq_names)
+    , current_(0)
+    , offset_(0)
+{
+    if (!out_.is_open()) {
+        throw std::runtime_error(str(format(
+            "Failed to open count cache %1%"
+            ) % path));
+    }
+    buffer_.append(magic(), MAGIC_SIZE);
+}
+
+void CountCache::Writer::operator()(char const* seq_name, uint32_t pos) {
+    Sequence& seq = start_row(seq_name, pos);
+    buffer_ += char(0);
+    ++seq.num_rows;
+}
+
+void CountCache::Writer::operator()(
+          char const* seq_name
+        , uint32_t pos
+        , std::vector<uint64_t> const& counts
+        )
+{
+    Sequence& seq = start_row(seq_name, pos);
+    std::size_t step = with_starts_ ? 2 : 1;
+    std::size_t n_cols = counts.size() / step;
+    if (n_cols > column_keys_.size()) {
+        throw std::runtime_error(str(format(
+            "Failed to write count cache %1%: a row has more columns than the cache"
+            ) % path_));
+    }
+
+    uint64_t n_cells = 0;
+    for (std::size_t c = 0; c < n_cols; ++c)
+        n_cells += counts[step * c] != 0 || counts[step * c + step - 1] != 0;
+
+    put_varint(buffer_, n_cells);
+    for (std::size_t c = 0; c < n_cols; ++c) {
+        if (counts[step * c] == 0 && counts[step * c + step - 1] == 0)
+            continue;
+        put_varint(buffer_, c);
+        put_varint(buffer_, counts[step * c]);
+        if (with_starts_)
+            put_varint(buffer_, counts[step * c + 1]);
+        seq.used[c] = true;
+    }
+    ++seq.num_rows;
+
+    if (buffer_.size() >= BUFFER_SIZE)
+        flush_buffer();
+}
+
+CountCache::Writer::Sequence& CountCache::Writer::start_row(char const* seq_name, uint32_t pos) {
+    uint64_t here = offset_ + buffer_.size();
+    if (!current_ || current_name_ != seq_name) {
+        if (current_)
+            current_->size = here - current_->offset;
+
+        auto inserted = sequences_.insert(std::make_pair(std::string(seq_name), Sequence()));
+        if (!inserted.second) {
+            throw std::runtime_error(str(format(
+                "Failed to write count cache %1%: the rows of %2% are not together"
+                ) % path_ % seq_name));
+        }
+        current_ = &inserted.first->second;
+        current_name_ = seq_name;
+        current_->num_rows = 0;
+        current_->offset = here;
+        current_->size = 0;
+        current_->used.assign(column_keys_.size(), false);
+    }
+
+    uint32_t row = (pos - 1) / resolution_;
+    if (row < current_->num_rows) {
+        throw std::runtime_error(str(format(
+            "Failed to write count cache %1%: the rows of %2% are out of order"
+            ) % path_ % seq_name));
+    }
+    for (; current_->num_rows < row; ++current_->num_rows)
+        buffer_ += char(0);
+    return *current_;
+}
+
+void CountCache::Writer::flush_buffer() {
+    out_.write(buffer_.data(), buffer_.size());
+    offset_ += buffer_.size();
+    buffer_.clear();
+}
+
+void CountCache::Writer::finish() {
+    uint64_t index_offset = offset_ + buffer_.size();
+    if (current_)
+        current_->size = index_offset - current_->offset;
+
+    put_u64(buffer_, key_.bam_size);
+    put_u64(buffer_, key_.bam_mtime);
+    put_u32(buffer_, key_.header_hash);
+    put_string(buffer_, key_.settings);
+    put_u32(buffer_, resolution_);
+    put_u32(buffer_, with_starts_ ? 1 : 0);
+
+    put_u32(buffer_, library_names_.size());
+    for (auto i = library_names_.begin(); i != library_names_.end(); ++i)
+        put_string(buffer_, *i);
+
+    put_u32(buffer_, column_keys_.size());
+    for (auto i = column_keys_.begin(); i != column_keys_.end(); ++i)
+        put_u64(buffer_, *i);
+
+    // sequences without a single row were counted all the same
+    put_u32(buffer_, seq_names_.size());
+    for (auto i = seq_names_.begin(); i != seq_names_.end(); ++i) {
+        Sequence seq = {0, index_offset, 0, std::vector<bool>()};
+        auto found = sequences_.find(*i);
+        if (found != sequences_.end())
+            seq = found->second;
+
+        put_string(buffer_, *i);
+        put_u32(buffer_, seq.num_rows);
+        put_u64(buffer_, seq.offset);
+        put_u64(buffer_, seq.size);
+        std::vector<uint32_t> used;
+        for (std::size_t c = 0; c < seq.used.size(); ++c) {
+            if (seq.used[c])
+                used.push_back(c);
+        }
+        put_u32(buffer_, used.size());
+        for (auto c = used.begin(); c != used.end(); ++c)
+            put_u32(buffer_, *c);
+    }
+
+    put_u64(buffer_, index_offset);
+    buffer_.append(magic(), MAGIC_SIZE);
+    flush_buffer();
+
+    out_.close();
+    if (!out_) {
+        throw std::runtime_error(str(format(
+            "Failed to write count cache %1%"
+            ) % path_));
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Reading
+CountCache::CountCache(std::string const& path)
+    : path_(path)
+    , in_(path.c_str(), std::ios::binary)
+    , resolution_(0)
+    , with_starts_(false)
+    , pos_(0)
+{
+    if (!in_.is_open()) {
+        throw std::runtime_error(str(format(
+            "Failed to open count cache %1%"
+            ) % path));
+    }
+
+    in_.seekg(0, std::ios::end);
+    uint64_t size = in_.tellg();
+    std::string head(MAGIC_SIZE, '\0');
+    std::string tail(sizeof(uint64_t) + MAGIC_SIZE, '\0');
+    uint64_t index_offset = 0;
+    if (size >= head.size() + tail.size()) {
+        in_.seekg(0);
+        in_.read(&head[0], head.size());
+        in_.seekg(size - tail.size());
+        in_.read(&tail[0], tail.size());
+        std::memcpy(&index_offset, tail.data(), sizeof(index_offset));
+    }
+    if (!in_ || head.compare(0, MAGIC_SIZE, magic()) != 0
+        || tail.compare(sizeof(uint64_t), MAGIC_SIZE, magic()) != 0
+        || index_offset < MAGIC_SIZE || index_offset > size - tail.size())
+    {
+        throw std::runtime_error(str(format(
+            "%1% is not a count cache."
+            ) % path));
+    }
+
+    std::string index(size - tail.size() - index_offset, '\0');
+    in_.seekg(index_offset);
+    in_.read(&index[0], index.size());
+
+    IndexReader reader(index, path_);
+    key_.bam_size = reader.u64();
+    key_.bam_mtime = reader.u64();
+    key_.header_hash = reader.u32();
+    key_.settings = reader.string();
+    resolution_ = reader.u32();
+    with_starts_ = reader.u32() != 0;
+
+    uint32_t n_libs = reader.u32();
+    for (uint32_t i = 0; i < n_libs; ++i)
+        library_names_.push_back(reader.string());
+
+    uint32_t n_cols = reader.u32();
+    for (uint32_t i = 0; i < n_cols; ++i)
+        column_keys_.push_back(reader.u64());
+
+    uint32_t n_seqs = reader.u32();
+    for (uint32_t i = 0; i < n_seqs; ++i) {
+        seq_names_.push_back(reader.string());
+        Sequence seq;
+        seq.num_rows = reader.u32();
+        seq.offset = reader.u64();
+        seq.size = reader.u64();
+        uint32_t n_used = reader.u32();
+        for (uint32_t c = 0; c < n_used; ++c)
+            seq.used_columns.push_back(reader.u32());
+        sequences_.push_back(seq);
+
+        if (seq.offset > index_offset || seq.size > index_offset - seq.offset) {
+            throw std::runtime_error(str(format(
+                "Count cache %1% is damaged."
+                ) % path_));
+        }
+    }
+
+    if (!in_ || !reader.done() || resolution_ == 0) {
+        throw std::runtime_error(str(format(
+            "Count cache %1% is damaged."
+            ) % path_));
+    }
+}
+
+CountCache::Sequence const* CountCache::find(std::string const& name) const {
+    for (std::size_t i = 0; i < seq_names_.size(); ++i) {
+        if (seq_names_[i] == name)
+            return &sequences_[i];
+    }
+    return 0;
+}
+
+bool CountCache::can_answer(
+          Key const& key
+        , std::vector<int> const& window_sizes
+        , std::vector<std::string> const& seq_names
+        , std::string& reason
+        ) const
+{
+    if (key != key_) {
+        reason = "it was counted from another version of the bam file or with other filters";
+        return false;
+    }
+
+    for (auto i = window_sizes.begin(); i != window_sizes.end(); ++i) {
+        if (*i % resolution_ != 0) {
+            reason = str(format(
+                "window size %1% is not a multiple of its resolution (%2%)"
+                ) % *i % resolution_);
+            return false;
+        }
+    }
+
+    for (auto i = seq_names.begin(); i != seq_names.end(); ++i) {
+        if (!find(*i)) {
+            reason = str(format("it does not have sequence %1%") % *i);
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<bool> CountCache::used_columns(std::vector<std::string> const& seq_names) const {
+    std::vector<bool> rv(column_keys_.size(), false);
+    for (auto i = seq_names.begin(); i != seq_names.end(); ++i) {
+        Sequence const* seq = find(*i);
+        if (!seq)
+            continue;
+        for (auto c = seq->used_columns.begin(); c != seq->used_columns.end(); ++c) {
+            if (*c < rv.size())
+                rv[*c] = true;
+        }
+    }
+    return rv;
+}
+
+uint32_t CountCache::seek(std::string const& name) {
+    Sequence const* seq = find(name);
+    if (!seq) {
+        throw std::runtime_error(str(format(
+            "Count cache %1% does not have sequence %2%"
+            ) % path_ % name));
+    }
+
+    rows_.resize(seq->size);
+    in_.seekg(seq->offset);
+    in_.read(&rows_[0], rows_.size());
+    if (!in_) {
+        throw std::runtime_error(str(format(
+            "Failed to read count cache %1%"
+            ) % path_));
+    }
+    pos_ = 0;
+    return seq->num_rows;
+}
+
+void CountCache::next_row(std::vector<Cell>& cells) {
+    cells.clear();
+    uint64_t n;
+    bool ok = get_varint(rows_, pos_, n);
+    for (uint64_t i = 0; ok && i < n; ++i) {
+        uint64_t column;
+        Cell cell = {0, 0, 0};
+        ok = get_varint(rows_, pos_, column) && column < column_keys_.size()
+            && get_varint(rows_, pos_, cell.count)
+            && (!with_starts_ || get_varint(rows_, pos_, cell.starts));
+        cell.column = column;
+        cells.push_back(cell);
+    }
+
+    if (!ok) {
+        throw std::runtime_error(str(format(
+            "Count cache %1% is damaged."
+            ) % path_));
+    }
+}
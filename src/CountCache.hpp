@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+class BamHeader;
+struct Options;
+
+// Counts of a bam file kept next to the output (--count-cache) so that
+// later runs with other window sizes, sequences or columns need not read
+// the bam file again. Rows are kept for every window of the finest
+// resolution counted (the smallest window size of the run that wrote
+// the cache), by library and read length, with the reads starting in each
+// window next to those overlapping it unless reads only count where they
+// start. Coarser windows are made from them as MultiResolutionPrinter
+// does, so any multiple of the resolution can be answered.
+//
+// A cache is only good for the bam file and filters it was counted with;
+// Key records both.
+//
+// Layout (integers little endian, varints as in DeferredTable):
+//
+//   "BWCACHE1"
+//   the rows of each sequence, one after the other. A row is a varint
+//   number of cells that are not 0, then for each: varint column, varint
+//   count and, with read starts, varint number of reads starting in it
+//   the index:
+//     u64 bam file size, u64 modification time (ns), u32 header hash,
+//     the filter settings
+//     u32 resolution, u32 1 if rows have read starts else 0
+//     u32 number of libraries, then the name of each
+//     u32 number of columns, then u64 (library index << 32 | read length)
+//     for each (library index as in DiscoveringColumnAssigner)
+//     u32 number of sequences, then for each:
+//       name, u32 num_rows, u64 offset, u64 size, u32 number of columns
+//       with counts, then each of them (u32)
+//     (names and settings are a u32 length and that many bytes)
+//   u64 offset of the index
+//   "BWCACHE1"
+class CountCache {
+public:
+    static char const* magic() { return "BWCACHE1"; }
+    enum { MAGIC_SIZE = 8 };
+
+    // What the counts depend on
+    struct Key {
+        uint64_t bam_size;
+        uint64_t bam_mtime;
+        uint32_t header_hash;
+        std::string settings;
+
+        bool operator==(Key const& rhs) const;
+        bool operator!=(Key const& rhs) const { return !(*this == rhs); }
+    };
+
+    // The key of the counts of opts.input_file with the filters in opts
+    static Key key_for(Options const& opts, BamHeader const& header);
+
+    // One column of a row, for columns that are not 0
+    struct Cell {
+        uint32_t column;
+        uint64_t count;
+        // reads starting in the window, with_starts() only
+        uint64_t starts;
+    };
+
+    // Writes a cache from the rows of a TableBuilder that counted with a
+    // DiscoveringColumnAssigner that keeps unmatched reads. seq_names are
+    // the sequences counted; rows must come a sequence at a time, in
+    // order. Call finish() after the last row.
+    class Writer {
+    public:
+        Writer(
+                  std::string const& path
+                , Key const& key
+                , uint32_t resolution
+                , bool with_starts
+                , std::vector<std::string> const& library_names
+                , std::vector<uint64_t> const& column_keys
+                , std::vector<std::string> const& seq_names
+                );
+
+        void operator()(char const* seq_name, uint32_t pos);
+        void operator()(
+                  char const* seq_name
+                , uint32_t pos
+                , std::vector<uint64_t> const& counts
+                );
+
+        void finish();
+
+    private:
+        struct Sequence {
+            uint32_t num_rows;
+            uint64_t offset;
+            uint64_t size;
+            std::vector<bool> used;
+        };
+
+        // Move on to the row at pos of seq_name, adding the empty rows
+        // before it
+        Sequence& start_row(char const* seq_name, uint32_t pos);
+        void flush_buffer();
+
+    private:
+        std::string path_;
+        std::ofstream out_;
+        Key key_;
+        uint32_t resolution_;
+        bool with_starts_;
+        std::vector<std::string> library_names_;
+        std::vector<uint64_t> column_keys_;
+        std::vector<std::string> seq_names_;
+        std::map<std::string, Sequence> sequences_;
+        Sequence* current_;
+        std::string current_name_;
+        std::string buffer_;
+        uint64_t offset_;
+    };
+
+    // Open the cache at path; throws if it is not one
+    explicit CountCache(std::string const& path);
+
+    Key const& key() const { return key_; }
+    uint32_t resolution() const { return resolution_; }
+    bool with_starts() const { return with_starts_; }
+    std::vector<std::string> const& library_names() const { return library_names_; }
+    std::vector<uint64_t> const& column_keys() const { return column_keys_; }
+
+    // Whether the counts can make the tables of a run counting the
+    // sequences seq_names of the bam file and with the filters of key, in
+    // windows of window_sizes. If not, reason says why.
+    bool can_answer(
+              Key const& key
+            , std::vector<int> const& window_sizes
+            , std::vector<std::string> const& seq_names
+            , std::string& reason
+            ) const;
+
+    // Which columns have counts in the sequences seq_names
+    std::vector<bool> used_columns(std::vector<std::string> const& seq_names) const;
+
+    // Start reading the rows of sequence name; returns how many there are
+    uint32_t seek(std::string const& name);
+    // The cells of the next row that are not 0
+    void next_row(std::vector<Cell>& cells);
+
+private:
+    struct Sequence {
+        uint32_t num_rows;
+        uint64_t offset;
+        uint64_t size;
+        std::vector<uint32_t> used_columns;
+    };
+
+    Sequence const* find(std::string const& name) const;
+
+private:
+    std::string path_;
+    std::ifstream in_;
+    Key key_;
+    uint32_t resolution_;
+    bool with_starts_;
+    std::vector<std::string> library_names_;
+    std::vector<uint64_t> column_keys_;
+    std::vector<std::string> seq_names_;
+    std::vector<Sequence> sequences_;
+
+    // the rows of the sequence being read
+    std::string rows_;
+    std::size_t pos_;
+};
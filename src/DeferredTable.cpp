@@ -0,0 +1,221 @@
+#include "DeferredTable.hpp"
+#include "BinaryTablePrinter.hpp"
+#include "ColumnAssigner.hpp"
+#include "CountCache.hpp"
+#include "RunRowPrinter.hpp"
+#include "TableBuilder.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+
+using boost::format;
+
+namespace {
+    void put_u32(std::ostream& os, uint32_t x) {
+        os.write(reinterpret_cast<char const*>(&x), sizeof(x));
+    }
+
+    bool get_u32(std::istream& in, uint32_t& x) {
+        return bool(in.read(reinterpret_cast<char*>(&x), sizeof(x)));
+    }
+
+    // Counts are mostly small: 7 bits per byte, high bit set on all but
+    // the last byte.
+    void put_varint(std::ostream& os, uint64_t x) {
+        char buf[10];
+        std::size_t n = 0;
+        for (; x >= 0x80; x >>= 7)
+            buf[n++] = char(x | 0x80);
+        buf[n++] = char(x);
+        os.write(buf, n);
+    }
+
+    bool get_varint(std::istream& in, uint64_t& x) {
+        x = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c = in.get();
+            if (c == std::char_traits<char>::eof())
+                return false;
+            x |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return true;
+        }
+        return false;
+    }
+}
+
+SpillBuffer::SpillBuffer(std::size_t memory_limit)
+    : memory_limit_(memory_limit)
+{
+}
+
+std::streamsize SpillBuffer::xsputn(char const* s, std::streamsize n) {
+    if (!spilled() && memory_.size() + n > memory_limit_)
+        spill();
+
+    if (spilled()) {
+        if (!file_.write(s, n))
+            return 0;
+    }
+    else {
+        memory_.append(s, n);
+    }
+    return n;
+}
+
+SpillBuffer::int_type SpillBuffer::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+
+    char ch = traits_type::to_char_type(c);
+    return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
+
+void SpillBuffer::spill() {
+    char const* tmpdir = getenv("TMPDIR");
+    std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/bam-window-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        throw std::runtime_error(str(format(
+            "Failed to create temporary file %1%: %2%"
+            ) % path % strerror(errno)));
+    }
+    close(fd);
+
+    file_.open(path.c_str(), std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+    unlink(path.c_str());
+    if (!file_.is_open()) {
+        throw std::runtime_error(str(format(
+            "Failed to open temporary file %1%"
+            ) % path));
+    }
+
+    file_.write(memory_.data(), memory_.size());
+    std::string().swap(memory_);
+}
+
+std::istream& SpillBuffer::reader() {
+    if (spilled()) {
+        file_.flush();
+        file_.seekg(0);
+        return file_;
+    }
+
+    memory_reader_.str(memory_);
+    memory_reader_.clear();
+    return memory_reader_;
+}
+
+
+DeferredRowEncoder::DeferredRowEncoder(std::ostream& os, ColumnAssignerBase const&)
+    : os(os)
+    , last_name(0)
+{
+}
+
+void DeferredRowEncoder::operator()(char const* seq_name, uint32_t pos) {
+    (*this)(seq_name, pos, std::vector<uint64_t>());
+}
+
+void DeferredRowEncoder::operator()(
+          char const* seq_name
+        , uint32_t pos
+        , std::vector<uint64_t> const& counts
+        )
+{
+    if (seq_name != last_name) {
+        uint32_t len = strlen(seq_name);
+        put_u32(os, len);
+        os.write(seq_name, len);
+        last_name = seq_name;
+    }
+    else {
+        put_u32(os, 0);
+    }
+
+    put_u32(os, pos);
+    put_u32(os, counts.size());
+    for (auto i = counts.begin(); i != counts.end(); ++i)
+        put_varint(os, *i);
+}
+
+
+DeferredTable::DeferredTable(std::size_t memory_limit)
+    : buffer_(memory_limit)
+    , rows_(&buffer_)
+{
+}
+
+void DeferredTable::write(std::ostream& os, ColumnAssignerBase const& col_assigner) {
+    col_assigner.print_header(os);
+    DefaultRowPrinter printer(os, col_assigner);
+    replay(printer, col_assigner);
+}
+
+template<typename Printer>
+void DeferredTable::replay(Printer& printer, ColumnAssignerBase const& col_assigner) {
+    std::vector<std::size_t> order = col_assigner.column_order();
+    replay_rows(printer, &order);
+}
+
+template<typename Printer>
+void DeferredTable::replay_stored(Printer& printer) {
+    replay_rows(printer, 0);
+}
+
+template<typename Printer>
+void DeferredTable::replay_rows(Printer& printer, std::vector<std::size_t> const* order) {
+    if (!rows_)
+        throw std::runtime_error("Failed to write temporary output.");
+
+    std::istream& in = buffer_.reader();
+    std::string name;
+    std::vector<uint64_t> stored;
+    std::vector<uint64_t> counts(order ? order->size() : 0);
+    uint32_t name_len;
+    while (get_u32(in, name_len)) {
+        if (name_len > 0) {
+            name.resize(name_len);
+            in.read(&name[0], name_len);
+        }
+
+        uint32_t pos;
+        uint32_t n;
+        get_u32(in, pos);
+        get_u32(in, n);
+        if (!in || (order && n > order->size()))
+            throw std::runtime_error("Failed to read back temporary output.");
+
+        stored.resize(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            if (!get_varint(in, stored[i]))
+                throw std::runtime_error("Failed to read back temporary output.");
+        }
+
+        if (n == 0) {
+            printer(name.c_str(), pos);
+            continue;
+        }
+        if (!order) {
+            printer(name.c_str(), pos, stored);
+            continue;
+        }
+
+        std::fill(counts.begin(), counts.end(), 0u);
+        for (uint32_t i = 0; i < n; ++i)
+            counts[(*order)[i]] = stored[i];
+        printer(name.c_str(), pos, counts);
+    }
+}
+
+template void DeferredTable::replay(DefaultRowPrinter&, ColumnAssignerBase const&);
+template void DeferredTable::replay(BinaryTablePrinter&, ColumnAssignerBase const&);
+template void DeferredTable::replay(RunRowPrinter&, ColumnAssignerBase const&);
+template void DeferredTable::replay_stored(CountCache::Writer&);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+struct ColumnAssignerBase;
+
+// Output buffer that stays in memory up to memory_limit bytes and moves
+// everything to an (already unlinked) temporary file beyond that.
+class SpillBuffer : public std::streambuf {
+public:
+    explicit SpillBuffer(std::size_t memory_limit);
+
+    bool spilled() const { return file_.is_open(); }
+
+    // Rewind to the start of everything written so far
+    std::istream& reader();
+
+protected:
+    std::streamsize xsputn(char const* s, std::streamsize n);
+    int_type overflow(int_type c);
+
+private:
+    void spill();
+
+private:
+    std::size_t memory_limit_;
+    std::string memory_;
+    std::istringstream memory_reader_;
+    std::fstream file_;
+};
+
+// TableBuilder printer that encodes rows for a DeferredTable: the sequence
+// name (only when it changes), the position and the counts as they are
+// (as varints).
+struct DeferredRowEncoder {
+    DeferredRowEncoder(std::ostream& os, ColumnAssignerBase const& col_assigner);
+
+    void operator()(char const* seq_name, uint32_t pos);
+    void operator()(
+              char const* seq_name
+            , uint32_t pos
+            , std::vector<uint64_t> const& counts
+            );
+    // rows are written as they come
+    void flush() {}
+
+    std::ostream& os;
+    char const* last_name;
+};
+
+// Holds the rows of the output table until all of its columns are known
+// (see ColumnAssignerBase::fixed_columns), or until the whole table can be
+// written in another layout. Rows encoded to rows() by DeferredRowEncoder
+// are kept in a SpillBuffer; write() prints the header and the rows
+// widened and reordered to the final columns.
+class DeferredTable {
+public:
+    explicit DeferredTable(std::size_t memory_limit = 64 << 20);
+
+    std::ostream& rows() { return rows_; }
+
+    void write(std::ostream& os, ColumnAssignerBase const& col_assigner);
+
+    // Give the rows, as write() prints them, to printer instead (which is
+    // DefaultRowPrinter, BinaryTablePrinter or RunRowPrinter)
+    template<typename Printer>
+    void replay(Printer& printer, ColumnAssignerBase const& col_assigner);
+
+    // Give the rows to printer as they were encoded, neither widened nor
+    // reordered (for CountCache::Writer)
+    template<typename Printer>
+    void replay_stored(Printer& printer);
+
+private:
+    // order is the output position of each column; null keeps the counts
+    // as they are
+    template<typename Printer>
+    void replay_rows(Printer& printer, std::vector<std::size_t> const* order);
+
+private:
+    SpillBuffer buffer_;
+    std::ostream rows_;
+};
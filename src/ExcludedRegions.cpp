@@ -0,0 +1,123 @@
+#include "ExcludedRegions.hpp"
+#include "BamHeader.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using boost::format;
+
+namespace {
+    struct ByBegin {
+        bool operator()(ExcludedRegions::Interval const& a, ExcludedRegions::Interval const& b) const {
+            return a.beg < b.beg;
+        }
+    };
+
+    // for upper_bound: the first interval ending after pos
+    struct EndsAfter {
+        bool operator()(uint32_t pos, ExcludedRegions::Interval const& iv) const {
+            return pos < iv.end;
+        }
+    };
+
+    bool is_header_line(std::string const& line) {
+        return line.empty() || line[0] == '#'
+            || line.compare(0, 5, "track") == 0
+            || line.compare(0, 7, "browser") == 0;
+    }
+
+    // Sort intervals and merge those that overlap or touch
+    void merge_intervals(std::vector<ExcludedRegions::Interval>& ivs) {
+        std::sort(ivs.begin(), ivs.end(), ByBegin());
+        std::size_t n = 0;
+        for (auto i = ivs.begin(); i != ivs.end(); ++i) {
+            if (n > 0 && i->beg <= ivs[n - 1].end)
+                ivs[n - 1].end = std::max(ivs[n - 1].end, i->end);
+            else
+                ivs[n++] = *i;
+        }
+        ivs.resize(n);
+    }
+}
+
+ExcludedRegions::ExcludedRegions(std::istream& bed, BamHeader const& header)
+    : by_seq_(header.num_seqs())
+    , num_ignored_(0)
+{
+    std::string line;
+    for (std::size_t line_no = 1; std::getline(bed, line); ++line_no) {
+        if (is_header_line(line))
+            continue;
+
+        std::istringstream fields(line);
+        std::string name;
+        int64_t beg = -1;
+        int64_t end = -1;
+        if (!(fields >> name >> beg >> end) || beg < 0 || end < beg || end > 0xffffffffll) {
+            throw std::runtime_error(str(format(
+                "Invalid BED interval on line %1% of excluded regions: '%2%'."
+                ) % line_no % line));
+        }
+
+        int32_t tid = header.seq_idx(name);
+        if (tid < 0) {
+            ++num_ignored_;
+            continue;
+        }
+
+        if (beg < end) {
+            Interval iv = {uint32_t(beg), uint32_t(end)};
+            by_seq_[tid].push_back(iv);
+        }
+    }
+
+    for (auto i = by_seq_.begin(); i != by_seq_.end(); ++i)
+        merge_intervals(*i);
+}
+
+auto ExcludedRegions::intervals(int32_t tid) const -> std::vector<Interval> const& {
+    return by_seq_[tid];
+}
+
+ExcludedRegions::Cursor::Cursor(ExcludedRegions const* regions)
+    : regions_(regions)
+    , tid_(-1)
+    , beg_(0)
+    , idx_(0)
+{
+}
+
+bool ExcludedRegions::Cursor::overlaps(int32_t tid, uint32_t beg, uint32_t end) {
+    Interval const* iv = seek(tid, beg);
+    return iv && iv->beg < std::max(end, beg + 1);
+}
+
+bool ExcludedRegions::Cursor::covers(int32_t tid, uint32_t beg, uint32_t end) {
+    Interval const* iv = seek(tid, beg);
+    return iv && iv->beg <= beg && iv->end >= end;
+}
+
+auto ExcludedRegions::Cursor::seek(int32_t tid, uint32_t beg) -> Interval const* {
+    if (!regions_ || tid < 0 || std::size_t(tid) >= regions_->by_seq_.size())
+        return 0;
+
+    std::vector<Interval> const& ivs = regions_->by_seq_[tid];
+    if (tid != tid_ || beg < beg_) {
+        tid_ = tid;
+        idx_ = std::upper_bound(ivs.begin(), ivs.end(), beg, EndsAfter()) - ivs.begin();
+    }
+    else if (idx_ < ivs.size() && ivs[idx_].end <= beg) {
+        // the next interval is the usual case; a jump past several (to
+        // another shard) gets a binary search
+        ++idx_;
+        if (idx_ < ivs.size() && ivs[idx_].end <= beg)
+            idx_ = std::upper_bound(ivs.begin() + idx_, ivs.end(), beg, EndsAfter()) - ivs.begin();
+    }
+    beg_ = beg;
+    return idx_ < ivs.size() ? &ivs[idx_] : 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+class BamHeader;
+
+// Regions of the reference to leave out of the counts (e.g., a blacklist
+// of artefact-prone regions), read from a BED file. Intervals are kept per
+// sequence, sorted and merged, so that any position is in at most one.
+class ExcludedRegions {
+public:
+    // 0-based, half open
+    struct Interval {
+        uint32_t beg;
+        uint32_t end;
+    };
+
+    // Walks the intervals of one sequence at a time. Positions given for a
+    // sequence are expected to increase (as read starts do in a sorted
+    // file), which makes each check amortized O(1); going back, or to
+    // another sequence, costs a binary search.
+    class Cursor {
+    public:
+        // A cursor without regions excludes nothing
+        explicit Cursor(ExcludedRegions const* regions = 0);
+
+        bool active() const { return regions_ != 0; }
+
+        // Whether [beg, end) on sequence tid overlaps an excluded interval.
+        // An empty range counts as the base at beg.
+        bool overlaps(int32_t tid, uint32_t beg, uint32_t end);
+
+        // Whether [beg, end) lies entirely in one excluded interval
+        bool covers(int32_t tid, uint32_t beg, uint32_t end);
+
+    private:
+        // The first interval of tid that ends after beg, if any
+        Interval const* seek(int32_t tid, uint32_t beg);
+
+    private:
+        ExcludedRegions const* regions_;
+        int32_t tid_;
+        uint32_t beg_;
+        std::size_t idx_;
+    };
+
+    // Reads "name start end" lines (further columns, comments and track
+    // lines are ignored). Intervals on sequences that are not in header
+    // are skipped and counted in num_ignored().
+    ExcludedRegions(std::istream& bed, BamHeader const& header);
+
+    std::vector<Interval> const& intervals(int32_t tid) const;
+
+    // Number of intervals (before merging) on unknown sequences
+    std::size_t num_ignored() const { return num_ignored_; }
+
+private:
+    std::vector<std::vector<Interval>> by_seq_;
+    std::size_t num_ignored_;
+};
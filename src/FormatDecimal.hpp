@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Integer to text without streams or locales, for printing tables.
+//
+// Digits are written two at a time from a table of "00".."99", back to
+// front, after counting them; the count takes a few comparisons instead
+// of a division per digit.
+
+// Most characters format_decimal() writes
+enum { MAX_DECIMAL_DIGITS = 20 };
+
+inline
+unsigned decimal_digits(uint64_t value) {
+    if (value < 10u) return 1;
+    if (value < 100u) return 2;
+    if (value < 1000u) return 3;
+    if (value < 10000u) return 4;
+    if (value < 100000u) return 5;
+    if (value < 1000000u) return 6;
+    if (value < 10000000u) return 7;
+    if (value < 100000000u) return 8;
+    if (value < 1000000000u) return 9;
+    if (value < 10000000000u) return 10;
+    return 10 + decimal_digits(value / 10000000000u);
+}
+
+// Write value at p (no terminating null); returns the end of it
+inline
+char* format_decimal(char* p, uint64_t value) {
+    static char const pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+    char* end = p + decimal_digits(value);
+    char* q = end;
+    while (value >= 100) {
+        unsigned i = unsigned(value % 100) * 2;
+        value /= 100;
+        q -= 2;
+        std::memcpy(q, pairs + i, 2);
+    }
+
+    if (value >= 10) {
+        std::memcpy(q - 2, pairs + value * 2, 2);
+    }
+    else {
+        q[-1] = char('0' + value);
+    }
+    return end;
+}
@@ -0,0 +1,149 @@
+#include "IndexEstimator.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+    // samtools keeps (file range, mapped/unmapped counts) of each sequence
+    // in this bin
+    int const META_BIN = 37450;
+    // First bin of the finest (16kb) level
+    int const TILE_BIN_OFFSET = 4681;
+    // Typical bam compression ratio, used to turn offsets within a bgzf
+    // block into compressed bytes
+    double const COMPRESSION_RATIO = 3.0;
+
+    double file_pos(uint64_t voffset) {
+        return double(voffset >> 16) + double(voffset & 0xffff) / COMPRESSION_RATIO;
+    }
+
+    // Every run of tiles of a sequence came out with no bytes, which happens
+    // to small sequences whose reads share a bgzf block or two (and
+    // compress better than COMPRESSION_RATIO). Put the mapped reads in the
+    // tiles with reads by the bytes contained in them, or evenly over the
+    // tiles where reads start if no tile contains any.
+    void spread_reads(
+              uint64_t n_mapped
+            , uint64_t const* offsets
+            , std::vector<double> const& contained
+            , std::vector<double>& rv
+            )
+    {
+        std::vector<double> weights(contained);
+        double weight = 0.0;
+        for (auto k = weights.begin(); k != weights.end(); ++k)
+            weight += *k;
+
+        if (weight == 0.0) {
+            for (std::size_t k = 0; k < weights.size(); ++k) {
+                if (offsets[k] != 0 && (k == 0 || offsets[k] != offsets[k - 1])) {
+                    weights[k] = 1.0;
+                    weight += 1.0;
+                }
+            }
+        }
+
+        if (weight > 0.0) {
+            for (std::size_t k = 0; k < rv.size(); ++k)
+                rv[k] = double(n_mapped) * weights[k] / weight;
+        }
+    }
+}
+
+IndexEstimator::IndexEstimator(bam_index_t const* index)
+    : index_(index)
+{
+}
+
+std::vector<double> IndexEstimator::tile_counts(int32_t tid) const {
+    std::vector<double> rv;
+    uint64_t const* meta;
+    if (bam_index_chunks(index_, tid, META_BIN, &meta) < 2)
+        return rv;
+
+    double seq_end = file_pos(meta[1]);
+    uint64_t n_mapped = meta[2];
+
+    uint64_t const* offsets;
+    int n_tiles = bam_index_linear(index_, tid, &offsets);
+    rv.resize(n_tiles, 0.0);
+
+    // bytes of the reads contained in each tile
+    std::vector<double> contained(n_tiles, 0.0);
+    for (int i = 0; i < n_tiles; ++i) {
+        uint64_t const* chunks;
+        int n_chunks = bam_index_chunks(index_, tid, TILE_BIN_OFFSET + i, &chunks);
+        for (int j = 0; j < n_chunks; ++j)
+            contained[i] += std::max(0.0, file_pos(chunks[2 * j + 1]) - file_pos(chunks[2 * j]));
+    }
+
+    // leading tiles without reads have offset 0
+    int i = 0;
+    while (i < n_tiles && offsets[i] == 0)
+        ++i;
+
+    double total = 0.0;
+    while (i < n_tiles) {
+        int j = i + 1;
+        while (j < n_tiles && offsets[j] == offsets[i])
+            ++j;
+
+        double run_end = j < n_tiles ? file_pos(offsets[j]) : seq_end;
+        double bytes = std::max(0.0, run_end - file_pos(offsets[i]));
+        double weight = 0.0;
+        for (int k = i; k < j; ++k)
+            weight += contained[k];
+
+        if (weight > 0.0) {
+            for (int k = i; k < j; ++k)
+                rv[k] += bytes * contained[k] / weight;
+        }
+        else {
+            rv[i] += bytes;
+        }
+        total += bytes;
+        i = j;
+    }
+
+    if (total > 0.0) {
+        double scale = double(n_mapped) / total;
+        for (auto k = rv.begin(); k != rv.end(); ++k)
+            *k *= scale;
+    }
+    else if (n_mapped > 0) {
+        spread_reads(n_mapped, offsets, contained, rv);
+    }
+    return rv;
+}
+
+std::vector<double> IndexEstimator::window_counts(
+          int32_t tid
+        , RowAssigner const& row_assigner
+        ) const
+{
+    std::vector<double> tiles = tile_counts(tid);
+    std::vector<double> rv(row_assigner.num_wins, 0.0);
+    uint64_t seq_len = row_assigner.seq_len;
+    uint64_t win_size = row_assigner.win_size;
+    uint32_t last_row = row_assigner.num_wins - 1;
+
+    for (std::size_t t = 0; t < tiles.size(); ++t) {
+        if (tiles[t] == 0.0)
+            continue;
+
+        uint64_t beg = uint64_t(t) * TILE_SIZE;
+        uint64_t end = std::min(beg + TILE_SIZE, seq_len);
+        if (beg >= end) {
+            // reads placed past the end of the sequence
+            rv[last_row] += tiles[t];
+            continue;
+        }
+
+        for (uint64_t row = beg / win_size; row * win_size < end && row <= last_row; ++row) {
+            uint64_t overlap = std::min(end, (row + 1) * win_size)
+                - std::max(beg, row * win_size);
+            rv[row] += tiles[t] * double(overlap) / double(end - beg);
+        }
+    }
+    return rv;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "RowAssigner.hpp"
+
+#include <bam.h>
+
+#include <cstdint>
+#include <vector>
+
+// Approximates the number of mapped reads starting in each window from a
+// bam index alone, without reading any alignments.
+//
+// The compressed bytes between consecutive linear index offsets (16kb
+// tiles) give the volume of reads starting in each tile. Runs of tiles
+// sharing one offset (empty tiles, or tiles under a long read) split that
+// volume in proportion to the chunk sizes of their finest-level bins.
+// Volumes are then scaled so that each sequence adds up to the mapped read
+// count stored in the index metadata pseudo-bin. A sequence small enough
+// to come out with no volume at all (see below) gets that count spread
+// over its tiles with reads instead.
+//
+// Error: sequence totals match the index metadata (which is before any
+// filtering; it counts duplicates, secondary alignments, etc.) for every
+// sequence with a linear index. Offsets inside a bgzf block are
+// placed assuming a fixed compression ratio, so the boundary of each tile
+// is off by at most one block and the count of any run of whole tiles is
+// within about two blocks worth of records (a few hundred short reads) of
+// the truth, plus however much compressed record size varies along the
+// sequence. Windows smaller than a tile get the tile's average density.
+class IndexEstimator {
+public:
+    enum { TILE_SIZE = 1 << 14 };
+
+    explicit IndexEstimator(bam_index_t const* index);
+
+    // Estimated reads starting in each tile of sequence tid
+    std::vector<double> tile_counts(int32_t tid) const;
+
+    // Estimated reads starting in each window of sequence tid; tiles are
+    // spread evenly over the bases they share with each window.
+    std::vector<double> window_counts(int32_t tid, RowAssigner const& row_assigner) const;
+
+private:
+    bam_index_t const* index_;
+};
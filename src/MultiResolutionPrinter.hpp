@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Printer for TableBuilder that turns rows for the finest window size into
+// rows for several window sizes that are multiples of it. printers[i]
+// gets windows factors[i] times as wide as those counted (factors[0] is
+// normally 1, i.e., the rows as they are).
+//
+// When reads are counted in every window they overlap, adding up rows
+// would count a read once for each fine window it spans. The builder
+// then also counts read starts (TableBuilder::set_count_starts()) and a
+// coarse window gets the reads overlapping its first fine window plus
+// those starting in the others.
+//
+// Rows must arrive in order, starting at a multiple of every factor. Call
+// flush() after the last row to print the coarse rows still being summed.
+template<typename Printer>
+class MultiResolutionPrinter {
+public:
+    typedef std::vector<uint64_t> Counts;
+
+    MultiResolutionPrinter(
+              std::vector<Printer*> const& printers
+            , std::vector<uint32_t> const& factors
+            , uint32_t win_size
+            , bool with_starts
+            )
+        : win_size_(win_size)
+        , with_starts_(with_starts)
+    {
+        assert(printers.size() == factors.size());
+        for (std::size_t i = 0; i < printers.size(); ++i) {
+            Level level;
+            level.printer = printers[i];
+            level.factor = factors[i];
+            level.seq_name = 0;
+            level.pos = 0;
+            level.has_counts = false;
+            levels_.push_back(level);
+        }
+    }
+
+    void operator()(char const* seq_name, uint32_t pos) {
+        for (auto i = levels_.begin(); i != levels_.end(); ++i) {
+            if (i->factor == 1) {
+                (*i->printer)(seq_name, pos);
+                continue;
+            }
+            start_row(*i, seq_name, pos);
+        }
+    }
+
+    void operator()(char const* seq_name, uint32_t pos, Counts const& counts) {
+        std::size_t step = with_starts_ ? 2 : 1;
+        for (auto i = levels_.begin(); i != levels_.end(); ++i) {
+            if (i->factor == 1) {
+                if (with_starts_) {
+                    overlaps_.resize(counts.size() / 2);
+                    for (std::size_t c = 0; c < overlaps_.size(); ++c)
+                        overlaps_[c] = counts[2 * c];
+                    (*i->printer)(seq_name, pos, overlaps_);
+                }
+                else {
+                    (*i->printer)(seq_name, pos, counts);
+                }
+                continue;
+            }
+
+            // the first fine window brings the reads overlapping it, the
+            // others only those starting in them
+            bool first = start_row(*i, seq_name, pos);
+            std::size_t offset = first ? 0 : step - 1;
+            if (i->counts.size() < counts.size() / step)
+                i->counts.resize(counts.size() / step, 0u);
+            for (std::size_t c = 0; c < counts.size() / step; ++c)
+                i->counts[c] += counts[step * c + offset];
+            i->has_counts = true;
+        }
+    }
+
+    void flush() {
+        for (auto i = levels_.begin(); i != levels_.end(); ++i)
+            print_level(*i);
+    }
+
+private:
+    struct Level {
+        Printer* printer;
+        uint32_t factor;
+        // the coarse row being summed up
+        char const* seq_name;
+        uint32_t pos;
+        bool has_counts;
+        Counts counts;
+    };
+
+    // Move level on to the coarse row containing the fine row at pos,
+    // printing the previous one if this starts a new row. Returns true if
+    // it does.
+    bool start_row(Level& level, char const* seq_name, uint32_t pos) {
+        uint32_t row = (pos - 1) / win_size_;
+        if (row % level.factor != 0) {
+            assert(level.seq_name == seq_name);
+            return false;
+        }
+
+        print_level(level);
+        level.seq_name = seq_name;
+        level.pos = pos;
+        return true;
+    }
+
+    void print_level(Level& level) {
+        if (level.seq_name == 0)
+            return;
+
+        if (level.has_counts)
+            (*level.printer)(level.seq_name, level.pos, level.counts);
+        else
+            (*level.printer)(level.seq_name, level.pos);
+
+        level.seq_name = 0;
+        level.has_counts = false;
+        std::fill(level.counts.begin(), level.counts.end(), 0u);
+    }
+
+private:
+    uint32_t win_size_;
+    bool with_starts_;
+    std::vector<Level> levels_;
+    Counts overlaps_;
+};
@@ -5,8 +5,10 @@
 
 #include <boost/format.hpp>
 
+#include <algorithm>
 #include <ios>
 #include <iomanip>
+#include <set>
 #include <sstream>
 
 namespace po = boost::program_options;
@@ -54,9 +56,24 @@ namespace {
 }
 
 
+std::string Options::output_file_for(std::size_t idx) const {
+    if (window_sizes.size() == 1)
+        return output_file;
+    return str(format("%1%.%2%") % output_file % window_sizes[idx]);
+}
+
+std::string Options::sample_name_for(std::size_t idx) const {
+    std::string const& path = input_files[idx];
+    std::size_t slash = path.rfind('/');
+    std::string rv = slash == std::string::npos ? path : path.substr(slash + 1);
+    if (rv.size() > 4 && rv.compare(rv.size() - 4, 4, ".bam") == 0)
+        rv.erase(rv.size() - 4);
+    return rv;
+}
+
 std::string Options::help_message() const {
     std::stringstream ss;
-    ss << "\nUsage: " << program_name << " [OPTIONS]" << " <input-file>\n\n";
+    ss << "\nUsage: " << program_name << " [OPTIONS]" << " <input-file>...\n\n";
     ss << opts << "\n";
     return ss.str();
 }
@@ -88,7 +105,7 @@ void Options::check_help() const {
 Options::Options(int argc, char** argv)
     : program_name(argv[0])
 {
-    pos_opts.add("input-file", 1);
+    pos_opts.add("input-file", -1);
 
     po::options_description help_opts("Help Options");
     help_opts.add_options()
@@ -100,24 +117,104 @@ Options::Options(int argc, char** argv)
     po::options_description gen_opts("General Options");
     gen_opts.add_options()
         ("input-file,i"
-            , po::value<std::string>(&input_file)->required()
-            , "Sorted, indexed bam file to count reads in (1st positional arg)")
+            , po::value<std::vector<std::string>>(&input_files)->required()
+            , "Sorted, indexed bam file to count reads in (positional args; "
+              "- for stdin). Several files (a cohort aligned to the same "
+              "reference) make one table: each is counted by a thread of "
+              "its own and its columns are prefixed by its file name "
+              "without .bam (-j is ignored)")
 
         ("output-file,o"
             , po::value<std::string>(&output_file)->default_value("-")
             , "Output file (- for stdout)")
 
+        ("output-format"
+            , po::value<std::string>(&output_format)->default_value("tsv")
+            , "tsv: tab separated text. binary: the counts of each "
+              "sequence column by column, with an index of columns and "
+              "sequences at the end, for loading with BinaryTable.hpp "
+              "(written once counting is done; each sequence is held in "
+              "memory while it is written). bedgraph: a \"chr start end "
+              "counts...\" line for each run of windows with the same "
+              "counts, leaving out windows with no reads, after a header "
+              "of '#' lines with the window size and sequences")
+
+        ("bgzip,z"
+            , po::bool_switch(&bgzip)->default_value(false)
+            , "Compress tsv or bedgraph output with BGZF. With -o, a tabix "
+              "index of it is written to OUTPUT.tbi (as by tabix -s 1 -b 2 "
+              "-e 2 -S 1 for tsv and tabix -p bed for bedgraph)")
+
+        ("bgzip-threads"
+            , po::value<int>(&bgzip_threads)->default_value(4)
+            , "Number of threads compressing the output with -z")
+
+        ("count-cache"
+            , po::value<std::string>(&count_cache)->default_value("")
+            , "File of counts by library and read length in every window "
+              "(of the smallest window size) to answer later runs on the "
+              "same bam file from. If it was counted from this version of "
+              "the bam file with the same filters, has the sequences asked "
+              "for, and the window sizes are multiples of its own, the "
+              "tables are made from it without reading any alignments. "
+              "Otherwise the reads are counted into a new one that "
+              "replaces it")
+
         ("sequence,c"
             , po::value<std::vector<std::string>>(&sequence_names)
             , "Sequence/chromosome name to operate on (may be specified "
               "multiple times). By default, all sequences are processed")
+
+        ("threads,t"
+            , po::value<int>(&num_threads)->default_value(1)
+            , "Number of threads to use for decompressing the input "
+              "(per worker when -j is given)")
+
+        ("workers,j"
+            , po::value<int>(&num_workers)->default_value(1)
+            , "Number of worker threads counting reads. Sequences are "
+              "split into shards that idle workers steal from busy ones; "
+              "each worker opens its own reader and output order is unchanged")
+
+        ("shard-size"
+            , po::value<int>(&shard_size)->default_value(2000000)
+            , "Approximate number of bases per unit of work when -j > 1 "
+              "(rounded up to a multiple of the window size)")
+
+        ("stream"
+            , po::bool_switch(&stream)->default_value(false)
+            , "Read the input from front to back without an index (implied "
+              "when the input is - or a pipe). Sequences are reported in "
+              "header order and -j is ignored. The input must be sorted by "
+              "coordinate")
+
+        ("mmap"
+            , po::bool_switch(&mmap)->default_value(false)
+            , "Read the input through a memory mapping shared by all "
+              "workers. Blocks stored uncompressed (bgzf level 0) are "
+              "parsed in place. Ignored if the input cannot be mapped")
+
+        ("prefetch-depth"
+            , po::value<int>(&prefetch_depth)->default_value(0)
+            , "Number of concurrent reads to keep in flight ahead of each "
+              "reader, e.g., for network file systems (0 disables read-ahead; "
+              "ignored with --mmap)")
+
+        ("prefetch-size"
+            , po::value<int>(&prefetch_size)->default_value(8)
+            , "Megabytes of compressed input to read ahead when "
+              "--prefetch-depth is set")
         ;
 
     po::options_description rep_opts("Reporting Options");
     rep_opts.add_options()
         ("window-size,w"
-            , po::value<int>(&window_size)->default_value(1000)
-            , "Tiling window size")
+            , po::value<std::vector<int>>(&window_sizes)->default_value(
+                std::vector<int>(1, 1000), "1000")
+            , "Tiling window size. May be given several times to get a "
+              "table for each size from a single pass; sizes must be "
+              "multiples of the smallest one and the table for size N goes "
+              "to OUTPUT.N (-o is required)")
 
         ("leftmost,s"
             , po::bool_switch(&leftmost)->default_value(false)
@@ -131,7 +228,40 @@ Options::Options(int argc, char** argv)
         ("by-read-length,r"
             , po::bool_switch(&per_read_len)->default_value(false)
             , "Count and report reads (in columns) per-read length "
-              "(compatible with -l)")
+              "(compatible with -l). Columns are found while counting, so "
+              "rows are held back (in a temporary file if need be) until "
+              "the end")
+
+        ("sample-reads"
+            , po::value<int>(&sample_reads)->default_value(0)
+            , "With -r, fix the columns up front from a sample of about this "
+              "many reads, read in small batches from evenly spaced points "
+              "of the index, so that rows can be written as they are "
+              "counted. Lengths missing from the sample are not reported. "
+              "0 (or streaming input) finds columns while counting")
+
+        ("counter-bits"
+            , po::value<std::string>(&counter_bits_string)->default_value("auto")
+            , "Width of the counters that hold rows while they are counted: "
+              "16, 32, 64 or auto. Narrow counters save memory and cache for "
+              "wide tables but fail if more reads than they can count start "
+              "in one window; auto starts at 16 bits and widens the rows "
+              "that need it")
+
+        ("skip-excluded-windows"
+            , po::bool_switch(&skip_excluded_windows)->default_value(false)
+            , "Leave out the rows of windows that lie entirely in regions "
+              "excluded with --exclude-bed")
+
+        ("estimate"
+            , po::bool_switch(&estimate)->default_value(false)
+            , "Approximate the number of mapped reads starting in each "
+              "window from the bam index alone, without reading any "
+              "alignments. Implies -s; cannot be combined with -l, -r or "
+              "filters other than -d. Sequence totals match the mapped "
+              "read counts in the index; windows "
+              "made of whole 16kb tiles are typically within a few hundred "
+              "reads, smaller windows get the average of their tile")
         ;
 
     po::options_description flt_opts("Filtering Options");
@@ -152,6 +282,13 @@ Options::Options(int argc, char** argv)
             , po::value<float>(&downsample)->default_value(1.0f)
             , "If set to something < 1.0, report reads with this probability")
 
+        ("downsample-by-name"
+            , po::bool_switch(&downsample_by_name)->default_value(false)
+            , "With -d, decide which reads to keep by a hash of their name "
+              "and the seed rather than by random draws: both mates of a "
+              "pair are kept or dropped together and the result does not "
+              "depend on -j or the order reads are read in")
+
         ("seed,S"
             , po::value<std::string>(&seed_string)->default_value("")
             , "Seed for random number generator when downsampling. "
@@ -166,6 +303,12 @@ Options::Options(int argc, char** argv)
                 BAM_FSECONDARY | BAM_FSUPPLEMENTAL | BAM_FDUP | BAM_FUNMAP | BAM_FQCFAIL
                 )
             , "SAM flags that each read is forbidden to have")
+
+        ("exclude-bed,x"
+            , po::value<std::string>(&exclude_bed)->default_value("")
+            , "BED file of regions (e.g., a blacklist) to leave out: reads "
+              "overlapping them (with -s, starting in them) are not counted "
+              "and are reported separately from filtered reads")
         ;
 
     opts.add(help_opts).add(gen_opts).add(rep_opts).add(flt_opts);
@@ -199,6 +342,8 @@ Options::Options(int argc, char** argv)
 }
 
 void Options::validate() {
+    input_file = input_files.front();
+
     if (pairs_only)
         required_flags |= BAM_FPAIRED;
 
@@ -211,10 +356,146 @@ void Options::validate() {
             ) % required_flags % forbidden_flags));
     }
 
-    if (window_size < 1) {
+    std::sort(window_sizes.begin(), window_sizes.end());
+    window_sizes.erase(std::unique(window_sizes.begin(), window_sizes.end()), window_sizes.end());
+    for (auto i = window_sizes.begin(); i != window_sizes.end(); ++i) {
+        if (*i < 1) {
+            throw std::runtime_error(str(format(
+                "Invalid window size (%1%), must be >= 1."
+                ) % *i));
+        }
+
+        if (*i % window_sizes.front() != 0) {
+            throw std::runtime_error(str(format(
+                "Invalid window size (%1%), must be a multiple of the "
+                "smallest window size (%2%)."
+                ) % *i % window_sizes.front()));
+        }
+    }
+    window_size = window_sizes.front();
+
+    if (window_sizes.size() > 1 && (output_file.empty() || output_file == "-"))
+        throw std::runtime_error("Several window sizes need an output file name (-o).");
+
+    if (num_threads < 1) {
+        throw std::runtime_error(str(format(
+            "Invalid number of threads (%1%), must be >= 1."
+            ) % num_threads));
+    }
+
+    if (num_workers < 1) {
+        throw std::runtime_error(str(format(
+            "Invalid number of workers (%1%), must be >= 1."
+            ) % num_workers));
+    }
+
+    if (shard_size < 1) {
+        throw std::runtime_error(str(format(
+            "Invalid shard size (%1%), must be >= 1."
+            ) % shard_size));
+    }
+
+    if (prefetch_depth < 0) {
+        throw std::runtime_error(str(format(
+            "Invalid prefetch depth (%1%), must be >= 0."
+            ) % prefetch_depth));
+    }
+
+    if (prefetch_size < 1) {
+        throw std::runtime_error(str(format(
+            "Invalid prefetch size (%1%), must be >= 1."
+            ) % prefetch_size));
+    }
+
+    if (estimate) {
+        if (per_lib || per_read_len)
+            throw std::runtime_error("--estimate cannot report per-library or per-read length counts.");
+
+        if (min_mapq > 0 || required_flags != 0 || !var_map["forbidden-flags"].defaulted())
+            throw std::runtime_error("--estimate cannot filter reads by mapping quality or flags.");
+
+        if (window_sizes.size() > 1)
+            throw std::runtime_error("--estimate takes a single window size.");
+
+        if (!exclude_bed.empty())
+            throw std::runtime_error("--estimate cannot leave out excluded regions.");
+
+        leftmost = true;
+    }
+
+    if (skip_excluded_windows && exclude_bed.empty())
+        throw std::runtime_error("--skip-excluded-windows needs --exclude-bed.");
+
+    if (output_format != "tsv" && !binary_output() && !bedgraph_output()) {
+        throw std::runtime_error(str(format(
+            "Invalid output format '%1%', must be tsv, binary or bedgraph."
+            ) % output_format));
+    }
+
+    if (binary_output() && skip_excluded_windows)
+        throw std::runtime_error("Binary output has every window; --skip-excluded-windows cannot be used.");
+
+    if (bedgraph_output() && skip_excluded_windows)
+        throw std::runtime_error("Windows missing from bedgraph output are 0; --skip-excluded-windows cannot be used.");
+
+    if (bgzip && binary_output())
+        throw std::runtime_error("Binary tables are read through a memory mapping; -z cannot be used.");
+
+    if (!count_cache.empty()) {
+        if (estimate)
+            throw std::runtime_error("--estimate reads no alignments; --count-cache cannot be used.");
+
+        if (downsample < 1.0f)
+            throw std::runtime_error("Downsampled counts cannot be cached; --count-cache cannot be used with -d.");
+
+        if (input_file == "-")
+            throw std::runtime_error("--count-cache needs a bam file, not standard input.");
+    }
+
+    if (cohort()) {
+        if (estimate)
+            throw std::runtime_error("--estimate takes a single input file.");
+
+        if (!count_cache.empty())
+            throw std::runtime_error("--count-cache takes a single input file.");
+
+        std::set<std::string> names;
+        for (std::size_t i = 0; i < input_files.size(); ++i) {
+            if (input_files[i] == "-")
+                throw std::runtime_error("Standard input cannot be one of several input files.");
+
+            if (!names.insert(sample_name_for(i)).second) {
+                throw std::runtime_error(str(format(
+                    "Several input files are named %1%; the columns of each "
+                    "input are named after its file."
+                    ) % sample_name_for(i)));
+            }
+        }
+    }
+
+    if (bgzip_threads < 1) {
+        throw std::runtime_error(str(format(
+            "Invalid number of compression threads (%1%), must be >= 1."
+            ) % bgzip_threads));
+    }
+
+    if (counter_bits_string == "auto") {
+        counter_bits = 0;
+    }
+    else if (counter_bits_string == "16" || counter_bits_string == "32"
+            || counter_bits_string == "64") {
+        counter_bits = boost::lexical_cast<int>(counter_bits_string);
+    }
+    else {
+        throw std::runtime_error(str(format(
+            "Invalid counter width '%1%', must be 16, 32, 64 or auto."
+            ) % counter_bits_string));
+    }
+
+    if (sample_reads < 0) {
         throw std::runtime_error(str(format(
-            "Invalid window size (%1%), must be >= 1."
-            ) % window_size));
+            "Invalid sample size (%1%), must be >= 0."
+            ) % sample_reads));
     }
 
     if (downsample <= 0.0f || downsample > 1.0f) {
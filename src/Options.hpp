@@ -26,10 +26,23 @@ public:
 struct Options {
     std::string program_name;
 
-    std::string input_file;
+    std::string input_file; // the first of input_files
+    std::vector<std::string> input_files;
     std::string output_file;
+    std::string output_format;
+    bool bgzip;
+    int bgzip_threads;
+    std::string count_cache;
+    int num_threads;
+    int num_workers;
+    int shard_size;
+    bool stream;
+    bool mmap;
+    int prefetch_depth;
+    int prefetch_size;
     int min_mapq;
-    int window_size;
+    int window_size; // the smallest of window_sizes
+    std::vector<int> window_sizes;
     int required_flags;
     int forbidden_flags;
     bool pairs_only;
@@ -37,9 +50,16 @@ struct Options {
     bool leftmost;
     bool per_lib;
     bool per_read_len;
+    int sample_reads;
+    bool estimate;
+    std::string counter_bits_string;
+    int counter_bits; // 0 for auto
     std::string seed_string;
     long seed;
     float downsample;
+    bool downsample_by_name;
+    std::string exclude_bed;
+    bool skip_excluded_windows;
     std::vector<std::string> sequence_names;
 
 
@@ -48,6 +68,17 @@ struct Options {
 
     void validate();
 
+    // Where the table for window_sizes[idx] goes
+    std::string output_file_for(std::size_t idx) const;
+    // The name of input_files[idx] in the columns of a cohort table: its
+    // file name without the directory and a .bam extension
+    std::string sample_name_for(std::size_t idx) const;
+    // Several inputs make one table (see BamWindow::count_cohort)
+    bool cohort() const { return input_files.size() > 1; }
+
+    bool binary_output() const { return output_format == "binary"; }
+    bool bedgraph_output() const { return output_format == "bedgraph"; }
+
 private:
     std::string help_message() const;
     std::string version_message() const;
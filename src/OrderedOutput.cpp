@@ -0,0 +1,78 @@
+#include "OrderedOutput.hpp"
+
+#include <cassert>
+
+OrderedOutput::OrderedOutput(
+          std::ostream& out
+        , std::size_t n_slots
+        , std::size_t max_buffered
+        )
+    : out_(out)
+    , slots_(n_slots)
+    , max_buffered_(max_buffered)
+    , buffered_(0)
+    , current_(0)
+{
+}
+
+void OrderedOutput::append(std::size_t slot, std::string chunk) {
+    assert(slot < slots_.size());
+    if (chunk.empty())
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!error_ && slot != current_ && buffered_ > max_buffered_)
+        ready_.wait(lock);
+    // nobody will write it
+    if (error_)
+        return;
+
+    buffered_ += chunk.size();
+    slots_[slot].chunks.push_back(std::move(chunk));
+    ready_.notify_all();
+}
+
+void OrderedOutput::finish(std::size_t slot) {
+    assert(slot < slots_.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots_[slot].finished = true;
+    ready_.notify_all();
+}
+
+void OrderedOutput::abort(std::exception_ptr err) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_)
+        error_ = err;
+    ready_.notify_all();
+}
+
+void OrderedOutput::write_all() {
+    std::deque<std::string> pending;
+    for (auto slot = slots_.begin(); slot != slots_.end(); ++slot) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // appends to this slot no longer wait
+        current_ = slot - slots_.begin();
+        ready_.notify_all();
+        for (;;) {
+            while (!error_ && slot->chunks.empty() && !slot->finished)
+                ready_.wait(lock);
+
+            if (error_)
+                std::rethrow_exception(error_);
+
+            if (slot->chunks.empty())
+                break; // finished and fully written
+
+            // don't hold the lock while writing
+            pending.swap(slot->chunks);
+            for (auto i = pending.begin(); i != pending.end(); ++i)
+                buffered_ -= i->size();
+            ready_.notify_all();
+            lock.unlock();
+            for (auto i = pending.begin(); i != pending.end(); ++i)
+                out_ << *i;
+            pending.clear();
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Reorder stage for output produced by several worker threads.
+//
+// Each unit of work (e.g., a sequence) owns a numbered slot. Workers append
+// chunks of finished text to their slot in any order; write_all() (called
+// from the thread that owns the output stream) writes slot 0 to completion,
+// then slot 1, and so on. Chunks for the slot currently being written go
+// straight out; later slots are buffered until their turn comes, up to
+// max_buffered bytes: past that, append() to a later slot waits for the
+// writer to catch up. The slot being written is always taken, so workers
+// that fill slots in order cannot deadlock.
+class OrderedOutput {
+public:
+    enum { DEFAULT_MAX_BUFFERED = 64 << 20 };
+
+    OrderedOutput(
+              std::ostream& out
+            , std::size_t n_slots
+            , std::size_t max_buffered = DEFAULT_MAX_BUFFERED
+            );
+
+    void append(std::size_t slot, std::string chunk);
+    void finish(std::size_t slot);
+
+    // Stop waiting for output; write_all() will rethrow err.
+    void abort(std::exception_ptr err);
+
+    // Blocks until every slot has been finished and written.
+    void write_all();
+
+private:
+    struct Slot {
+        Slot() : finished(false) {}
+
+        std::deque<std::string> chunks;
+        bool finished;
+    };
+
+    std::ostream& out_;
+    std::vector<Slot> slots_;
+    std::size_t max_buffered_;
+    // bytes waiting in slots_, and the slot write_all() is on
+    std::size_t buffered_;
+    std::size_t current_;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+};
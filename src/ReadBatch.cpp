@@ -0,0 +1,39 @@
+#include "ReadBatch.hpp"
+#include "MurmurHash2.hpp"
+
+uint32_t ReadBatch::intern(char const* rg) {
+    if (!rg)
+        return NO_READ_GROUP;
+
+    std::size_t len = strlen(rg);
+    uint32_t hash = murmurhash2(rg, len, 40);
+    std::size_t mask = slots_.size() - 1;
+    std::size_t i = hash & mask;
+    for (; slots_[i] != NO_READ_GROUP; i = (i + 1) & mask) {
+        uint32_t id = slots_[i];
+        if (rg_hashes_[id] == hash && rg_names[id].size() == len
+            && memcmp(rg_names[id].data(), rg, len) == 0)
+        {
+            return id;
+        }
+    }
+
+    uint32_t id = rg_names.size();
+    rg_names.push_back(std::string(rg, len));
+    rg_hashes_.push_back(hash);
+    slots_[i] = id;
+    // keep the table at most half full
+    if (2 * rg_names.size() > slots_.size())
+        rehash(2 * slots_.size());
+    return id;
+}
+
+void ReadBatch::rehash(std::size_t n_slots) {
+    slots_.assign(n_slots, NO_READ_GROUP);
+    for (uint32_t id = 0; id < rg_hashes_.size(); ++id) {
+        std::size_t i = rg_hashes_[id] & (n_slots - 1);
+        while (slots_[i] != NO_READ_GROUP)
+            i = (i + 1) & (n_slots - 1);
+        slots_[i] = id;
+    }
+}
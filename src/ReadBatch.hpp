@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// A block of reads from one sequence, stored column by column so that
+// TableBuilder::add_batch() can find their rows and columns in tight loops
+// over plain arrays (with one virtual call to the column assigner per batch
+// rather than one per read). Reads must be added in coordinate order.
+//
+// Read groups are interned as they are added: each read gets the id of its
+// read group among the few distinct ones in the batch, so that column
+// assigners look each of those up once per batch. In a coordinate sorted
+// file the reads of different read groups are interleaved, which defeats
+// ReadGroupIndex's check of the last one found.
+struct ReadBatch {
+    enum { DEFAULT_CAPACITY = 4096 };
+    enum : uint32_t { NO_READ_GROUP = 0xffffffff };
+
+    // Without ends (when only read starts are counted) and read groups
+    // (when the column assigner does not use them) those columns are left
+    // empty.
+    ReadBatch(bool with_ends, bool with_read_groups, std::size_t capacity = DEFAULT_CAPACITY)
+        : with_ends(with_ends)
+        , with_read_groups(with_read_groups)
+        , starts(capacity)
+        , ends(with_ends ? capacity : 0)
+        , lengths(capacity)
+        , rg_ids(with_read_groups ? capacity : 0)
+        , size_(0)
+        , slots_(16, NO_READ_GROUP)
+    {
+    }
+
+    template<typename T>
+    void push_back(T const& e) {
+        assert(!full());
+        starts[size_] = first_pos(e);
+        lengths[size_] = length(e);
+        if (with_ends)
+            ends[size_] = last_pos(e);
+        if (with_read_groups)
+            rg_ids[size_] = intern(read_group(e));
+        ++size_;
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t capacity() const { return starts.size(); }
+    bool empty() const { return size_ == 0; }
+    bool full() const { return size_ == starts.size(); }
+
+    void clear() {
+        size_ = 0;
+        if (!rg_names.empty()) {
+            rg_names.clear();
+            rg_hashes_.clear();
+            std::fill(slots_.begin(), slots_.end(), NO_READ_GROUP);
+        }
+    }
+
+    // null if the read has no read group (or they are not kept)
+    char const* rg_name(std::size_t i) const {
+        if (!with_read_groups || rg_ids[i] == NO_READ_GROUP)
+            return 0;
+        return rg_names[rg_ids[i]].c_str();
+    }
+
+    bool with_ends;
+    bool with_read_groups;
+
+    // Filled in by push_back(). These are allocated up front: only the
+    // first size() values are reads.
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> ends;
+    std::vector<uint32_t> lengths;
+    std::vector<uint32_t> rg_ids; // index in rg_names or NO_READ_GROUP
+    std::vector<std::string> rg_names; // in order of appearance
+
+    // filled in by TableBuilder::add_batch() (size() values)
+    std::vector<uint32_t> first_rows;
+    std::vector<uint32_t> last_rows;
+    std::vector<int> columns;
+
+private:
+    std::size_t size_;
+
+    uint32_t intern(char const* rg);
+    void rehash(std::size_t n_slots);
+
+    // open addressing table of ids in rg_names (a power of 2 in size)
+    std::vector<uint32_t> slots_;
+    std::vector<uint32_t> rg_hashes_;
+};
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <tuple>
 
@@ -34,6 +36,32 @@ struct RowAssigner {
         return std::make_tuple(first_row, last_row);
     }
 
+    // row_range() for n reads at once, given their first positions and
+    // (unless start_only) last positions
+    void row_ranges(
+              std::size_t n
+            , uint32_t const* fst_pos
+            , uint32_t const* lst_pos
+            , uint32_t* first_rows
+            , uint32_t* last_rows
+            ) const
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            first_rows[i] = fst_pos[i] / win_size;
+
+        if (start_only) {
+            std::copy(first_rows, first_rows + n, last_rows);
+            return;
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            assert(fst_pos[i] <= lst_pos[i]);
+            // as above, [123, 123) ends in the row it starts in
+            uint32_t lst = lst_pos[i] + (lst_pos[i] == fst_pos[i]);
+            last_rows[i] = (lst - 1) / win_size;
+        }
+    }
+
     uint32_t start_pos_for_row(uint32_t idx) const;
 
     uint32_t win_size;
@@ -0,0 +1,144 @@
+#include "RunRowPrinter.hpp"
+#include "BamHeader.hpp"
+#include "ColumnAssigner.hpp"
+#include "FormatDecimal.hpp"
+
+#include <algorithm>
+
+RunRowPrinter::RunRowPrinter(
+          std::ostream& os
+        , ColumnAssignerBase const& col_assigner
+        , BamHeader const& header
+        , uint32_t win_size
+        )
+    : os_(os)
+    , header_(header)
+    , win_size_(win_size)
+    , have_run_(false)
+    , seq_len_(0)
+    , run_first_(0)
+    , run_last_(0)
+    , run_zero_(false)
+    , run_counts_(col_assigner.num_columns())
+    , buffer_(BLOCK_SIZE)
+    , used_(0)
+{
+}
+
+RunRowPrinter::~RunRowPrinter() {
+    flush();
+}
+
+void RunRowPrinter::print_header(
+          std::ostream& os
+        , ColumnAssignerBase const& col_assigner
+        , BamHeader const& header
+        , std::vector<int32_t> const& seqs
+        , uint32_t win_size
+        )
+{
+    os << "#window_size\t" << win_size << "\n";
+    for (auto i = seqs.begin(); i != seqs.end(); ++i)
+        os << "#sequence\t" << header.seq_name(*i) << "\t" << header.seq_length(*i) << "\n";
+
+    std::vector<std::string> names = col_assigner.output_column_names();
+    os << "#Chr\tStart\tEnd";
+    for (auto i = names.begin(); i != names.end(); ++i)
+        os << "\t" << *i;
+    os << "\n";
+}
+
+void RunRowPrinter::operator()(
+          char const* seq_name
+        , uint32_t pos
+        , std::vector<uint64_t> const& counts
+        )
+{
+    if (!have_run_ || !same_counts(counts) || !extend_run(seq_name, pos))
+        start_run(seq_name, pos, &counts);
+}
+
+void RunRowPrinter::flush() {
+    print_run();
+    have_run_ = false;
+    if (used_ > 0)
+        os_.write(buffer_.data(), used_);
+    used_ = 0;
+}
+
+// Rows can be narrower than run_counts_ (missing values are 0)
+bool RunRowPrinter::same_counts(std::vector<uint64_t> const& counts) const {
+    std::size_t n = std::min(counts.size(), run_counts_.size());
+    if (!std::equal(counts.begin(), counts.begin() + n, run_counts_.begin()))
+        return false;
+    for (std::size_t i = n; i < counts.size(); ++i) {
+        if (counts[i] != 0)
+            return false;
+    }
+    for (std::size_t i = n; i < run_counts_.size(); ++i) {
+        if (run_counts_[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+void RunRowPrinter::start_run(
+          char const* seq_name
+        , uint32_t pos
+        , std::vector<uint64_t> const* counts
+        )
+{
+    print_run();
+
+    if (!have_run_ || seq_name_ != seq_name) {
+        seq_name_ = seq_name;
+        seq_len_ = header_.seq_length(header_.seq_idx(seq_name_));
+    }
+
+    have_run_ = true;
+    run_first_ = pos - 1;
+    run_last_ = pos - 1;
+    std::fill(run_counts_.begin(), run_counts_.end(), 0u);
+    if (counts) {
+        if (counts->size() > run_counts_.size())
+            run_counts_.resize(counts->size(), 0u);
+        std::copy(counts->begin(), counts->end(), run_counts_.begin());
+    }
+    run_zero_ = std::count(run_counts_.begin(), run_counts_.end(), 0u)
+        == std::ptrdiff_t(run_counts_.size());
+}
+
+void RunRowPrinter::print_run() {
+    if (!have_run_ || run_zero_)
+        return;
+
+    uint32_t end = run_last_ + win_size_;
+    if (run_last_ < seq_len_)
+        end = std::min(end, seq_len_);
+
+    char* p = room(seq_name_.size() + 3 + (run_counts_.size() + 2) * (MAX_DECIMAL_DIGITS + 1));
+    std::memcpy(p, seq_name_.data(), seq_name_.size());
+    p += seq_name_.size();
+    *p++ = '\t';
+    p = format_decimal(p, run_first_);
+    *p++ = '\t';
+    p = format_decimal(p, end);
+    for (auto i = run_counts_.begin(); i != run_counts_.end(); ++i) {
+        *p++ = '\t';
+        p = format_decimal(p, *i);
+    }
+    *p++ = '\n';
+    used_ = p - buffer_.data();
+}
+
+// n free bytes at the end of the buffer
+char* RunRowPrinter::room(std::size_t n) {
+    if (used_ + n > buffer_.size()) {
+        if (used_ > 0)
+            os_.write(buffer_.data(), used_);
+        used_ = 0;
+        if (n > buffer_.size())
+            buffer_.resize(n);
+    }
+    return buffer_.data() + used_;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class BamHeader;
+struct ColumnAssignerBase;
+
+// TableBuilder printer for --output-format bedgraph. Consecutive windows
+// with the same counts are printed as one "chr start end counts..." line
+// (start and end 0 based and half open, as in a bedGraph) and windows
+// with no reads are left out.
+//
+// The dense table can be rebuilt from this: print_header() lists the
+// window size and the sequences, a line stands for a window at every
+// multiple of the window size in [start, end), and windows not on any
+// line are 0. Ends are clipped to the length of the sequence, except for
+// rows past it (from reads running off the end), which make the dense
+// table that much longer.
+class RunRowPrinter {
+public:
+    enum { BLOCK_SIZE = 1 << 16 };
+
+    RunRowPrinter(
+              std::ostream& os
+            , ColumnAssignerBase const& col_assigner
+            , BamHeader const& header
+            , uint32_t win_size
+            );
+
+    RunRowPrinter(RunRowPrinter const&) = delete;
+    RunRowPrinter& operator=(RunRowPrinter const&) = delete;
+
+    ~RunRowPrinter();
+
+    static void print_header(
+              std::ostream& os
+            , ColumnAssignerBase const& col_assigner
+            , BamHeader const& header
+            , std::vector<int32_t> const& seqs
+            , uint32_t win_size
+            );
+
+    // most empty windows just make a run of them longer
+    void operator()(char const* seq_name, uint32_t pos) {
+        if (!run_zero_ || !extend_run(seq_name, pos))
+            start_run(seq_name, pos, 0);
+    }
+
+    void operator()(
+              char const* seq_name
+            , uint32_t pos
+            , std::vector<uint64_t> const& counts
+            );
+
+    // Prints the run so far, which the next row does not continue
+    void flush();
+
+private:
+    bool extend_run(char const* seq_name, uint32_t pos) {
+        if (!have_run_ || pos - 1 != run_last_ + win_size_
+            || std::strcmp(seq_name, seq_name_.c_str()) != 0)
+        {
+            return false;
+        }
+        run_last_ = pos - 1;
+        return true;
+    }
+
+    bool same_counts(std::vector<uint64_t> const& counts) const;
+    void start_run(char const* seq_name, uint32_t pos, std::vector<uint64_t> const* counts);
+    void print_run();
+    char* room(std::size_t n);
+
+private:
+    std::ostream& os_;
+    BamHeader const& header_;
+    uint32_t win_size_;
+
+    // the run: windows starting at run_first_ to run_last_ (0 based) in
+    // seq_name_, all with run_counts_
+    bool have_run_;
+    std::string seq_name_;
+    uint32_t seq_len_;
+    uint32_t run_first_;
+    uint32_t run_last_;
+    bool run_zero_;
+    std::vector<uint64_t> run_counts_;
+
+    std::vector<char> buffer_;
+    std::size_t used_;
+};
@@ -0,0 +1,164 @@
+#include "ShardMerger.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+//////////////////////////////////////////////////////////////////////
+// ShardRows
+void ShardRows::get_row(std::size_t i, Counts& counts) const {
+    uint32_t width = widths_[i];
+    counts.resize(width);
+    std::size_t first = i * stride_;
+    if (high_.empty()) {
+        std::copy(cells_.begin() + first, cells_.begin() + first + width, counts.begin());
+        return;
+    }
+    for (uint32_t c = 0; c < width; ++c)
+        counts[c] = get(first + c);
+}
+
+void ShardRows::clear() {
+    widths_.clear();
+    cells_.clear();
+    high_.clear();
+}
+
+void ShardRows::reserve(std::size_t n_rows) {
+    widths_.reserve(n_rows);
+    cells_.reserve(n_rows * stride_);
+}
+
+void ShardRows::push_back() {
+    widths_.push_back(0);
+    cells_.resize(cells_.size() + stride_, 0u);
+}
+
+void ShardRows::push_back(Counts const& counts) {
+    if (counts.size() > stride_)
+        widen(counts.size());
+
+    std::size_t first = cells_.size();
+    widths_.push_back(counts.size());
+    cells_.resize(first + stride_, 0u);
+    for (std::size_t c = 0; c < counts.size(); ++c)
+        set(first + c, counts[c]);
+}
+
+void ShardRows::add_row(std::size_t i, ShardRows const& src, std::size_t src_row) {
+    uint32_t width = src.widths_[src_row];
+    if (width == 0)
+        return;
+
+    // rows may have been widened by different amounts
+    if (width > stride_)
+        widen(width);
+    widths_[i] = std::max(widths_[i], width);
+
+    std::size_t first = i * stride_;
+    std::size_t src_first = src_row * src.stride_;
+    for (uint32_t c = 0; c < width; ++c)
+        set(first + c, get(first + c) + src.get(src_first + c));
+}
+
+void ShardRows::append_row(ShardRows const& src, std::size_t src_row) {
+    push_back();
+    add_row(size() - 1, src, src_row);
+}
+
+void ShardRows::swap(ShardRows& other) {
+    std::swap(stride_, other.stride_);
+    widths_.swap(other.widths_);
+    cells_.swap(other.cells_);
+    high_.swap(other.high_);
+}
+
+uint64_t ShardRows::get(std::size_t cell) const {
+    uint64_t rv = cells_[cell];
+    if (!high_.empty()) {
+        auto found = high_.find(cell);
+        if (found != high_.end())
+            rv |= uint64_t(found->second) << 32;
+    }
+    return rv;
+}
+
+void ShardRows::set(std::size_t cell, uint64_t value) {
+    cells_[cell] = uint32_t(value);
+    uint32_t high = uint32_t(value >> 32);
+    if (high != 0)
+        high_[cell] = high;
+    else if (!high_.empty())
+        high_.erase(cell);
+}
+
+void ShardRows::widen(uint32_t stride) {
+    std::vector<uint32_t> cells(widths_.size() * stride, 0u);
+    std::unordered_map<std::size_t, uint32_t> high;
+    for (std::size_t i = 0; i < widths_.size(); ++i) {
+        auto first = cells_.begin() + i * stride_;
+        std::copy(first, first + stride_, cells.begin() + i * stride);
+    }
+    for (auto i = high_.begin(); i != high_.end(); ++i)
+        high[i->first / stride_ * stride + i->first % stride_] = i->second;
+
+    cells_.swap(cells);
+    high_.swap(high);
+    stride_ = stride;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// ShardMerger
+ShardMerger::ShardMerger(std::vector<bool> const& ends_sequence)
+    : ends_sequence_(ends_sequence)
+    , pending_(ends_sequence.size())
+    , submitted_(ends_sequence.size(), false)
+    , next_(0)
+{
+}
+
+void ShardMerger::submit(
+          std::size_t slot
+        , ShardCounts& counts
+        , std::vector<MergedShard>& ready
+        )
+{
+    assert(slot < pending_.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(!submitted_[slot]);
+    pending_[slot].rows.swap(counts.rows);
+    pending_[slot].carry.swap(counts.carry);
+    submitted_[slot] = true;
+
+    for (; next_ < pending_.size() && submitted_[next_]; ++next_) {
+        ShardCounts& shard = pending_[next_];
+        ready.push_back(MergedShard());
+        MergedShard& merged = ready.back();
+        merged.slot = next_;
+        merged.rows.swap(shard.rows);
+
+        std::size_t n_in = std::min(carry_.size(), merged.rows.size());
+        for (std::size_t i = 0; i < n_in; ++i)
+            merged.rows.add_row(i, carry_, i);
+
+        // what is left of the carry and the carry of this shard move on
+        next_carry_.clear();
+        for (std::size_t i = n_in; i < carry_.size(); ++i)
+            next_carry_.append_row(carry_, i);
+        for (std::size_t i = 0; i < shard.carry.size(); ++i) {
+            if (i < next_carry_.size())
+                next_carry_.add_row(i, shard.carry, i);
+            else
+                next_carry_.append_row(shard.carry, i);
+        }
+        carry_.swap(next_carry_);
+        ShardRows().swap(shard.carry);
+
+        if (ends_sequence_[next_]) {
+            for (std::size_t i = 0; i < carry_.size(); ++i)
+                merged.rows.append_row(carry_, i);
+            carry_.clear();
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Rows of counts in one flat row-major buffer of stride() cells per row,
+// so that a shard costs no allocation per row. Each row keeps the number
+// of counts it was added with (0 for a row without counts); the cells
+// past them are 0, as are columns past the end of a row elsewhere (see
+// ColumnAssignerBase). Cells are 32 bits; the high bits of the rare count
+// that needs more are kept aside. clear() keeps the memory (and the
+// stride) for reuse.
+class ShardRows {
+public:
+    typedef std::vector<uint64_t> Counts;
+
+    ShardRows() : stride_(0) {}
+
+    std::size_t size() const { return widths_.size(); }
+    std::size_t stride() const { return stride_; }
+    // The number of counts of row i, 0 if it has none
+    uint32_t width(std::size_t i) const { return widths_[i]; }
+    // The counts of row i, width(i) of them
+    void get_row(std::size_t i, Counts& counts) const;
+
+    void clear();
+    void reserve(std::size_t n_rows);
+    // Add a row without counts
+    void push_back();
+    void push_back(Counts const& counts);
+    // Add the counts of row src_row of src to row i
+    void add_row(std::size_t i, ShardRows const& src, std::size_t src_row);
+    // Add a copy of row src_row of src
+    void append_row(ShardRows const& src, std::size_t src_row);
+
+    void swap(ShardRows& other);
+
+private:
+    uint64_t get(std::size_t cell) const;
+    void set(std::size_t cell, uint64_t value);
+    void widen(uint32_t stride);
+
+private:
+    uint32_t stride_;
+    std::vector<uint32_t> widths_;
+    std::vector<uint32_t> cells_;
+    // bits 32 and up of the cells that need them
+    std::unordered_map<std::size_t, uint32_t> high_;
+};
+
+// Counts for one shard (a window aligned range of rows in a sequence) as
+// produced by a TableBuilder that only saw reads starting in the shard.
+// rows[i] holds row begin + i. Reads that run past the end of the shard
+// leave counts in carry, starting at the first row after the shard.
+struct ShardCounts {
+    ShardRows rows;
+    ShardRows carry;
+};
+
+// Printer for TableBuilder that fills in a ShardCounts. The first n_rows
+// rows printed belong to the shard, the rest are carry.
+class ShardRowCollector {
+public:
+    ShardRowCollector(ShardCounts& counts, uint32_t n_rows)
+        : counts_(counts)
+        , n_rows_(n_rows)
+    {
+        counts_.rows.reserve(n_rows);
+    }
+
+    void operator()(char const*, uint32_t) {
+        if (counts_.rows.size() < n_rows_)
+            counts_.rows.push_back();
+        else
+            counts_.carry.push_back();
+    }
+
+    void operator()(char const*, uint32_t, ShardRows::Counts const& counts) {
+        if (counts_.rows.size() < n_rows_)
+            counts_.rows.push_back(counts);
+        else
+            counts_.carry.push_back(counts);
+    }
+
+private:
+    ShardCounts& counts_;
+    uint32_t n_rows_;
+};
+
+// Reads that span a shard boundary are counted by the shard they start in,
+// so the first rows of each shard are not final until every earlier shard
+// of the same sequence is done. Shards are numbered in output order and may
+// be submitted in any order; submit() adds the carried over counts to every
+// shard whose predecessors are all in and hands those shards back, in
+// order, ready to print. The last shard of each sequence also gets any
+// rows that reads pushed past the end of the sequence.
+class ShardMerger {
+public:
+    struct MergedShard {
+        std::size_t slot;
+        ShardRows rows;
+    };
+
+    // ends_sequence[i] is true if shard i is the last of its sequence.
+    explicit ShardMerger(std::vector<bool> const& ends_sequence);
+
+    // Takes the buffers of counts, which are left empty
+    void submit(std::size_t slot, ShardCounts& counts, std::vector<MergedShard>& ready);
+
+private:
+    std::vector<bool> ends_sequence_;
+    std::vector<ShardCounts> pending_;
+    std::vector<bool> submitted_;
+    std::size_t next_;
+    ShardRows carry_;
+    ShardRows next_carry_;
+    std::mutex mutex_;
+};
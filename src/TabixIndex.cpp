@@ -0,0 +1,269 @@
+#include "TabixIndex.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <bgzf.h>
+
+using boost::format;
+
+namespace {
+    uint64_t const UNSET = std::numeric_limits<uint64_t>::max();
+
+    // Classic tabix indexes use 5 levels of bins over 2^29 bases
+    int const MIN_SHIFT = 14;
+    int64_t const MAX_COORDINATE = int64_t(1) << 29;
+
+    // From the SAM spec; end is exclusive
+    uint32_t reg2bin(int64_t beg, int64_t end) {
+        --end;
+        if (beg >> 14 == end >> 14) return ((1 << 15) - 1) / 7 + (beg >> 14);
+        if (beg >> 17 == end >> 17) return ((1 << 12) - 1) / 7 + (beg >> 17);
+        if (beg >> 20 == end >> 20) return ((1 << 9) - 1) / 7 + (beg >> 20);
+        if (beg >> 23 == end >> 23) return ((1 << 6) - 1) / 7 + (beg >> 23);
+        if (beg >> 26 == end >> 26) return ((1 << 3) - 1) / 7 + (beg >> 26);
+        return 0;
+    }
+
+    void put_u32(std::string& out, uint32_t x) {
+        for (int i = 0; i < 4; ++i)
+            out += char(x >> (8 * i));
+    }
+
+    void put_u64(std::string& out, uint64_t x) {
+        for (int i = 0; i < 8; ++i)
+            out += char(x >> (8 * i));
+    }
+
+    bool parse_int(char const* beg, char const* end, int64_t& value) {
+        if (beg == end)
+            return false;
+        value = 0;
+        for (; beg != end; ++beg) {
+            if (*beg < '0' || *beg > '9' || value > MAX_COORDINATE)
+                return false;
+            value = value * 10 + (*beg - '0');
+        }
+        return true;
+    }
+}
+
+TabixIndex::Format TabixIndex::tsv_format() {
+    Format rv = {0, 1, 2, 2, '#', 1};
+    return rv;
+}
+
+TabixIndex::Format TabixIndex::bed_format() {
+    Format rv = {PRESET_UCSC, 1, 2, 3, '#', 0};
+    return rv;
+}
+
+TabixIndex::TabixIndex(Format const& format)
+    : format_(format)
+    , offset_(0)
+    , num_lines_(0)
+    , last_beg_(0)
+    , have_chunk_(false)
+    , chunk_bin_(0)
+    , chunk_beg_(0)
+    , chunk_end_(0)
+{
+    end_.offset = 0;
+    end_.address = 0;
+}
+
+void TabixIndex::add_text(char const* data, std::size_t n) {
+    char const* end = data + n;
+    while (data != end) {
+        char const* eol = static_cast<char const*>(std::memchr(data, '\n', end - data));
+        if (!eol) {
+            partial_.append(data, end);
+            offset_ += end - data;
+            return;
+        }
+
+        uint64_t line_end = offset_ + (eol - data) + 1;
+        if (partial_.empty()) {
+            add_line(data, eol - data, offset_, line_end);
+        }
+        else {
+            partial_.append(data, eol);
+            add_line(partial_.data(), partial_.size(), line_end - partial_.size() - 1, line_end);
+            partial_.clear();
+        }
+        offset_ = line_end;
+        data = eol + 1;
+    }
+}
+
+void TabixIndex::add_block(int64_t address, int compressed_length, int uncompressed_length) {
+    Block block = {end_.offset, address};
+    blocks_.push_back(block);
+    end_.offset += uncompressed_length;
+    end_.address = address + compressed_length;
+}
+
+// Lines go into the index as in tabix's ti_index_core(): consecutive lines
+// in the same bin make a chunk, and each 16kb window of the linear index
+// gets the first line overlapping it.
+void TabixIndex::add_line(char const* line, std::size_t n, uint64_t beg_offset, uint64_t end_offset) {
+    if (++num_lines_ <= format_.skip || (n > 0 && line[0] == format_.meta))
+        return;
+
+    int32_t n_cols = std::max(format_.col_seq, std::max(format_.col_beg, format_.col_end));
+    std::vector<char const*> fields;
+    fields.reserve(n_cols + 1);
+    fields.push_back(line);
+    char const* end = line + n;
+    for (char const* p = line; p != end && int32_t(fields.size()) <= n_cols; ++p) {
+        if (*p == '\t')
+            fields.push_back(p + 1);
+    }
+    fields.push_back(end + 1);
+
+    int64_t beg = 0;
+    int64_t stop = 0;
+    if (int32_t(fields.size()) <= n_cols
+        || !parse_int(fields[format_.col_beg - 1], fields[format_.col_beg] - 1, beg)
+        || (format_.col_end > 0
+            && !parse_int(fields[format_.col_end - 1], fields[format_.col_end] - 1, stop)))
+    {
+        throw std::runtime_error(str(format(
+            "Failed to index line %1% of the output: '%2%'"
+            ) % num_lines_ % std::string(line, n)));
+    }
+
+    if (!(format_.preset & PRESET_UCSC))
+        --beg;
+    if (format_.col_end == 0 || format_.col_end == format_.col_beg)
+        stop = beg + 1;
+    if (beg < 0 || stop > MAX_COORDINATE || stop <= beg) {
+        throw std::runtime_error(str(format(
+            "Line %1% of the output cannot go in a tabix index: '%2%'"
+            ) % num_lines_ % std::string(line, n)));
+    }
+
+    std::string name(fields[format_.col_seq - 1], fields[format_.col_seq] - 1);
+    if (seqs_.empty() || seqs_.back().name != name) {
+        if (!seq_idx_.insert(std::make_pair(name, seqs_.size())).second) {
+            throw std::runtime_error(str(format(
+                "Failed to index the output: lines of %1% are not together"
+                ) % name));
+        }
+        end_chunk();
+        seqs_.push_back(Sequence());
+        seqs_.back().name = name;
+        last_beg_ = 0;
+    }
+    else if (beg < last_beg_) {
+        throw std::runtime_error(str(format(
+            "Failed to index the output: line %1% is out of order"
+            ) % num_lines_));
+    }
+    last_beg_ = beg;
+
+    Sequence& seq = seqs_.back();
+    std::size_t last_window = (stop - 1) >> MIN_SHIFT;
+    if (seq.linear.size() <= last_window)
+        seq.linear.resize(last_window + 1, UNSET);
+    for (std::size_t i = beg >> MIN_SHIFT; i <= last_window; ++i) {
+        if (seq.linear[i] == UNSET)
+            seq.linear[i] = beg_offset;
+    }
+
+    uint32_t bin = reg2bin(beg, stop);
+    if (!have_chunk_ || bin != chunk_bin_) {
+        end_chunk();
+        have_chunk_ = true;
+        chunk_bin_ = bin;
+        chunk_beg_ = beg_offset;
+    }
+    chunk_end_ = end_offset;
+}
+
+void TabixIndex::end_chunk() {
+    if (!have_chunk_)
+        return;
+    Chunk chunk = {chunk_beg_, chunk_end_};
+    seqs_.back().bins[chunk_bin_].push_back(chunk);
+    have_chunk_ = false;
+}
+
+uint64_t TabixIndex::virtual_offset(uint64_t offset) const {
+    Block const* block = &end_;
+    if (offset < end_.offset) {
+        Block key = {offset, 0};
+        auto i = std::upper_bound(blocks_.begin(), blocks_.end(), key, BlockOffsetLess());
+        block = &*(i - 1);
+    }
+    return uint64_t(block->address) << 16 | (offset - block->offset);
+}
+
+void TabixIndex::write(std::string const& path) {
+    end_chunk();
+    if (!partial_.empty() || end_.offset != offset_)
+        throw std::runtime_error("Failed to index the output: it was not all written.");
+
+    std::string out("TBI\1", 4);
+    put_u32(out, seqs_.size());
+    put_u32(out, format_.preset);
+    put_u32(out, format_.col_seq);
+    put_u32(out, format_.col_beg);
+    put_u32(out, format_.col_end);
+    put_u32(out, uint32_t(int32_t(format_.meta)));
+    put_u32(out, format_.skip);
+
+    std::string names;
+    for (auto i = seqs_.begin(); i != seqs_.end(); ++i)
+        names.append(i->name.c_str(), i->name.size() + 1);
+    put_u32(out, names.size());
+    out += names;
+
+    for (auto i = seqs_.begin(); i != seqs_.end(); ++i) {
+        put_u32(out, i->bins.size());
+        for (auto bin = i->bins.begin(); bin != i->bins.end(); ++bin) {
+            // chunks that meet in a block become one, as tabix does
+            std::vector<Chunk> chunks;
+            for (auto c = bin->second.begin(); c != bin->second.end(); ++c) {
+                Chunk chunk = {virtual_offset(c->beg), virtual_offset(c->end)};
+                if (!chunks.empty() && chunks.back().end >> 16 == chunk.beg >> 16)
+                    chunks.back().end = chunk.end;
+                else
+                    chunks.push_back(chunk);
+            }
+
+            put_u32(out, bin->first);
+            put_u32(out, chunks.size());
+            for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+                put_u64(out, c->beg);
+                put_u64(out, c->end);
+            }
+        }
+
+        // windows no line starts in point at the line before
+        put_u32(out, i->linear.size());
+        uint64_t last = 0;
+        for (auto w = i->linear.begin(); w != i->linear.end(); ++w) {
+            if (*w != UNSET)
+                last = virtual_offset(*w);
+            put_u64(out, last);
+        }
+    }
+
+    BGZF* fp = bgzf_open(path.c_str(), "w");
+    if (!fp) {
+        throw std::runtime_error(str(format(
+            "Failed to open index file %1%"
+            ) % path));
+    }
+    ssize_t written = bgzf_write(fp, out.data(), out.size());
+    if (bgzf_close(fp) != 0 || written != ssize_t(out.size())) {
+        throw std::runtime_error(str(format(
+            "Failed to write index file %1%"
+            ) % path));
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Tabix (.tbi) index of a BGZF compressed table, built from the text of
+// the table as it is compressed (see BgzfOutput) instead of by reading the
+// file back. Offsets are kept as offsets into the text until write(),
+// which turns them into virtual file offsets with the blocks given to
+// add_block().
+class TabixIndex {
+public:
+    // Where the fields are, as in the header of the index
+    struct Format {
+        int32_t preset; // 0 (1 based starts) or PRESET_UCSC (0 based, half open)
+        int32_t col_seq;
+        int32_t col_beg;
+        int32_t col_end; // 0 if there is none: lines then cover one base
+        char meta; // lines starting with this are not indexed
+        int32_t skip; // nor are this many lines at the top
+    };
+
+    enum : int32_t { PRESET_UCSC = 0x10000 };
+
+    // As `tabix -s 1 -b 2 -e 2 -S 1` for tab separated tables
+    static Format tsv_format();
+    // As `tabix -p bed` for bedgraph tables
+    static Format bed_format();
+
+    explicit TabixIndex(Format const& format);
+
+    // The next n bytes of text
+    void add_text(char const* data, std::size_t n);
+
+    // The next block of the file, at file offset address
+    void add_block(int64_t address, int compressed_length, int uncompressed_length);
+
+    // Write the index to path, BGZF compressed as tabix does. All of the
+    // text must have been added and all of its blocks written.
+    void write(std::string const& path);
+
+private:
+    struct Chunk {
+        uint64_t beg;
+        uint64_t end;
+    };
+
+    struct Sequence {
+        std::string name;
+        std::map<uint32_t, std::vector<Chunk>> bins;
+        // offset of the first line overlapping each 16kb window
+        std::vector<uint64_t> linear;
+    };
+
+    struct Block {
+        uint64_t offset;
+        int64_t address;
+    };
+
+    struct BlockOffsetLess {
+        bool operator()(Block const& a, Block const& b) const {
+            return a.offset < b.offset;
+        }
+    };
+
+    void add_line(char const* line, std::size_t n, uint64_t beg_offset, uint64_t end_offset);
+    void end_chunk();
+    uint64_t virtual_offset(uint64_t offset) const;
+
+private:
+    Format format_;
+    // offset of the end of the text so far; the last line if it has not
+    // ended yet
+    uint64_t offset_;
+    std::string partial_;
+    int64_t num_lines_;
+
+    std::vector<Sequence> seqs_;
+    std::unordered_map<std::string, std::size_t> seq_idx_;
+    int64_t last_beg_;
+
+    // lines in bin chunk_bin_ of the last sequence, from chunk_beg_ to
+    // chunk_end_
+    bool have_chunk_;
+    uint32_t chunk_bin_;
+    uint64_t chunk_beg_;
+    uint64_t chunk_end_;
+
+    // where the text at each offset went, and the end of it
+    std::vector<Block> blocks_;
+    Block end_;
+};
@@ -3,54 +3,122 @@
 #include "WarningCollector.hpp"
 #include "RowAssigner.hpp"
 #include "ColumnAssigner.hpp"
+#include "FormatDecimal.hpp"
+#include "ReadBatch.hpp"
+
+#include <boost/format.hpp>
 
 #include <algorithm>
 #include <cassert>
-#include <deque>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <tuple>
 
-struct DefaultRowPrinter {
+// Prints rows as tab separated text. Rows are formatted into a buffer of
+// the printer's own and go to os in blocks of up to BLOCK_SIZE bytes (a
+// write that large goes straight to the file rather than through the
+// stream's buffer), and on flush() or destruction.
+class DefaultRowPrinter {
+public:
+    enum { BLOCK_SIZE = 1 << 16 };
+
     DefaultRowPrinter(std::ostream& os, ColumnAssignerBase const& col_assigner)
-        : os(os)
+        : os_(os)
+        , buffer_(BLOCK_SIZE)
+        , used_(0)
     {
         std::size_t n_cols = col_assigner.num_columns();
-        empty_value_str.reserve(2 * n_cols);
+        empty_tail_.reserve(2 * n_cols + 1);
         for (std::size_t i = 0; i < n_cols; ++i) {
-            empty_value_str += "\t0";
+            empty_tail_ += "\t0";
         }
+        empty_tail_ += "\n";
+    }
+
+    DefaultRowPrinter(DefaultRowPrinter const&) = delete;
+    DefaultRowPrinter& operator=(DefaultRowPrinter const&) = delete;
+
+    ~DefaultRowPrinter() {
+        flush();
     }
 
     void operator()(
               char const* seq_name
             , uint32_t pos
-            ) const
+            )
     {
-        os << seq_name << "\t" << pos << empty_value_str << "\n";
+        std::size_t name_len = std::strlen(seq_name);
+        char* p = room(name_len + 2 + MAX_DECIMAL_DIGITS + empty_tail_.size());
+        p = start_row(p, seq_name, name_len, pos);
+        std::memcpy(p, empty_tail_.data(), empty_tail_.size());
+        used_ = p + empty_tail_.size() - buffer_.data();
     }
 
     void operator()(
               char const* seq_name
             , uint32_t pos
-            , std::vector<uint32_t> const& counts
-            ) const
+            , std::vector<uint64_t> const& counts
+            )
     {
-        os << seq_name << "\t" << pos;
+        std::size_t name_len = std::strlen(seq_name);
+        char* p = room(name_len + 2 + MAX_DECIMAL_DIGITS
+            + counts.size() * (MAX_DECIMAL_DIGITS + 1));
+        p = start_row(p, seq_name, name_len, pos);
         for (auto i = counts.begin(); i != counts.end(); ++i) {
-            os << "\t" << *i;
+            *p++ = '\t';
+            p = format_decimal(p, *i);
         }
-        os << "\n";
+        *p++ = '\n';
+        used_ = p - buffer_.data();
     }
 
-    std::ostream& os;
-    std::string empty_value_str;
+    void flush() {
+        if (used_ > 0)
+            os_.write(buffer_.data(), used_);
+        used_ = 0;
+    }
+
+private:
+    // n free bytes at the end of the buffer
+    char* room(std::size_t n) {
+        if (used_ + n > buffer_.size()) {
+            flush();
+            if (n > buffer_.size())
+                buffer_.resize(n);
+        }
+        return buffer_.data() + used_;
+    }
+
+    char* start_row(char* p, char const* seq_name, std::size_t name_len, uint32_t pos) {
+        std::memcpy(p, seq_name, name_len);
+        p += name_len;
+        *p++ = '\t';
+        return format_decimal(p, pos);
+    }
+
+private:
+    std::ostream& os_;
+    // "\t0" for each column and the end of the line
+    std::string empty_tail_;
+    std::vector<char> buffer_;
+    std::size_t used_;
 };
 
-template<typename PrinterType = DefaultRowPrinter, typename WarnType = WarningCollector>
+// CellType is the (signed) type of the cells counts are kept in until
+// rows are printed; see set_promote_rows() for what happens when one is
+// too narrow.
+template<
+      typename PrinterType = DefaultRowPrinter
+    , typename WarnType = WarningCollector
+    , typename CellType = int32_t
+    >
 class TableBuilder {
 public:
-    typedef std::vector<uint32_t> Counts;
+    typedef std::vector<uint64_t> Counts;
 
     // seq_name is expected to outlive this object.
     // In practice it comes from the bam header, so this is not an issue.
@@ -62,19 +130,55 @@ public:
             , WarnType& warnings
             )
         : current_row_(0)
+        , end_row_(row_assigner.num_wins)
         , seq_name_(seq_name)
         , row_assigner_(row_assigner)
         , col_assigner_(col_assigner)
         , printer_(printer)
         , needs_read_group_(col_assigner_.needs_read_group())
+        , cells_per_col_(1)
+        , promote_rows_(false)
+        , capacity_(16)
+        , stride_(col_assigner_.num_columns())
+        , head_(0)
+        , n_rows_(0)
         , warnings_(warnings)
     {
+        cells_.resize(std::size_t(capacity_) * stride_, 0);
+        wide_.resize(capacity_);
+        row_.resize(stride_, 0u);
     }
 
     ~TableBuilder() {
         flush();
     }
 
+    // Only produce rows [begin, end) (the default is every window in the
+    // sequence). Must be called before any values are added. Counts that
+    // land past the end (reads spanning the boundary) are still printed
+    // after the last row by flush() so that the caller can merge them.
+    void set_row_range(uint32_t begin, uint32_t end) {
+        assert(n_rows_ == 0 && begin <= end);
+        current_row_ = begin;
+        end_row_ = end;
+    }
+
+    // Also count the reads starting in each row: column c goes to cells
+    // 2c (reads overlapping the row) and 2c + 1 (reads starting in it) of
+    // the printed rows. Must be called before any values are added.
+    void set_count_starts(bool value) {
+        assert(n_rows_ == 0);
+        cells_per_col_ = value ? 2 : 1;
+        relayout(capacity_, col_assigner_.num_columns() * cells_per_col_);
+    }
+
+    // A cell overflows when more reads than CellType can count start (or
+    // end) in one row. By default that is an error; with value set, the
+    // row gets 64 bit cells to take the excess instead.
+    void set_promote_rows(bool value) {
+        promote_rows_ = value;
+    }
+
     template<typename T>
     void operator()(T const& value) {
         uint32_t fst_row, lst_row;
@@ -91,20 +195,74 @@ public:
             return;
         }
 
-        set_current_row(fst_row);
+        count_read(fst_row, lst_row, col);
+    }
+
+    // Count every read in batch, as operator() would one at a time. The
+    // batch needs read groups if the column assigner does, and ends unless
+    // the row assigner counts starts only. Its row and column columns are
+    // overwritten; the reads are left in it.
+    void add_batch(ReadBatch& batch) {
+        assert(!needs_read_group_ || batch.with_read_groups);
+        assert(row_assigner_.start_only || batch.with_ends);
+        std::size_t n = batch.size();
+        batch.first_rows.resize(n);
+        batch.last_rows.resize(n);
+        batch.columns.resize(n);
+
+        row_assigner_.row_ranges(n, batch.starts.data(), batch.ends.data(),
+            batch.first_rows.data(), batch.last_rows.data());
+        col_assigner_.assign_columns(batch);
 
-        for (; fst_row <= lst_row; ++fst_row) {
-            increment_cell(fst_row, col);
+        for (std::size_t i = 0; i < n; ++i) {
+            int col = batch.columns[i];
+            if (col < 0) {
+                warnings_.warn_invalid_col(batch.rg_name(i), batch.lengths[i]);
+                continue;
+            }
+            count_read(batch.first_rows[i], batch.last_rows[i], col);
         }
     }
 
-    void increment_cell(uint32_t idx, uint32_t col) {
-        assert(idx >= current_row_);
-        uint32_t local_idx = idx - current_row_;
-        while (local_idx >= rows_.size()) {
-            rows_.push_back(new_row());
+    // Count a read that spans rows [fst_row, lst_row] in column col
+    void count_read(uint32_t fst_row, uint32_t lst_row, int col) {
+        set_current_row(fst_row);
+        if (cells_per_col_ == 2) {
+            increment_cells(fst_row, lst_row, 2 * col);
+            increment_cells(fst_row, fst_row, 2 * col + 1);
+        }
+        else {
+            increment_cells(fst_row, lst_row, col);
         }
-        ++rows_[local_idx][col];
+    }
+
+    void increment_cell(uint32_t idx, uint32_t col) {
+        increment_cells(idx, idx, col);
+    }
+
+    // Count one in column col of every row in [fst, lst]. The ring holds
+    // differences between consecutive rows: +1 at fst and -1 after lst,
+    // summed up as rows are printed, so long reads cost the same as short
+    // ones.
+    void increment_cells(uint32_t fst, uint32_t lst, uint32_t col) {
+        assert(fst >= current_row_ && fst <= lst);
+        uint32_t local_fst = fst - current_row_;
+        uint32_t local_end = lst - current_row_ + 1;
+        // columns can be added while counting; rows are widened lazily
+        if (col >= stride_)
+            widen(col + 1);
+        if (local_end > n_rows_)
+            extend(local_end);
+
+        CellType& start = cells_[slot(local_fst) * stride_ + col];
+        if (start == std::numeric_limits<CellType>::max())
+            promote(local_fst, col, start);
+        ++start;
+
+        CellType& end = cells_[slot(local_end) * stride_ + col];
+        if (end == std::numeric_limits<CellType>::min())
+            promote(local_end, col, end);
+        --end;
     }
 
     void set_current_row(uint32_t idx) {
@@ -116,10 +274,9 @@ public:
     void advance_to(uint32_t idx) {
         assert(idx >= current_row_);
         uint32_t diff = idx - current_row_;
-        uint32_t n_with_data = std::min(diff, uint32_t(rows_.size()));
+        uint32_t n_with_data = std::min(diff, n_rows_);
         for (uint32_t i = 0; i < n_with_data; ++i, ++current_row_) {
-            print_row(rows_.front());
-            rows_.pop_front();
+            pop_row();
         }
 
         for (uint32_t i = n_with_data; i < diff; ++i, ++current_row_) {
@@ -133,35 +290,132 @@ public:
     }
 
     void print_row(Counts const& c) const {
-        assert(c.size() == col_assigner_.num_columns());
+        assert(c.size() <= col_assigner_.num_columns() * cells_per_col_);
         auto pos = row_assigner_.start_pos_for_row(current_row_) + 1;
         printer_(seq_name_, pos, c);
     }
 
-    Counts new_row() const {
-        return Counts(col_assigner_.num_columns(), 0u);
-    }
-
     void flush() {
-        for (auto i = rows_.begin(); i != rows_.end(); ++i) {
-            print_row(rows_.front());
-            rows_.pop_front();
-            ++current_row_;
+        for (; n_rows_ > 0; ++current_row_) {
+            pop_row();
         }
 
-        for (; current_row_ < row_assigner_.num_wins; ++current_row_) {
+        for (; current_row_ < end_row_; ++current_row_) {
             print_empty_row();
         }
     }
 
+private:
+    // Pending rows live in a ring of cells (row-major, stride_ counts per
+    // row) starting at head_. Each pending row holds the change from the
+    // row before it; the row just past them holds the ends of the reads
+    // that cover the last one. All other cells are zero, so rows are
+    // recycled without touching the allocator. Rows that were promoted keep
+    // the part of their changes that did not fit in wide_.
+    std::size_t slot(uint32_t local_idx) const {
+        return (head_ + local_idx) & (capacity_ - 1);
+    }
+
+    // Print the row at current_row_ and give its cells back
+    void pop_row() {
+        assert(n_rows_ > 0);
+        auto first = cells_.begin() + head_ * stride_;
+        for (uint32_t i = 0; i < stride_; ++i) {
+            row_[i] += int64_t(first[i]);
+            first[i] = 0;
+        }
+        add_wide(head_);
+        head_ = (head_ + 1) & (capacity_ - 1);
+        --n_rows_;
+        print_row(row_);
+
+        // every read has ended; the next row holds nothing but their ends
+        if (n_rows_ == 0) {
+            std::fill(cells_.begin() + head_ * stride_, cells_.begin() + (head_ + 1) * stride_, 0);
+            wide_[head_].clear();
+            std::fill(row_.begin(), row_.end(), 0u);
+        }
+    }
+
+    // Move the value of cell (in column col of the local_idx'th pending
+    // row) to the row's wide cells.
+    void promote(uint32_t local_idx, uint32_t col, CellType& cell) {
+        if (!promote_rows_) {
+            throw std::runtime_error(str(boost::format(
+                "Too many reads start or end in the window at %1%:%2% to "
+                "count in %3% bits; use a wider --counter-bits (or auto)."
+                ) % seq_name_
+                % (row_assigner_.start_pos_for_row(current_row_ + local_idx) + 1)
+                % (8 * sizeof(CellType))));
+        }
+
+        std::vector<int64_t>& wide = wide_[slot(local_idx)];
+        if (wide.empty())
+            wide.resize(stride_, 0);
+        wide[col] += cell;
+        cell = 0;
+    }
+
+    void add_wide(std::size_t slot_idx) {
+        std::vector<int64_t>& wide = wide_[slot_idx];
+        for (std::size_t i = 0; i < wide.size(); ++i)
+            row_[i] += wide[i];
+        wide.clear();
+    }
+
+    void extend(uint32_t n_rows) {
+        if (n_rows >= capacity_) {
+            uint32_t capacity = capacity_;
+            while (capacity <= n_rows)
+                capacity *= 2;
+            relayout(capacity, stride_);
+        }
+        n_rows_ = n_rows;
+    }
+
+    void widen(uint32_t min_stride) {
+        // keep the pairs of cells for each column together
+        min_stride += min_stride % cells_per_col_;
+        uint32_t stride = std::max(min_stride, uint32_t(col_assigner_.num_columns() * cells_per_col_));
+        relayout(capacity_, stride);
+    }
+
+    void relayout(uint32_t capacity, uint32_t stride) {
+        std::vector<CellType> cells(std::size_t(capacity) * stride, 0);
+        std::vector<std::vector<int64_t>> wide(capacity);
+        for (uint32_t i = 0; i <= n_rows_; ++i) {
+            auto first = cells_.begin() + slot(i) * stride_;
+            std::copy(first, first + stride_, cells.begin() + std::size_t(i) * stride);
+            wide[i].swap(wide_[slot(i)]);
+            if (!wide[i].empty())
+                wide[i].resize(stride, 0);
+        }
+        cells_.swap(cells);
+        wide_.swap(wide);
+        capacity_ = capacity;
+        stride_ = stride;
+        head_ = 0;
+        row_.resize(stride_, 0u);
+    }
+
 private:
     uint32_t current_row_;
+    uint32_t end_row_;
     char const* seq_name_;
     RowAssigner const& row_assigner_;
     ColumnAssignerBase const& col_assigner_;
     PrinterType& printer_;
     bool needs_read_group_;
-    std::deque<Counts> rows_;
+    uint32_t cells_per_col_;
+    bool promote_rows_;
+
+    std::vector<CellType> cells_;
+    std::vector<std::vector<int64_t>> wide_; // per slot, empty unless promoted
+    uint32_t capacity_; // in rows, a power of 2
+    uint32_t stride_;
+    uint32_t head_;
+    uint32_t n_rows_;
+    Counts row_; // running sum, i.e., the counts of the last row printed
 
     WarnType& warnings_;
 };
@@ -27,10 +27,10 @@ WarningCollector::WarningCollector(Options const& opts, RgToLibMap const& rg2lib
     , missing_rgs_(0)
 {}
 
-void WarningCollector::warn_invalid_col(char const* rg, uint32_t len) {
+void WarningCollector::warn_invalid_col(char const* rg, uint32_t len, std::size_t n) {
     if (opts_.per_lib) {
         if (!rg) {
-            ++missing_rgs_;
+            missing_rgs_ += n;
             return;
         }
 
@@ -40,13 +40,13 @@ void WarningCollector::warn_invalid_col(char const* rg, uint32_t len) {
             lib = iter->second;
 
         if (opts_.per_read_len)
-            ++lib_skipped_lengths_[lib][len];
+            lib_skipped_lengths_[lib][len] += n;
         else
-            ++skipped_libs_[lib];
+            skipped_libs_[lib] += n;
     }
     else {
         if (opts_.per_read_len) {
-            ++skipped_lens_[len];
+            skipped_lens_[len] += n;
         }
         else {
             assert(1 + 1 == 11); // should not be able to get here
@@ -54,6 +54,22 @@ void WarningCollector::warn_invalid_col(char const* rg, uint32_t len) {
     }
 }
 
+void WarningCollector::merge(WarningCollector const& other) {
+    missing_rgs_ += other.missing_rgs_;
+
+    for (auto i = other.skipped_lens_.begin(); i != other.skipped_lens_.end(); ++i)
+        skipped_lens_[i->first] += i->second;
+
+    for (auto i = other.skipped_libs_.begin(); i != other.skipped_libs_.end(); ++i)
+        skipped_libs_[i->first] += i->second;
+
+    for (auto i = other.lib_skipped_lengths_.begin(); i != other.lib_skipped_lengths_.end(); ++i) {
+        auto& lens = lib_skipped_lengths_[i->first];
+        for (auto j = i->second.begin(); j != i->second.end(); ++j)
+            lens[j->first] += j->second;
+    }
+}
+
 void WarningCollector::print(std::ostream& os) {
     ReadCountTransform xfm;
 
@@ -13,7 +13,11 @@ class WarningCollector {
 public:
     WarningCollector(Options const& opts, RgToLibMap const& rg2lib);
 
-    void warn_invalid_col(char const* rg, uint32_t len);
+    // n reads of read group rg and length len have no column
+    void warn_invalid_col(char const* rg, uint32_t len, std::size_t n = 1);
+    // Add in the warnings gathered by another collector (e.g., one owned by
+    // a worker thread).
+    void merge(WarningCollector const& other);
     void print(std::ostream& os);
 
 private:
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A fixed pool of work items split between workers. Each worker takes
+// items from the front of its own lane; when that runs dry it steals from
+// the back of another worker's lane. Dealing items out round-robin in
+// output order keeps all workers close to the front of the output while
+// steals go after the work that is needed last.
+template<typename T>
+class WorkStealingQueue {
+public:
+    explicit WorkStealingQueue(std::size_t n_workers) {
+        for (std::size_t i = 0; i < n_workers; ++i)
+            lanes_.emplace_back(new Lane);
+    }
+
+    std::size_t num_workers() const {
+        return lanes_.size();
+    }
+
+    void push(std::size_t worker, T const& item) {
+        Lane& lane = *lanes_[worker];
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        lane.items.push_back(item);
+    }
+
+    // Returns false once there is no work left anywhere.
+    bool pop(std::size_t worker, T& item) {
+        {
+            Lane& lane = *lanes_[worker];
+            std::lock_guard<std::mutex> lock(lane.mutex);
+            if (!lane.items.empty()) {
+                item = lane.items.front();
+                lane.items.pop_front();
+                return true;
+            }
+        }
+
+        for (std::size_t i = 1; i < lanes_.size(); ++i) {
+            Lane& victim = *lanes_[(worker + i) % lanes_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.items.empty()) {
+                item = victim.items.back();
+                victim.items.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Drop all remaining work.
+    void cancel() {
+        for (auto i = lanes_.begin(); i != lanes_.end(); ++i) {
+            std::lock_guard<std::mutex> lock((*i)->mutex);
+            (*i)->items.clear();
+        }
+    }
+
+private:
+    struct Lane {
+        std::mutex mutex;
+        std::deque<T> items;
+    };
+
+    std::vector<std::unique_ptr<Lane>> lanes_;
+};
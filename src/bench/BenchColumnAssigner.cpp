@@ -0,0 +1,90 @@
+// Column lookups per second for each ColumnAssigner mode.
+//
+// The reads are synthetic: 16 read groups in 4 libraries, each in runs of
+// a few hundred reads (as in a coordinate sorted bam from a handful of
+// lanes), with a few read lengths. Every read group name is copied to a
+// buffer of its own, as it would be in a bam record.
+
+#include "ColumnAssigner.hpp"
+
+#include <boost/format.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using boost::format;
+
+namespace {
+    std::size_t const N_READS = 1 << 20;
+    int const N_ROUNDS = 20;
+
+    struct Reads {
+        std::vector<char> names; // nul terminated read group names
+        std::vector<std::size_t> offsets;
+        std::vector<uint32_t> lens;
+    };
+
+    Reads make_reads(RgToLibMap const& rg2lib, std::vector<uint32_t> const& lens) {
+        std::vector<std::string> rgs;
+        for (auto i = rg2lib.begin(); i != rg2lib.end(); ++i)
+            rgs.push_back(i->first);
+
+        Reads reads;
+        srand48(42);
+        std::size_t rg = 0;
+        for (std::size_t i = 0; i < N_READS; ++i) {
+            if (lrand48() % 300 == 0)
+                rg = lrand48() % rgs.size();
+
+            reads.offsets.push_back(reads.names.size());
+            reads.names.insert(reads.names.end(), rgs[rg].begin(), rgs[rg].end());
+            reads.names.push_back('\0');
+            reads.lens.push_back(lens[lrand48() % lens.size()]);
+        }
+        return reads;
+    }
+
+    void bench(char const* mode, ColumnAssignerBase const& ca, Reads const& reads) {
+        bool rg = ca.needs_read_group();
+        long checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < N_ROUNDS; ++round) {
+            for (std::size_t i = 0; i < N_READS; ++i) {
+                char const* name = rg ? &reads.names[reads.offsets[i]] : 0;
+                checksum += ca.assign_column(name, reads.lens[i]);
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double rate = N_READS * double(N_ROUNDS) / elapsed.count();
+        std::cout << format("%-24s %8.1f M lookups/s  (checksum %d)\n")
+            % mode % (rate / 1e6) % checksum;
+    }
+}
+
+int main() {
+    RgToLibMap rg2lib;
+    for (int i = 0; i < 16; ++i) {
+        std::string rg = str(format("H7TLVADXX.%d.ACGTACGT-%d") % (i % 2 + 1) % i);
+        rg2lib[rg] = str(format("lib%d") % (i % 4));
+    }
+
+    std::vector<uint32_t> lens{100, 101, 125, 150, 151, 250};
+    PerLibReadLengths lib_lens;
+    for (auto i = rg2lib.begin(); i != rg2lib.end(); ++i)
+        lib_lens[i->second].insert(lens.begin(), lens.end());
+
+    Reads reads = make_reads(rg2lib, lens);
+
+    bench("single", SingleColumnAssigner(), reads);
+    bench("by length", PerLengthColumnAssigner(lens), reads);
+    bench("by library", PerLibColumnAssigner(rg2lib), reads);
+    bench("by library and length", PerLibAndLengthColumnAssigner(rg2lib, lib_lens), reads);
+    bench("discovered by length", DiscoveringColumnAssigner(rg2lib, false), reads);
+    bench("discovered by both", DiscoveringColumnAssigner(rg2lib, true), reads);
+    return 0;
+}
@@ -0,0 +1,131 @@
+// Megabytes of table text per second written by DefaultRowPrinter, and by
+// the ostream insertion it replaced, to /dev/null.
+//
+// Tables have 100bp windows with 1 or 50 columns (e.g., libraries by
+// read length) and counts typical of 30x coverage: mostly small, with
+// empty rows and zero cells mixed in.
+
+#include "ColumnAssigner.hpp"
+#include "TableBuilder.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using boost::format;
+
+namespace {
+    uint32_t const N_ROWS = 200000;
+    uint32_t const WIN_SIZE = 100;
+    int const N_ROUNDS = 5;
+
+    // The row printer as it was, one operator<< per field
+    struct StreamRowPrinter {
+        StreamRowPrinter(std::ostream& os, ColumnAssignerBase const& col_assigner)
+            : os(os)
+        {
+            for (std::size_t i = 0; i < col_assigner.num_columns(); ++i)
+                empty_value_str += "\t0";
+        }
+
+        void operator()(char const* seq_name, uint32_t pos) {
+            os << seq_name << "\t" << pos << empty_value_str << "\n";
+        }
+
+        void operator()(char const* seq_name, uint32_t pos, std::vector<uint64_t> const& counts) {
+            os << seq_name << "\t" << pos;
+            for (auto i = counts.begin(); i != counts.end(); ++i)
+                os << "\t" << *i;
+            os << "\n";
+        }
+
+        std::ostream& os;
+        std::string empty_value_str;
+    };
+
+    // Counts for each row; empty vectors are empty rows
+    std::vector<std::vector<uint64_t>> make_rows(std::size_t n_cols) {
+        srand48(42);
+        std::vector<std::vector<uint64_t>> rows(N_ROWS);
+        for (auto i = rows.begin(); i != rows.end(); ++i) {
+            if (drand48() < 0.1)
+                continue;
+            i->resize(n_cols);
+            for (auto j = i->begin(); j != i->end(); ++j)
+                *j = drand48() < 0.3 ? 0 : lrand48() % (1000 / n_cols + 2);
+        }
+        return rows;
+    }
+
+    template<typename Printer>
+    void print_table(std::ostream& os, ColumnAssignerBase const& ca,
+        std::vector<std::vector<uint64_t>> const& rows)
+    {
+        Printer printer(os, ca);
+        uint32_t pos = 1;
+        for (auto i = rows.begin(); i != rows.end(); ++i, pos += WIN_SIZE) {
+            if (i->empty())
+                printer("chr1", pos);
+            else
+                printer("chr1", pos, *i);
+        }
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    // the fastest of N_ROUNDS rounds, which is the least disturbed by
+    // whatever else the machine is doing
+    template<typename Printer>
+    void bench(char const* mode, char const* how, ColumnAssignerBase const& ca,
+        std::vector<std::vector<uint64_t>> const& rows)
+    {
+        std::stringstream text;
+        print_table<Printer>(text, ca, rows);
+        double megabytes = text.str().size() / 1e6;
+
+        double best = 1e9;
+        for (int round = 0; round < N_ROUNDS; ++round) {
+            std::ofstream out("/dev/null");
+            auto start = Clock::now();
+            print_table<Printer>(out, ca, rows);
+            out.flush();
+            std::chrono::duration<double> elapsed = Clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        std::cout << format("%-12s %-10s %8.1f MB/s  (%.1f MB)\n")
+            % mode % how % (megabytes / best) % megabytes;
+    }
+
+    void bench_both(char const* mode, ColumnAssignerBase const& ca) {
+        auto rows = make_rows(ca.num_columns());
+
+        std::stringstream expected;
+        std::stringstream actual;
+        print_table<StreamRowPrinter>(expected, ca, rows);
+        print_table<DefaultRowPrinter>(actual, ca, rows);
+        if (expected.str() != actual.str()) {
+            std::cerr << "ERROR: " << mode << " tables differ\n";
+            exit(1);
+        }
+
+        bench<StreamRowPrinter>(mode, "ostream", ca, rows);
+        bench<DefaultRowPrinter>(mode, "buffered", ca, rows);
+    }
+}
+
+int main() {
+    std::vector<uint32_t> lens;
+    for (uint32_t i = 0; i < 50; ++i)
+        lens.push_back(100 + i);
+
+    bench_both("1 column", SingleColumnAssigner());
+    bench_both("50 columns", PerLengthColumnAssigner(lens));
+    return 0;
+}
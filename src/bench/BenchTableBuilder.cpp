@@ -0,0 +1,157 @@
+// Reads counted per second by TableBuilder, one at a time (operator())
+// and in batches (add_batch()), for a few column assigner modes.
+//
+// This is the part of counting that runs after a record is decoded. The
+// reads are synthetic: a few read lengths and 16 read groups, interleaved
+// as in a coordinate sorted file from several lanes, at about 30x
+// coverage of one sequence.
+
+#include "ColumnAssigner.hpp"
+#include "ReadBatch.hpp"
+#include "RowAssigner.hpp"
+#include "TableBuilder.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using boost::format;
+
+namespace {
+    std::size_t const N_READS = 1 << 21;
+    uint32_t const SEQ_LEN = 10000000;
+    uint32_t const WIN_SIZE = 1000;
+    int const N_ROUNDS = 7;
+
+    struct Read {
+        uint32_t start;
+        uint32_t end;
+        uint32_t len;
+        char const* rg;
+    };
+
+    uint32_t first_pos(Read const& r) { return r.start; }
+    uint32_t last_pos(Read const& r) { return r.end; }
+    uint32_t length(Read const& r) { return r.len; }
+    char const* read_group(Read const& r) { return r.rg; }
+
+    struct SumPrinter {
+        void operator()(char const*, uint32_t) {}
+        void operator()(char const*, uint32_t, std::vector<uint64_t> const& counts) {
+            for (auto i = counts.begin(); i != counts.end(); ++i)
+                sum += *i;
+        }
+
+        uint64_t sum;
+    };
+
+    struct NoWarnings {
+        void warn_invalid_col(char const*, uint32_t) {}
+    };
+
+    typedef TableBuilder<SumPrinter, NoWarnings> BuilderType;
+
+    std::vector<Read> make_reads(
+              std::vector<std::string> const& rgs
+            , std::vector<uint32_t> const& lens
+            )
+    {
+        std::vector<Read> reads;
+        srand48(42);
+        for (std::size_t i = 0; i < N_READS; ++i) {
+            Read r;
+            r.start = lrand48() % (SEQ_LEN - 1000);
+            r.len = lens[lrand48() % lens.size()];
+            r.end = r.start + r.len;
+            r.rg = rgs[lrand48() % rgs.size()].c_str();
+            reads.push_back(r);
+        }
+
+        struct ByStart {
+            bool operator()(Read const& a, Read const& b) const {
+                return a.start < b.start;
+            }
+        };
+        std::sort(reads.begin(), reads.end(), ByStart());
+        return reads;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    void report(char const* mode, char const* how, double seconds, uint64_t checksum) {
+        std::cout << format("%-24s %-8s %8.1f M reads/s  (checksum %d)\n")
+            % mode % how % (N_READS / seconds / 1e6) % checksum;
+    }
+
+    // the fastest of N_ROUNDS rounds, which is the least disturbed by
+    // whatever else the machine is doing
+    void bench(char const* mode, ColumnAssignerBase const& ca, std::vector<Read> const& reads) {
+        RowAssigner rows(SEQ_LEN, WIN_SIZE);
+        SumPrinter printer = {0};
+        NoWarnings warnings;
+
+        double best = 1e9;
+        for (int round = 0; round < N_ROUNDS; ++round) {
+            printer.sum = 0;
+            auto start = Clock::now();
+            {
+                BuilderType builder("chr1", rows, ca, printer, warnings);
+                for (auto i = reads.begin(); i != reads.end(); ++i)
+                    builder(*i);
+            }
+            std::chrono::duration<double> elapsed = Clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        report(mode, "per read", best, printer.sum);
+
+        best = 1e9;
+        for (int round = 0; round < N_ROUNDS; ++round) {
+            printer.sum = 0;
+            auto start = Clock::now();
+            {
+                BuilderType builder("chr1", rows, ca, printer, warnings);
+                ReadBatch batch(true, ca.needs_read_group());
+                for (auto i = reads.begin(); i != reads.end(); ++i) {
+                    batch.push_back(*i);
+                    if (batch.full()) {
+                        builder.add_batch(batch);
+                        batch.clear();
+                    }
+                }
+                builder.add_batch(batch);
+            }
+            std::chrono::duration<double> elapsed = Clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        report(mode, "batched", best, printer.sum);
+    }
+}
+
+int main() {
+    RgToLibMap rg2lib;
+    std::vector<std::string> rgs;
+    for (int i = 0; i < 16; ++i) {
+        std::string rg = str(format("H7TLVADXX.%d.ACGTACGT-%d") % (i % 2 + 1) % i);
+        rg2lib[rg] = str(format("lib%d") % (i % 4));
+        rgs.push_back(rg);
+    }
+
+    std::vector<uint32_t> lens{100, 101, 125, 150, 151, 250};
+    PerLibReadLengths lib_lens;
+    for (auto i = rg2lib.begin(); i != rg2lib.end(); ++i)
+        lib_lens[i->second].insert(lens.begin(), lens.end());
+
+    std::vector<Read> reads = make_reads(rgs, lens);
+
+    bench("single", SingleColumnAssigner(), reads);
+    bench("by length", PerLengthColumnAssigner(lens), reads);
+    bench("by library", PerLibColumnAssigner(rg2lib), reads);
+    bench("by library and length", PerLibAndLengthColumnAssigner(rg2lib, lib_lens), reads);
+    bench("discovered by both", DiscoveringColumnAssigner(rg2lib, true), reads);
+    return 0;
+}
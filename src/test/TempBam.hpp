@@ -0,0 +1,104 @@
+#pragma once
+
+#include <bam.h>
+#include <sam.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+// Writes SAM text out as a sorted, indexed bam file in $TMPDIR for tests
+// that need to go through samtools. The records must already be sorted
+// unless no index is requested. Both the bam and its index are removed when
+// this goes out of scope.
+class TempBam {
+public:
+    explicit TempBam(std::string const& sam_text, char const* mode = "wb", bool index = true) {
+        std::string sam_path = make_temp_path(".sam");
+        {
+            std::ofstream sam(sam_path.c_str());
+            sam << sam_text;
+        }
+
+        path_ = make_temp_path(".bam");
+        samfile_t* in = samopen(sam_path.c_str(), "r", 0);
+        if (!in)
+            throw std::runtime_error("TempBam: failed to read sam text");
+
+        samfile_t* out = samopen(path_.c_str(), mode, in->header);
+        bam1_t* b = bam_init1();
+        while (samread(in, b) >= 0)
+            samwrite(out, b);
+        bam_destroy1(b);
+        samclose(out);
+        samclose(in);
+        unlink(sam_path.c_str());
+
+        if (index && bam_index_build(path_.c_str()) != 0)
+            throw std::runtime_error("TempBam: failed to index " + path_);
+    }
+
+    ~TempBam() {
+        unlink(path_.c_str());
+        unlink((path_ + ".bai").c_str());
+    }
+
+    std::string const& path() const { return path_; }
+
+private:
+    static std::string make_temp_path(char const* suffix) {
+        char const* tmpdir = getenv("TMPDIR");
+        std::string tmpl = std::string(tmpdir ? tmpdir : "/tmp") + "/bam-window-test-XXXXXX";
+        int fd = mkstemp(&tmpl[0]);
+        if (fd < 0)
+            throw std::runtime_error("TempBam: mkstemp failed");
+        close(fd);
+        unlink(tmpl.c_str());
+        return tmpl + suffix;
+    }
+
+    TempBam(TempBam const&);
+    TempBam& operator=(TempBam const&);
+
+    std::string path_;
+};
+
+// Deterministic sorted reads of length read_len spread over the given
+// sequences with roughly `step` bases between read starts. Read groups rg1
+// and rg2 alternate.
+inline
+std::string make_sam_text(
+          std::vector<std::pair<std::string, uint32_t>> const& seqs
+        , uint32_t step
+        , uint32_t read_len
+        )
+{
+    std::stringstream ss;
+    ss << "@HD\tVN:1.0\tSO:coordinate\n";
+    for (auto i = seqs.begin(); i != seqs.end(); ++i)
+        ss << "@SQ\tSN:" << i->first << "\tLN:" << i->second << "\n";
+    ss << "@RG\tID:rg1\tLB:lib1\n@RG\tID:rg2\tLB:lib2\n";
+
+    uint32_t lcg = 12345;
+    std::size_t n = 0;
+    for (auto i = seqs.begin(); i != seqs.end(); ++i) {
+        for (uint32_t pos = 1; pos + read_len <= i->second; pos += step, ++n) {
+            std::string seq(read_len, 'A');
+            for (uint32_t j = 0; j < read_len; ++j) {
+                lcg = lcg * 1103515245 + 12345;
+                seq[j] = "ACGT"[(lcg >> 16) & 3];
+            }
+            ss << "r" << n << "\t0\t" << i->first << "\t" << pos << "\t60\t"
+                << read_len << "M\t*\t0\t0\t" << seq << "\t*\tRG:Z:rg"
+                << (1 + n % 2) << "\n";
+        }
+    }
+    return ss.str();
+}
@@ -0,0 +1,36 @@
+#include "BamEntry.hpp"
+#include "BamReader.hpp"
+#include "TempBam.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+TEST(TestBamEntry, read_group) {
+    std::string sam =
+        "@HD\tVN:1.0\tSO:coordinate\n"
+        "@SQ\tSN:chr1\tLN:1000\n"
+        "@RG\tID:rg1\tLB:lib1\n"
+        "@RG\tID:rg2\tLB:lib2\n";
+    std::string read = "\t0\tchr1\t1\t60\t4M\t*\t0\t0\tACGT\t####";
+    // tags of every type ahead of RG, including an array and a string
+    // that spell RGZ
+    sam += "a" + read + "\tRG:Z:rg1\n";
+    sam += "b" + read + "\tNM:i:1\tMD:Z:2A1\tXA:Z:RGZ,+10,4M,1;\tRG:Z:rg2\n";
+    sam += "c" + read + "\tML:B:C,82,71,90,0,1\tXf:f:1.5\tXH:H:1AE3\tXc:A:c\tRG:Z:rg1\tAS:i:4\n";
+    sam += "d" + read + "\tXs:B:s,-1,18258,90\tXi:i:5916498\n";
+    sam += "e" + read + "\n";
+    TempBam bam(sam);
+
+    std::vector<std::string> expected{"rg1", "rg2", "rg1", "", ""};
+    std::vector<std::string> found;
+    BamReader reader(bam.path());
+    reader.set_read_tags(true);
+    BamEntry e;
+    while (reader.next(e)) {
+        char const* rg = read_group(e);
+        found.push_back(rg ? rg : "");
+    }
+    EXPECT_EQ(expected, found);
+}
@@ -0,0 +1,188 @@
+#include "BamReader.hpp"
+#include "TempBam.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+    struct ReadInfo {
+        int32_t tid;
+        uint32_t pos;
+        std::string name;
+
+        bool operator==(ReadInfo const& rhs) const {
+            return tid == rhs.tid && pos == rhs.pos && name == rhs.name;
+        }
+    };
+
+    std::vector<ReadInfo> read_all(BamReader& reader) {
+        std::vector<ReadInfo> rv;
+        BamEntry e;
+        while (reader.next(e)) {
+            ReadInfo info = {e->core.tid, first_pos(e), name(e)};
+            rv.push_back(info);
+        }
+        return rv;
+    }
+
+    std::vector<ReadInfo> read_by_sequence(BamReader& reader) {
+        std::vector<ReadInfo> rv;
+        for (int32_t i = 0; i < reader.header().num_seqs(); ++i) {
+            reader.set_sequence_idx(i);
+            auto seq_reads = read_all(reader);
+            rv.insert(rv.end(), seq_reads.begin(), seq_reads.end());
+        }
+        return rv;
+    }
+}
+
+class TestBamReader : public ::testing::Test {
+public:
+    void SetUp() {
+        std::vector<std::pair<std::string, uint32_t>> seqs{
+              {"chr1", 400000}
+            , {"chr2", 250000}
+            , {"chr3", 1000}
+            };
+        // ~65k reads of 100bp: several megabytes, i.e., lots of bgzf blocks
+        bam.reset(new TempBam(make_sam_text(seqs, 10, 100)));
+    }
+
+    std::unique_ptr<TempBam> bam;
+};
+
+TEST_F(TestBamReader, threaded_stream_matches_serial) {
+    BamReader serial(bam->path());
+    auto expected = read_all(serial);
+    ASSERT_GT(expected.size(), 60000u);
+
+    for (int n_threads = 2; n_threads <= 8; n_threads *= 2) {
+        BamReader threaded(bam->path());
+        threaded.set_decompression_threads(n_threads);
+        auto observed = read_all(threaded);
+        ASSERT_EQ(expected.size(), observed.size());
+        EXPECT_TRUE(expected == observed) << n_threads << " threads";
+        EXPECT_EQ(serial.total_read(), threaded.total_read());
+    }
+}
+
+TEST_F(TestBamReader, threaded_index_queries_match_serial) {
+    BamReader serial(bam->path());
+    auto expected = read_by_sequence(serial);
+
+    BamReader threaded(bam->path());
+    threaded.set_decompression_threads(4);
+    auto observed = read_by_sequence(threaded);
+    EXPECT_TRUE(expected == observed);
+
+    // Jumping backwards discards whatever was read ahead
+    threaded.set_sequence_idx(0);
+    auto again = read_all(threaded);
+    serial.set_sequence_idx(0);
+    EXPECT_TRUE(read_all(serial) == again);
+}
+
+TEST_F(TestBamReader, skipping_tags_keeps_names_and_cigars) {
+    BamReader full(bam->path());
+    BamReader lean(bam->path());
+    lean.set_read_tags(false);
+
+    BamEntry a;
+    BamEntry b;
+    std::size_t n = 0;
+    while (full.next(a)) {
+        ASSERT_TRUE(lean.next(b));
+        ASSERT_NE((char const*)0, read_group(a));
+        EXPECT_EQ((char const*)0, read_group(b));
+        EXPECT_STREQ(name(a), name(b));
+        EXPECT_EQ(first_pos(a), first_pos(b));
+        EXPECT_EQ(last_pos(a), last_pos(b));
+        EXPECT_EQ(length(a), length(b));
+        ++n;
+    }
+    EXPECT_FALSE(lean.next(b));
+    EXPECT_GT(n, 60000u);
+}
+
+TEST_F(TestBamReader, mmap_matches_stdio) {
+    BamReader serial(bam->path());
+    auto expected = read_by_sequence(serial);
+
+    // level 0 blocks are parsed in place rather than inflated
+    TempBam uncompressed(make_sam_text({{"chr1", 400000}, {"chr2", 250000}, {"chr3", 1000}}, 10, 100), "wbu");
+    std::vector<std::string> paths{bam->path(), uncompressed.path()};
+    for (auto path = paths.begin(); path != paths.end(); ++path) {
+        // both readers share one mapping
+        BamReader mapped(*path);
+        BamReader threaded(*path);
+        ASSERT_TRUE(mapped.use_mmap());
+        ASSERT_TRUE(threaded.use_mmap());
+        threaded.set_decompression_threads(4);
+
+        EXPECT_TRUE(expected == read_by_sequence(mapped)) << *path;
+        EXPECT_TRUE(expected == read_by_sequence(threaded)) << *path;
+
+        // jumping back to an earlier block
+        serial.set_sequence_idx(0);
+        mapped.set_sequence_idx(0);
+        EXPECT_TRUE(read_all(serial) == read_all(mapped)) << *path;
+    }
+}
+
+TEST_F(TestBamReader, prefetch_matches_serial) {
+    BamReader serial(bam->path());
+    auto expected = read_by_sequence(serial);
+    serial.clear_region();
+    serial.set_sequence_idx(0);
+    auto first = read_all(serial);
+
+    // small requests so that each region spans several of them
+    for (int n_threads = 1; n_threads <= 4; n_threads *= 4) {
+        BamReader prefetched(bam->path());
+        ASSERT_TRUE(prefetched.set_prefetch(3, 3 << 16));
+        prefetched.set_decompression_threads(n_threads);
+        EXPECT_TRUE(expected == read_by_sequence(prefetched)) << n_threads;
+
+        prefetched.set_sequence_idx(0);
+        EXPECT_TRUE(first == read_all(prefetched)) << n_threads;
+        EXPECT_GE(prefetched.io_stall_seconds(), 0.0);
+    }
+}
+
+TEST_F(TestBamReader, streaming_needs_no_index) {
+    BamReader indexed(bam->path());
+    auto expected = read_all(indexed);
+
+    std::string sam = make_sam_text({{"chr1", 400000}, {"chr2", 250000}, {"chr3", 1000}}, 10, 100);
+    // reads without a coordinate come last and end the stream
+    sam += "u1\t4\t*\t0\t0\t*\t*\t0\t0\tACGT\tIIII\n";
+    TempBam unindexed(sam, "wb", false);
+    for (int n_threads = 1; n_threads <= 4; n_threads *= 4) {
+        BamReader streaming(unindexed.path(), true);
+        streaming.set_decompression_threads(n_threads);
+        EXPECT_TRUE(expected == read_all(streaming)) << n_threads;
+        EXPECT_EQ(indexed.total_read(), streaming.total_read());
+        BamEntry e;
+        EXPECT_FALSE(streaming.next(e));
+    }
+}
+
+TEST_F(TestBamReader, streaming_rejects_unsorted_input) {
+    std::string sam =
+        "@SQ\tSN:chr1\tLN:1000\n@SQ\tSN:chr2\tLN:1000\n"
+        "a\t0\tchr1\t100\t60\t10M\t*\t0\t0\t*\t*\n"
+        "b\t0\tchr2\t50\t60\t10M\t*\t0\t0\t*\t*\n"
+        "c\t0\tchr2\t20\t60\t10M\t*\t0\t0\t*\t*\n"
+        ;
+    TempBam unsorted(sam, "wb", false);
+    BamReader reader(unsorted.path(), true);
+    BamEntry e;
+    ASSERT_TRUE(reader.next(e));
+    ASSERT_TRUE(reader.next(e));
+    EXPECT_THROW(reader.next(e), std::runtime_error);
+
+    EXPECT_THROW(BamReader(unsorted.path()), std::runtime_error);
+}
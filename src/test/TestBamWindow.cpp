@@ -0,0 +1,659 @@
+#include "BamWindow.hpp"
+#include "BinaryTable.hpp"
+#include "CountCache.hpp"
+#include "Options.hpp"
+#include "TempBam.hpp"
+
+#include <bgzf.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+    // Run bam-window with the given arguments and return its output
+    std::string run(std::string const& bam_path, std::vector<std::string> args) {
+        std::string out_path = bam_path + ".out";
+        args.insert(args.begin(), "bam-window");
+        args.push_back("-o");
+        args.push_back(out_path);
+        args.push_back(bam_path);
+
+        std::vector<char*> argv;
+        for (auto i = args.begin(); i != args.end(); ++i)
+            argv.push_back(&(*i)[0]);
+
+        {
+            Options opts(argv.size(), argv.data());
+            BamWindow app(opts);
+            app.exec();
+        }
+
+        std::ifstream in(out_path.c_str());
+        std::stringstream ss;
+        ss << in.rdbuf();
+        unlink(out_path.c_str());
+        return ss.str();
+    }
+}
+
+class TestBamWindow : public ::testing::Test {
+public:
+    void SetUp() {
+        std::vector<std::pair<std::string, uint32_t>> seqs{
+              {"chr1", 40050}
+            , {"chr2", 999}
+            };
+        // long reads so that lots of them span shard boundaries, plus
+        // one that runs off the end of the last sequence
+        std::string sam = make_sam_text(seqs, 37, 250);
+        sam += "over\t0\tchr2\t990\t60\t250M\t*\t0\t0\t*\t*\tRG:Z:rg1\n";
+        bam.reset(new TempBam(sam));
+    }
+
+    std::unique_ptr<TempBam> bam;
+};
+
+TEST_F(TestBamWindow, shards_match_serial) {
+    std::vector<std::vector<std::string>> cases{
+          {"-w", "100"}
+        , {"-w", "100", "-s"}
+        , {"-w", "70", "-r", "-l"}
+        , {"-w", "100", "-r"}
+        };
+
+    for (auto i = cases.begin(); i != cases.end(); ++i) {
+        std::string expected = run(bam->path(), *i);
+        ASSERT_FALSE(expected.empty());
+
+        char const* shard_sizes[] = {"1", "300", "1000000"};
+        for (int j = 0; j < 3; ++j) {
+            std::vector<std::string> args(*i);
+            args.push_back("-j");
+            args.push_back("3");
+            args.push_back("--shard-size");
+            args.push_back(shard_sizes[j]);
+            EXPECT_EQ(expected, run(bam->path(), args)) << "shard size " << shard_sizes[j];
+        }
+    }
+}
+
+TEST_F(TestBamWindow, streaming_matches_indexed) {
+    std::vector<std::vector<std::string>> cases{
+          {"-w", "100"}
+        , {"-w", "70", "-l"}
+        , {"-w", "100", "-c", "chr2"}
+        , {"-w", "70", "-r", "-l"}
+        };
+
+    for (auto i = cases.begin(); i != cases.end(); ++i) {
+        std::string expected = run(bam->path(), *i);
+        ASSERT_FALSE(expected.empty());
+
+        std::vector<std::string> args(*i);
+        args.push_back("--stream");
+        EXPECT_EQ(expected, run(bam->path(), args));
+    }
+}
+
+TEST_F(TestBamWindow, window_sizes_match_separate_runs) {
+    std::vector<std::vector<std::string>> cases{
+          {}
+        , {"-s"}
+        , {"-r", "-l"}
+        , {"-j", "3", "--shard-size", "300"}
+        , {"--stream"}
+        };
+    char const* sizes[] = {"70", "140", "350"};
+
+    for (auto i = cases.begin(); i != cases.end(); ++i) {
+        std::vector<std::string> args(*i);
+        for (int j = 0; j < 3; ++j) {
+            args.push_back("-w");
+            args.push_back(sizes[j]);
+        }
+        run(bam->path(), args);
+
+        for (int j = 0; j < 3; ++j) {
+            std::vector<std::string> single(*i);
+            single.push_back("-w");
+            single.push_back(sizes[j]);
+            std::string expected = run(bam->path(), single);
+
+            std::string path = bam->path() + ".out." + sizes[j];
+            std::ifstream in(path.c_str());
+            std::stringstream ss;
+            ss << in.rdbuf();
+            unlink(path.c_str());
+            EXPECT_EQ(expected, ss.str()) << "window size " << sizes[j];
+        }
+    }
+}
+
+TEST(TestBamWindowSampling, sample_covers_whole_file) {
+    // the second sequence has its own read length, far from the start
+    std::string sam = make_sam_text({{"chr1", 200000}, {"chr2", 20000}}, 10, 100);
+    std::string chr2 = make_sam_text({{"chr2", 20000}}, 10, 50);
+    sam.erase(sam.find("\tchr2\t1\t") - 1);
+    sam.erase(sam.rfind('\n') + 1);
+    sam += chr2.substr(chr2.find("r0\t"));
+    TempBam bam(sam);
+
+    std::string expected = run(bam.path(), {"-w", "1000", "-r"});
+    EXPECT_EQ(0u, expected.find("Chr\tStart\t50\t100\n"));
+
+    std::string sampled = run(bam.path(), {"-w", "1000", "-r", "--sample-reads", "640"});
+    EXPECT_EQ(expected, sampled);
+}
+
+TEST(TestBamWindowExclusion, matches_removed_reads) {
+    std::string sam = make_sam_text({{"chr1", 20000}, {"chr2", 3000}}, 23, 100);
+    TempBam bam(sam);
+    std::string bed_path = bam.path() + ".bed";
+    {
+        std::ofstream bed(bed_path.c_str());
+        bed << "chr1\t1000\t3000\nchr1\t2500\t3500\nchr1\t9050\t9051\nchr2\t0\t500\nchrM\t0\t10\n";
+    }
+
+    // the same reads without those overlapping the regions (or with -s,
+    // starting in them)
+    std::string kept[2];
+    std::istringstream lines(sam);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::string chr;
+        uint32_t pos = 0;
+        std::istringstream fields(line);
+        fields.ignore(1000, '\t');
+        fields.ignore(1000, '\t');
+        fields >> chr >> pos;
+        uint32_t beg = pos - 1;
+        bool starts_in = (chr == "chr1" && ((beg >= 1000 && beg < 3500) || beg == 9050))
+            || (chr == "chr2" && beg < 500);
+        bool overlaps = starts_in
+            || (chr == "chr1" && ((beg < 1000 && beg + 100 > 1000) || (beg < 9050 && beg + 100 > 9050)));
+        if (line[0] == '@' || !overlaps)
+            kept[0] += line + "\n";
+        if (line[0] == '@' || !starts_in)
+            kept[1] += line + "\n";
+    }
+
+    TempBam without_overlaps(kept[0]);
+    TempBam without_starts(kept[1]);
+    std::vector<std::vector<std::string>> cases{
+          {"-w", "100"}
+        , {"-w", "100", "-j", "3", "--shard-size", "700"}
+        , {"-w", "70", "-r", "-l", "--stream"}
+        , {"-w", "100", "-r"}
+        };
+
+    for (auto i = cases.begin(); i != cases.end(); ++i) {
+        for (int leftmost = 0; leftmost < 2; ++leftmost) {
+            std::vector<std::string> args(*i);
+            if (leftmost)
+                args.push_back("-s");
+            std::string expected = run((leftmost ? without_starts : without_overlaps).path(), args);
+            args.push_back("--exclude-bed");
+            args.push_back(bed_path);
+            EXPECT_EQ(expected, run(bam.path(), args)) << "case " << i - cases.begin()
+                << ", leftmost " << leftmost;
+        }
+    }
+
+    // windows entirely in [1000, 3500) and [0, 500) of chr2 are left out
+    std::string skipped = run(bam.path(), {"-w", "500", "-x", bed_path, "--skip-excluded-windows"});
+    std::string shards = run(bam.path(), {"-w", "500", "-x", bed_path, "--skip-excluded-windows",
+        "-j", "3", "--shard-size", "700"});
+    EXPECT_EQ(skipped, shards);
+    EXPECT_NE(std::string::npos, skipped.find("\nchr1\t501\t"));
+    EXPECT_NE(std::string::npos, skipped.find("\nchr1\t3501\t"));
+    EXPECT_EQ(std::string::npos, skipped.find("\nchr1\t1001\t"));
+    EXPECT_EQ(std::string::npos, skipped.find("\nchr1\t3001\t"));
+    EXPECT_EQ(std::string::npos, skipped.find("\nchr2\t1\t"));
+    EXPECT_NE(std::string::npos, skipped.find("\nchr2\t501\t"));
+
+    unlink(bed_path.c_str());
+}
+
+TEST(TestBamWindowDownsampling, by_name_keeps_mates_together) {
+    // one pair of reads sharing a name in each window, so that a window
+    // counts both mates or neither
+    std::vector<std::pair<std::string, uint32_t>> seqs{
+          {"chr1", 30000}
+        , {"chr2", 5000}
+        };
+    std::stringstream paired;
+    paired << "@HD\tVN:1.0\tSO:coordinate\n";
+    for (auto i = seqs.begin(); i != seqs.end(); ++i)
+        paired << "@SQ\tSN:" << i->first << "\tLN:" << i->second << "\n";
+    paired << "@RG\tID:rg1\tLB:lib1\n";
+    std::size_t n_pairs = 0;
+    for (auto i = seqs.begin(); i != seqs.end(); ++i) {
+        for (uint32_t pos = 1; pos + 100 <= i->second; pos += 100, ++n_pairs) {
+            for (uint32_t mate = 0; mate < 2; ++mate) {
+                paired << "pair" << n_pairs << "\t0\t" << i->first << "\t" << pos + 50 * mate
+                    << "\t60\t50M\t*\t0\t0\t*\t*\tRG:Z:rg1\n";
+            }
+        }
+    }
+    TempBam bam(paired.str());
+
+    std::vector<std::string> args{"-w", "100", "-s", "-d", "0.3", "-S", "17", "--downsample-by-name"};
+    std::string expected = run(bam.path(), args);
+
+    std::vector<std::string> sharded(args);
+    sharded.insert(sharded.end(), {"-j", "3", "--shard-size", "2000"});
+    EXPECT_EQ(expected, run(bam.path(), sharded));
+
+    std::vector<std::string> streamed(args);
+    streamed.push_back("--stream");
+    EXPECT_EQ(expected, run(bam.path(), streamed));
+
+    std::istringstream rows(expected);
+    std::string line;
+    std::getline(rows, line);
+    std::size_t kept_pairs = 0;
+    std::string chr;
+    std::size_t pos;
+    std::size_t count;
+    while (rows >> chr >> pos >> count) {
+        EXPECT_TRUE(count == 0 || count == 2) << chr << ":" << pos << " has " << count;
+        kept_pairs += count / 2;
+    }
+
+    EXPECT_GT(kept_pairs, n_pairs / 4);
+    EXPECT_LT(kept_pairs, n_pairs * 2 / 5);
+
+    args[6] = "18";
+    EXPECT_NE(expected, run(bam.path(), args));
+}
+
+namespace {
+    // The text table for a binary one
+    std::string binary_to_tsv(std::string const& binary, std::string const& path) {
+        {
+            std::ofstream out(path.c_str());
+            out << binary;
+        }
+        BinaryTable table(path);
+        std::stringstream ss;
+        ss << "Chr\tStart";
+        for (auto i = table.column_names().begin(); i != table.column_names().end(); ++i)
+            ss << "\t" << *i;
+        ss << "\n";
+
+        for (std::size_t s = 0; s < table.sequences().size(); ++s) {
+            BinaryTable::Sequence const& seq = table.sequences()[s];
+            std::vector<BinaryTable::Column> columns;
+            for (std::size_t c = 0; c < table.column_names().size(); ++c)
+                columns.push_back(table.column(s, c));
+
+            for (uint32_t row = 0; row < seq.num_windows; ++row) {
+                ss << seq.name << "\t" << row * table.window_size() + 1;
+                for (auto i = columns.begin(); i != columns.end(); ++i)
+                    ss << "\t" << (*i)[row];
+                ss << "\n";
+            }
+        }
+        unlink(path.c_str());
+        return ss.str();
+    }
+}
+
+namespace {
+    // The text table for a bedgraph one
+    std::string bedgraph_to_tsv(std::string const& bedgraph) {
+        std::stringstream in(bedgraph);
+        std::string line;
+        uint32_t win_size = 0;
+        std::vector<std::pair<std::string, uint32_t>> seqs;
+        std::string columns;
+        std::map<std::string, std::vector<std::string>> rows;
+        while (std::getline(in, line)) {
+            std::stringstream fields(line);
+            std::string chr;
+            uint32_t beg;
+            uint32_t end;
+            fields >> chr;
+            if (chr == "#window_size") {
+                fields >> win_size;
+            }
+            else if (chr == "#sequence") {
+                fields >> chr >> end;
+                seqs.push_back(std::make_pair(chr, end));
+                rows[chr].assign((end + win_size - 1) / win_size, "");
+            }
+            else if (chr == "#Chr") {
+                columns = line.substr(line.find("\tEnd") + 4);
+            }
+            else {
+                fields >> beg >> end;
+                std::string counts = line.substr(line.find('\t', chr.size() + 1));
+                counts = counts.substr(counts.find('\t', 1));
+                std::vector<std::string>& seq_rows = rows[chr];
+                for (uint32_t row = beg / win_size; row * win_size < end; ++row) {
+                    if (row >= seq_rows.size())
+                        seq_rows.resize(row + 1);
+                    seq_rows[row] = counts;
+                }
+            }
+        }
+
+        std::size_t n_cols = std::count(columns.begin(), columns.end(), '\t');
+        std::string zeros;
+        for (std::size_t i = 0; i < n_cols; ++i)
+            zeros += "\t0";
+
+        std::stringstream ss;
+        ss << "Chr\tStart" << columns << "\n";
+        for (auto i = seqs.begin(); i != seqs.end(); ++i) {
+            std::vector<std::string> const& seq_rows = rows[i->first];
+            for (uint32_t row = 0; row < seq_rows.size(); ++row) {
+                ss << i->first << "\t" << row * win_size + 1
+                    << (seq_rows[row].empty() ? zeros : seq_rows[row]) << "\n";
+            }
+        }
+        return ss.str();
+    }
+}
+
+TEST_F(TestBamWindow, bedgraph_output_matches_text) {
+    std::vector<std::vector<std::string>> cases{
+          {"-w", "100"}
+        , {"-w", "10", "-l"}
+        , {"-w", "70", "-r", "-l"}
+        , {"-w", "100", "-l", "-j", "3", "--shard-size", "300"}
+        , {"-w", "1000", "--stream", "-c", "chr2"}
+        , {"-w", "16384", "--estimate"}
+        };
+
+    for (auto i = cases.begin(); i != cases.end(); ++i) {
+        std::string expected = run(bam->path(), *i);
+        std::vector<std::string> args(*i);
+        args.push_back("--output-format");
+        args.push_back("bedgraph");
+        std::string bedgraph = run(bam->path(), args);
+        EXPECT_EQ(expected, bedgraph_to_tsv(bedgraph)) << "case " << i - cases.begin();
+    }
+
+    std::string bedgraph = run(bam->path(), {"-w", "10", "--output-format", "bedgraph"});
+    EXPECT_GT(run(bam->path(), {"-w", "10"}).size(), 4 * bedgraph.size());
+
+    // shards print the same runs as a single pass
+    std::vector<std::string> serial{"-w", "100", "-l", "--output-format", "bedgraph"};
+    std::vector<std::string> sharded(serial);
+    sharded.insert(sharded.end(), {"-j", "3", "--shard-size", "300"});
+    EXPECT_EQ(run(bam->path(), serial), run(bam->path(), sharded));
+}
+
+TEST_F(TestBamWindow, bedgraph_runs_span_shards) {
+    // a read starting in every window, so each sequence is one run
+    std::vector<std::pair<std::string, uint32_t>> seqs{
+          {"chr1", 20000}
+        , {"chr2", 5000}
+        };
+    TempBam even(make_sam_text(seqs, 100, 100));
+    std::vector<std::string> args{"-w", "100", "-s", "--output-format", "bedgraph"};
+    std::string expected = run(even.path(), args);
+    EXPECT_NE(std::string::npos, expected.find("\nchr1\t0\t19900\t1\n"));
+
+    char const* shard_sizes[] = {"100", "3000", "1000000"};
+    for (int i = 0; i < 3; ++i) {
+        std::vector<std::string> sharded(args);
+        sharded.insert(sharded.end(), {"-j", "3", "--shard-size", shard_sizes[i]});
+        EXPECT_EQ(expected, run(even.path(), sharded)) << "shard size " << shard_sizes[i];
+    }
+}
+
+namespace {
+    // The text of a BGZF compressed table
+    std::string bgzf_to_text(std::string const& compressed, std::string const& path) {
+        {
+            std::ofstream out(path.c_str());
+            out << compressed;
+        }
+        BGZF* fp = bgzf_open(path.c_str(), "r");
+        std::string rv;
+        char buf[4096];
+        ssize_t n;
+        while (fp && (n = bgzf_read(fp, buf, sizeof(buf))) > 0)
+            rv.append(buf, n);
+        if (fp)
+            bgzf_close(fp);
+        unlink(path.c_str());
+        return rv;
+    }
+}
+
+TEST_F(TestBamWindow, bgzip_output_matches_text) {
+    std::vector<std::vector<std::string>> cases{
+          {"-w", "100"}
+        , {"-w", "100", "--output-format", "bedgraph"}
+        , {"-w", "70", "-r", "-l", "--bgzip-threads", "1"}
+        , {"-w", "100", "-l", "-j", "3", "--shard-size", "300"}
+        , {"-w", "16384", "--estimate"}
+        };
+
+    std::string index_path = bam->path() + ".out.tbi";
+    for (auto i = cases.begin(); i != cases.end(); ++i) {
+        std::string expected = run(bam->path(), *i);
+        std::vector<std::string> args(*i);
+        args.push_back("-z");
+        std::string compressed = run(bam->path(), args);
+        EXPECT_EQ(expected, bgzf_to_text(compressed, bam->path() + ".gz"))
+            << "case " << i - cases.begin();
+        EXPECT_EQ(0, access(index_path.c_str(), R_OK)) << "case " << i - cases.begin();
+        unlink(index_path.c_str());
+    }
+}
+
+TEST_F(TestBamWindow, binary_output_matches_text) {
+    std::vector<std::vector<std::string>> cases{
+          {"-w", "100"}
+        , {"-w", "70", "-r", "-l"}
+        , {"-w", "100", "-l", "-j", "3", "--shard-size", "300"}
+        , {"-w", "1000", "--stream", "-c", "chr2"}
+        , {"-w", "16384", "--estimate"}
+        };
+
+    for (auto i = cases.begin(); i != cases.end(); ++i) {
+        std::string expected = run(bam->path(), *i);
+        std::vector<std::string> args(*i);
+        args.push_back("--output-format");
+        args.push_back("binary");
+        std::string binary = run(bam->path(), args);
+        EXPECT_EQ(expected, binary_to_tsv(binary, bam->path() + ".bin"))
+            << "case " << i - cases.begin();
+    }
+}
+
+TEST_F(TestBamWindow, count_cache_matches_counting) {
+    std::string cache_path = bam->path() + ".cache";
+    // the run writing the cache, then runs answered from it
+    std::vector<std::vector<std::string>> builds{
+          {"-w", "35"}
+        , {"-w", "35", "-s"}
+        , {"-w", "35", "-l", "-r", "-j", "3", "--shard-size", "300"}
+        };
+    std::vector<std::vector<std::string>> queries{
+          {"-w", "35"}
+        , {"-w", "70", "-l"}
+        , {"-w", "350", "-r"}
+        , {"-w", "105", "-l", "-r", "-c", "chr2"}
+        , {"-w", "70", "-w", "140", "-r"}
+        , {"-w", "70", "--output-format", "bedgraph"}
+        };
+
+    for (auto i = builds.begin(); i != builds.end(); ++i) {
+        unlink(cache_path.c_str());
+        bool leftmost = std::find(i->begin(), i->end(), "-s") != i->end();
+
+        std::vector<std::string> args(*i);
+        std::string expected = run(bam->path(), args);
+        args.push_back("--count-cache");
+        args.push_back(cache_path);
+        EXPECT_EQ(expected, run(bam->path(), args)) << "build " << i - builds.begin();
+
+        for (auto j = queries.begin(); j != queries.end(); ++j) {
+            args = *j;
+            if (leftmost)
+                args.push_back("-s");
+            expected = run(bam->path(), args);
+            args.push_back("--count-cache");
+            args.push_back(cache_path);
+            EXPECT_EQ(expected, run(bam->path(), args))
+                << "build " << i - builds.begin() << ", query " << j - queries.begin();
+        }
+
+        // answered, not written again at the queries' window sizes
+        EXPECT_EQ(35u, CountCache(cache_path).resolution());
+    }
+    unlink(cache_path.c_str());
+}
+
+namespace {
+    // The name of the columns of the bam file at path in a cohort table
+    std::string sample_name(std::string const& path) {
+        std::string rv = path.substr(path.rfind('/') + 1);
+        return rv.substr(0, rv.size() - 4);
+    }
+
+    // Split a table into its header and rows, keyed by "Chr\tStart"
+    void split_table(
+              std::string const& table
+            , std::vector<std::string>& columns
+            , std::vector<std::pair<std::string, std::string>>& rows
+            )
+    {
+        std::stringstream ss(table);
+        std::string line;
+        std::getline(ss, line);
+        std::stringstream header(line);
+        std::string column;
+        header >> column >> column;
+        while (header >> column)
+            columns.push_back(column);
+
+        while (std::getline(ss, line)) {
+            std::size_t key_end = line.find('\t', line.find('\t') + 1);
+            rows.push_back(std::make_pair(line.substr(0, key_end), line.substr(key_end)));
+        }
+    }
+
+    // The cohort table of two single input tables: their columns side by
+    // side, with 0 where a read ran past the end of a sequence in one only
+    std::string join_tables(
+              std::string const& a
+            , std::string const& a_name
+            , std::string const& b
+            , std::string const& b_name
+            )
+    {
+        std::vector<std::string> a_cols, b_cols;
+        std::vector<std::pair<std::string, std::string>> a_rows, b_rows;
+        split_table(a, a_cols, a_rows);
+        split_table(b, b_cols, b_rows);
+
+        std::stringstream rv;
+        rv << "Chr\tStart";
+        for (auto i = a_cols.begin(); i != a_cols.end(); ++i)
+            rv << "\t" << a_name << "." << *i;
+        for (auto i = b_cols.begin(); i != b_cols.end(); ++i)
+            rv << "\t" << b_name << "." << *i;
+        rv << "\n";
+
+        std::set<std::string> a_keys, b_keys;
+        for (auto i = a_rows.begin(); i != a_rows.end(); ++i)
+            a_keys.insert(i->first);
+        for (auto i = b_rows.begin(); i != b_rows.end(); ++i)
+            b_keys.insert(i->first);
+
+        std::string a_zeros, b_zeros;
+        for (std::size_t i = 0; i < a_cols.size(); ++i)
+            a_zeros += "\t0";
+        for (std::size_t i = 0; i < b_cols.size(); ++i)
+            b_zeros += "\t0";
+
+        auto i = a_rows.begin();
+        auto j = b_rows.begin();
+        while (i != a_rows.end() || j != b_rows.end()) {
+            if (i != a_rows.end() && j != b_rows.end() && i->first == j->first) {
+                rv << i->first << i->second << j->second << "\n";
+                ++i;
+                ++j;
+            }
+            else if (i != a_rows.end() && !b_keys.count(i->first)) {
+                rv << i->first << i->second << b_zeros << "\n";
+                ++i;
+            }
+            else {
+                rv << j->first << a_zeros << j->second << "\n";
+                ++j;
+            }
+        }
+        return rv.str();
+    }
+}
+
+TEST_F(TestBamWindow, cohort_matches_separate_runs) {
+    // other reads, none of them past the end of chr2
+    std::vector<std::pair<std::string, uint32_t>> seqs{
+          {"chr1", 40050}
+        , {"chr2", 999}
+        };
+    TempBam other(make_sam_text(seqs, 53, 100));
+
+    std::vector<std::vector<std::string>> cases{
+          {"-w", "100"}
+        , {"-w", "100", "-s"}
+        , {"-w", "70", "-l", "-r"}
+        , {"-w", "100", "-r", "--sample-reads", "500"}
+        , {"-w", "1000", "--stream", "-c", "chr2"}
+        };
+
+    for (auto i = cases.begin(); i != cases.end(); ++i) {
+        std::string expected = join_tables(
+              run(bam->path(), *i), sample_name(bam->path())
+            , run(other.path(), *i), sample_name(other.path()));
+
+        std::vector<std::string> args(*i);
+        args.push_back(bam->path());
+        EXPECT_EQ(expected, run(other.path(), args)) << "case " << i - cases.begin();
+    }
+
+    // tables of several window sizes come from the merged rows
+    std::string out_path = bam->path() + ".cohort";
+    std::string const bam_path = bam->path();
+    std::vector<std::string> args{"bam-window", "-w", "100", "-w", "300", "-o", out_path,
+        bam_path, other.path()};
+    std::vector<char*> argv;
+    for (auto i = args.begin(); i != args.end(); ++i)
+        argv.push_back(&(*i)[0]);
+    {
+        Options opts(argv.size(), argv.data());
+        BamWindow app(opts);
+        app.exec();
+    }
+    std::ifstream in((out_path + ".300").c_str());
+    std::stringstream coarse;
+    coarse << in.rdbuf();
+    std::vector<std::string> single{"-w", "300", bam_path};
+    EXPECT_EQ(run(other.path(), single), coarse.str());
+    unlink((out_path + ".100").c_str());
+    unlink((out_path + ".300").c_str());
+}
+
+TEST_F(TestBamWindow, cohort_needs_same_sequences) {
+    TempBam other(make_sam_text({{"chr1", 40050}, {"chr2", 1000}}, 53, 100));
+    std::vector<std::string> args{"-w", "100", other.path()};
+    EXPECT_THROW(run(bam->path(), args), std::runtime_error);
+}
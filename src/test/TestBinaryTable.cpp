@@ -0,0 +1,111 @@
+#include "BinaryTable.hpp"
+#include "BinaryTablePrinter.hpp"
+#include "BamReader.hpp"
+#include "ColumnAssigner.hpp"
+#include "TempBam.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+class TestBinaryTable : public ::testing::Test {
+public:
+    void SetUp() {
+        bam.reset(new TempBam(make_sam_text({{"chr1", 1000}, {"chr2", 250}, {"chr3", 10}}, 100, 5)));
+        reader.reset(new BamReader(bam->path()));
+        path = bam->path() + ".bin";
+    }
+
+    void TearDown() {
+        unlink(path.c_str());
+    }
+
+    std::unique_ptr<TempBam> bam;
+    std::unique_ptr<BamReader> reader;
+    std::string path;
+};
+
+TEST_F(TestBinaryTable, round_trip) {
+    std::vector<uint32_t> lens{36, 100};
+    PerLengthColumnAssigner ca(lens);
+    {
+        std::ofstream out(path.c_str());
+        BinaryTablePrinter printer(out, ca, reader->header(), 100);
+        printer("chr1", 1);
+        printer("chr1", 101, {3, 0});
+        printer("chr1", 201, {0, 7});
+        // chr1 rows 301.. are missing: 0
+        printer("chr2", 1, {300, 1});
+        printer("chr2", 201);
+        printer("chr3", 1, {1, 5000000000u});
+        printer.finish();
+    }
+
+    BinaryTable table(path);
+    EXPECT_EQ(100u, table.window_size());
+    std::vector<std::string> names{"36", "100"};
+    EXPECT_EQ(names, table.column_names());
+    ASSERT_EQ(3u, table.sequences().size());
+    EXPECT_EQ(1, table.find_sequence("chr2"));
+    EXPECT_EQ(-1, table.find_sequence("chr4"));
+    EXPECT_EQ(1, table.find_column("100"));
+
+    BinaryTable::Sequence const& chr1 = table.sequences()[0];
+    EXPECT_EQ("chr1", chr1.name);
+    EXPECT_EQ(1000u, chr1.length);
+    EXPECT_EQ(10u, chr1.num_windows);
+    EXPECT_EQ(1u, chr1.cell_width);
+
+    BinaryTable::Column c0 = table.column(0, 0);
+    BinaryTable::Column c1 = table.column(0, 1);
+    ASSERT_EQ(10u, c0.size());
+    ASSERT_TRUE(c0.cells<uint8_t>() != 0);
+    EXPECT_TRUE(c0.cells<uint16_t>() == 0);
+    EXPECT_EQ(3u, c0.cells<uint8_t>()[1]);
+    EXPECT_EQ(7u, c1[2]);
+    for (std::size_t i = 3; i < 10; ++i)
+        EXPECT_EQ(0u, c0[i] + c1[i]);
+
+    EXPECT_EQ(2u, table.sequences()[1].cell_width);
+    EXPECT_EQ(300u, table.column(1, 0)[0]);
+    EXPECT_EQ(0u, table.column(1, 1)[2]);
+
+    EXPECT_EQ(8u, table.sequences()[2].cell_width);
+    EXPECT_EQ(1u, table.sequences()[2].num_windows);
+    EXPECT_EQ(5000000000u, table.column(2, 1).cells<uint64_t>()[0]);
+}
+
+TEST_F(TestBinaryTable, rejects_other_files) {
+    {
+        std::ofstream out(path.c_str());
+        out << "Chr\tStart\tCounts\nchr1\t1\t0\n";
+    }
+    EXPECT_THROW(BinaryTable table(path), std::runtime_error);
+
+    {
+        std::ofstream out(path.c_str());
+        SingleColumnAssigner ca;
+        BinaryTablePrinter printer(out, ca, reader->header(), 100);
+        printer("chr1", 1, {1});
+        printer.finish();
+    }
+    EXPECT_NO_THROW(BinaryTable table(path));
+
+    // an index offset past the end of the file
+    {
+        std::fstream io(path.c_str(), std::ios::in | std::ios::out);
+        io.seekp(-16, std::ios::end);
+        uint64_t offset = 1000;
+        io.write(reinterpret_cast<char const*>(&offset), sizeof(offset));
+    }
+    EXPECT_THROW(BinaryTable table(path), std::runtime_error);
+
+    // cut off before the trailer
+    EXPECT_EQ(0, truncate(path.c_str(), 40));
+    EXPECT_THROW(BinaryTable table(path), std::runtime_error);
+}
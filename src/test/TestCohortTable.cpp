@@ -0,0 +1,163 @@
+#include "CohortTable.hpp"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    // Prints rows as "chr:pos counts..." lines
+    struct RowRecorder {
+        void operator()(char const* seq_name, uint32_t pos) {
+            std::stringstream ss;
+            ss << seq_name << ":" << pos;
+            rows.push_back(ss.str());
+        }
+
+        void operator()(char const* seq_name, uint32_t pos, std::vector<uint64_t> const& counts) {
+            std::stringstream ss;
+            ss << seq_name << ":" << pos;
+            for (auto i = counts.begin(); i != counts.end(); ++i)
+                ss << " " << *i;
+            rows.push_back(ss.str());
+        }
+
+        std::vector<std::string> rows;
+    };
+}
+
+TEST(TestCohortTable, queue) {
+    SampleRowQueue queue(2);
+    std::vector<std::string> seq_names{"chr1"};
+    SampleRowCollector collector(queue, seq_names, 2);
+    collector("chr1", 1);
+    collector("chr1", 11, {4});
+    collector("chr1", 21, {5});
+    collector.finish();
+
+    SampleRows rows;
+    ASSERT_TRUE(queue.pop(rows));
+    ASSERT_EQ(2u, rows.size());
+    EXPECT_EQ(11u, rows.positions[1]);
+    std::vector<std::size_t> offsets{0, 0, 1};
+    EXPECT_EQ(offsets, rows.offsets);
+    ASSERT_TRUE(queue.pop(rows));
+    ASSERT_EQ(1u, rows.size());
+    EXPECT_EQ(5u, rows.counts[0]);
+    EXPECT_FALSE(queue.pop(rows));
+
+    EXPECT_THROW(collector("chr2", 1), std::runtime_error);
+}
+
+TEST(TestCohortTable, queue_errors) {
+    SampleRowQueue failed;
+    failed.abort(std::make_exception_ptr(std::runtime_error("bad input")));
+    SampleRows rows;
+    EXPECT_THROW(failed.pop(rows), std::runtime_error);
+
+    // a full queue stops waiting when cancelled; later rows are dropped
+    SampleRowQueue cancelled(1);
+    std::vector<std::string> seq_names{"chr1"};
+    SampleRowCollector collector(cancelled, seq_names, 1);
+    collector("chr1", 1);
+    std::thread canceller(&SampleRowQueue::cancel, &cancelled);
+    collector("chr1", 11);
+    canceller.join();
+    EXPECT_TRUE(cancelled.cancelled());
+    collector("chr1", 21);
+    collector.finish();
+
+    ASSERT_TRUE(cancelled.pop(rows));
+    ASSERT_EQ(1u, rows.size());
+    EXPECT_EQ(1u, rows.positions[0]);
+    EXPECT_FALSE(cancelled.pop(rows));
+}
+
+TEST(TestCohortTable, merge) {
+    RgToLibMap rg2lib;
+    SingleColumnAssigner single;
+    DiscoveringColumnAssigner discovering(rg2lib, false);
+    EXPECT_EQ(0, discovering.assign_column(0, 100));
+    EXPECT_EQ(1, discovering.assign_column(0, 36));
+
+    std::vector<std::string> samples{"a", "b"};
+    std::vector<ColumnAssignerBase const*> inputs{&single, &discovering};
+    CohortColumnAssigner cohort(samples, inputs);
+    EXPECT_FALSE(cohort.fixed_columns());
+    EXPECT_EQ(1u, cohort.num_columns());
+
+    // names as given to the rows; the collectors see other pointers
+    std::vector<std::string> seq_names{"chr1", "chr2"};
+    std::vector<char const*> names{"chr1", "chr2"};
+    SampleRowQueue queue_a;
+    SampleRowQueue queue_b;
+    {
+        SampleRowCollector a(queue_a, seq_names, 2);
+        a(seq_names[0].c_str(), 1, {3});
+        a(seq_names[0].c_str(), 11);
+        // a read ran past the end of chr1 in input a only
+        a(seq_names[0].c_str(), 21, {1});
+        a(seq_names[1].c_str(), 1, {2});
+        a.finish();
+
+        SampleRowCollector b(queue_b, seq_names, 2);
+        b(seq_names[0].c_str(), 1, {0, 5});
+        b(seq_names[0].c_str(), 11, {1});
+        b(seq_names[1].c_str(), 1);
+        b.finish();
+    }
+
+    RowRecorder printer;
+    std::vector<SampleRowQueue*> queues{&queue_a, &queue_b};
+    merge_sample_rows(queues, cohort, names, 1, printer);
+
+    std::vector<std::string> expected{
+          "chr1:1 3 0 5"
+        , "chr1:11 0 1 0"
+        , "chr1:21 1 0 0"
+        , "chr2:1 2 0 0"
+        };
+    EXPECT_EQ(expected, printer.rows);
+
+    std::vector<std::string> expected_names{"a.Counts", "b.36", "b.100"};
+    EXPECT_EQ(expected_names, cohort.output_column_names());
+    std::vector<std::size_t> expected_order{0, 2, 1};
+    EXPECT_EQ(expected_order, cohort.column_order());
+}
+
+TEST(TestCohortTable, merge_with_starts) {
+    std::vector<uint32_t> lens{36, 100};
+    PerLengthColumnAssigner by_len(lens);
+    SingleColumnAssigner single;
+    std::vector<std::string> samples{"a", "b"};
+    std::vector<ColumnAssignerBase const*> inputs{&by_len, &single};
+    CohortColumnAssigner cohort(samples, inputs);
+    EXPECT_TRUE(cohort.fixed_columns());
+    EXPECT_EQ(3u, cohort.num_columns());
+
+    std::vector<std::string> seq_names{"chr1"};
+    std::vector<char const*> names{"chr1"};
+    SampleRowQueue queue_a;
+    SampleRowQueue queue_b;
+    {
+        SampleRowCollector a(queue_a, seq_names);
+        a(seq_names[0].c_str(), 1, {1, 1, 2, 0});
+        a.finish();
+
+        SampleRowCollector b(queue_b, seq_names);
+        b(seq_names[0].c_str(), 1, {7, 6});
+        b.finish();
+    }
+
+    RowRecorder printer;
+    std::vector<SampleRowQueue*> queues{&queue_a, &queue_b};
+    merge_sample_rows(queues, cohort, names, 2, printer);
+
+    std::vector<std::string> expected{"chr1:1 1 1 2 0 7 6"};
+    EXPECT_EQ(expected, printer.rows);
+    std::vector<std::size_t> expected_order{0, 1, 2};
+    EXPECT_EQ(expected_order, cohort.column_order());
+}
@@ -2,7 +2,9 @@
 
 #include <gtest/gtest.h>
 
+#include <new>
 #include <sstream>
+#include <type_traits>
 
 class TestColumnAssigner : public ::testing::Test {
 public:
@@ -167,3 +169,125 @@ TEST_F(TestColumnAssigner, assign_by_lib_and_len) {
     EXPECT_EQ(5, ca.assign_column("rg4", 250));
 
 }
+
+
+TEST_F(TestColumnAssigner, discover_by_len) {
+    DiscoveringColumnAssigner ca(rg2lib, false);
+    EXPECT_EQ(0u, ca.num_columns());
+    EXPECT_FALSE(ca.fixed_columns());
+    EXPECT_FALSE(ca.needs_read_group());
+
+    // columns are numbered as they show up
+    EXPECT_EQ(0, ca.assign_column(0, 100));
+    EXPECT_EQ(1, ca.assign_column("rg3", 36));
+    EXPECT_EQ(0, ca.assign_column("unknown_rg", 100));
+    EXPECT_EQ(2, ca.assign_column("rg1", 75));
+    EXPECT_EQ(1, ca.assign_column("rg1", 36));
+    EXPECT_EQ(3u, ca.num_columns());
+
+    // but reported in order of length
+    std::vector<std::size_t> expected_order{2, 0, 1};
+    EXPECT_EQ(expected_order, ca.column_order());
+
+    std::stringstream ss;
+    ca.print_header(ss);
+    EXPECT_EQ("Chr\tStart\t36\t75\t100\n", ss.str());
+}
+
+
+TEST_F(TestColumnAssigner, discover_by_lib_and_len) {
+    DiscoveringColumnAssigner ca(rg2lib, true);
+    EXPECT_TRUE(ca.needs_read_group());
+
+    EXPECT_EQ(-1, ca.assign_column("unknown_rg", 100));
+    EXPECT_EQ(-1, ca.assign_column(0, 100));
+    EXPECT_EQ(0u, ca.num_columns());
+
+    EXPECT_EQ(0, ca.assign_column("rg4", 150));
+    EXPECT_EQ(1, ca.assign_column("rg3", 100));
+    // rg2 also goes to lib1; same cols as rg1
+    EXPECT_EQ(2, ca.assign_column("rg1", 75));
+    EXPECT_EQ(2, ca.assign_column("rg2", 75));
+    EXPECT_EQ(3, ca.assign_column("rg2", 36));
+    EXPECT_EQ(4, ca.assign_column("rg3", 75));
+    EXPECT_EQ(5u, ca.num_columns());
+
+    std::vector<std::size_t> expected_order{4, 3, 1, 0, 2};
+    EXPECT_EQ(expected_order, ca.column_order());
+
+    std::stringstream ss;
+    ca.print_header(ss);
+    EXPECT_EQ("Chr\tStart\t"
+        "lib1.36\tlib1.75\t"
+        "lib2.75\tlib2.100\t"
+        "lib3.150\n"
+        , ss.str());
+}
+
+TEST_F(TestColumnAssigner, read_group_index) {
+    ReadGroupIndex index(rg2lib);
+    ASSERT_EQ(4u, index.size());
+
+    // the same name at different addresses, as in consecutive reads
+    std::string rg3("rg3");
+    std::string other("rg3");
+    EXPECT_EQ(2, index.find(rg3.c_str()));
+    EXPECT_EQ(2, index.find(other.c_str()));
+    EXPECT_EQ(0, index.find("rg1"));
+    EXPECT_EQ(-1, index.find("rg"));
+    EXPECT_EQ(-1, index.find("rg11"));
+    EXPECT_EQ(-1, index.find(0));
+    EXPECT_EQ(0, index.find("rg1"));
+    EXPECT_EQ("rg4", index.name(index.find("rg4")));
+
+    // another index must not pick up the read group cached above
+    RgToLibMap other_map;
+    other_map["rg4"] = "lib1";
+    ReadGroupIndex other_index(other_map);
+    EXPECT_EQ(0, other_index.find("rg4"));
+    EXPECT_EQ(-1, other_index.find("rg1"));
+    EXPECT_EQ(3, index.find("rg4"));
+}
+
+TEST_F(TestColumnAssigner, read_group_index_reused_address) {
+    // an index built where a larger one was must not use its cached id
+    RgToLibMap small_map;
+    small_map["rg4"] = "lib1";
+    std::aligned_storage<sizeof(ReadGroupIndex), alignof(ReadGroupIndex)>::type buf;
+
+    ReadGroupIndex* index = new (&buf) ReadGroupIndex(rg2lib);
+    EXPECT_EQ(3, index->find("rg4"));
+    index->~ReadGroupIndex();
+
+    index = new (&buf) ReadGroupIndex(small_map);
+    EXPECT_EQ(0, index->find("rg4"));
+    EXPECT_EQ(-1, index->find("rg1"));
+    index->~ReadGroupIndex();
+}
+
+TEST_F(TestColumnAssigner, long_read_lengths) {
+    std::vector<uint32_t> read_lens{150, 70000, 2000000};
+    PerLengthColumnAssigner ca(read_lens);
+    EXPECT_EQ(0, ca.assign_column(0, 150));
+    EXPECT_EQ(1, ca.assign_column(0, 70000));
+    EXPECT_EQ(2, ca.assign_column(0, 2000000));
+    EXPECT_EQ(-1, ca.assign_column(0, 151));
+    EXPECT_EQ(-1, ca.assign_column(0, 70001));
+}
+
+TEST_F(TestColumnAssigner, discover_keeping_unmatched) {
+    DiscoveringColumnAssigner ca(rg2lib, true, true);
+
+    EXPECT_EQ(0, ca.assign_column("unknown_rg", 100));
+    EXPECT_EQ(1, ca.assign_column(0, 100));
+    EXPECT_EQ(2, ca.assign_column("rg3", 100));
+    EXPECT_EQ(0, ca.assign_column("other_rg", 100));
+    EXPECT_EQ(3u, ca.num_columns());
+
+    std::vector<uint64_t> expected_keys{
+          (uint64_t(DiscoveringColumnAssigner::UNKNOWN_READ_GROUP) << 32) | 100
+        , (uint64_t(DiscoveringColumnAssigner::NO_READ_GROUP) << 32) | 100
+        , (uint64_t(1) << 32) | 100
+        };
+    EXPECT_EQ(expected_keys, ca.column_keys());
+}
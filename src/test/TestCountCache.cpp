@@ -0,0 +1,152 @@
+#include "CountCache.hpp"
+#include "ColumnAssigner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+class TestCountCache : public ::testing::Test {
+public:
+    void SetUp() {
+        char tmpl[] = "/tmp/count-cache-XXXXXX";
+        int fd = mkstemp(tmpl);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        path = tmpl;
+
+        key.bam_size = 1234;
+        key.bam_mtime = 5678;
+        key.header_hash = 42;
+        key.settings = "min_mapq 0";
+
+        libs = {"lib1", "lib2"};
+        column_keys = {
+              (uint64_t(1) << 32) | 36
+            , (uint64_t(DiscoveringColumnAssigner::NO_READ_GROUP) << 32) | 50
+            , 100
+            };
+        seq_names = {"chr1", "chr2", "chr3"};
+    }
+
+    void TearDown() {
+        unlink(path.c_str());
+    }
+
+    std::string path;
+    CountCache::Key key;
+    std::vector<std::string> libs;
+    std::vector<uint64_t> column_keys;
+    std::vector<std::string> seq_names;
+};
+
+TEST_F(TestCountCache, round_trip) {
+    {
+        CountCache::Writer writer(path, key, 10, true, libs, column_keys, seq_names);
+        // counts and read starts of each column
+        writer("chr1", 1, {3, 1, 0, 0, 0, 0});
+        // rows 11 and 21 are missing: empty
+        writer("chr1", 31, {0, 0, 0, 0, 2, 2});
+        writer("chr1", 41, {0, 0, 5, 0});
+        writer("chr2", 1);
+        // nothing at all for chr3
+        writer.finish();
+    }
+
+    CountCache cache(path);
+    EXPECT_TRUE(key == cache.key());
+    EXPECT_EQ(10u, cache.resolution());
+    EXPECT_TRUE(cache.with_starts());
+    EXPECT_EQ(libs, cache.library_names());
+    EXPECT_EQ(column_keys, cache.column_keys());
+
+    std::vector<bool> used_chr1{true, true, true};
+    std::vector<bool> used_none{false, false, false};
+    EXPECT_EQ(used_chr1, cache.used_columns({"chr1", "chr2"}));
+    EXPECT_EQ(used_none, cache.used_columns({"chr2", "chr3"}));
+
+    std::vector<CountCache::Cell> cells;
+    ASSERT_EQ(5u, cache.seek("chr1"));
+    cache.next_row(cells);
+    ASSERT_EQ(1u, cells.size());
+    EXPECT_EQ(0u, cells[0].column);
+    EXPECT_EQ(3u, cells[0].count);
+    EXPECT_EQ(1u, cells[0].starts);
+    cache.next_row(cells);
+    EXPECT_TRUE(cells.empty());
+    cache.next_row(cells);
+    EXPECT_TRUE(cells.empty());
+    cache.next_row(cells);
+    ASSERT_EQ(1u, cells.size());
+    EXPECT_EQ(2u, cells[0].column);
+    EXPECT_EQ(2u, cells[0].count);
+    EXPECT_EQ(2u, cells[0].starts);
+    cache.next_row(cells);
+    ASSERT_EQ(1u, cells.size());
+    EXPECT_EQ(1u, cells[0].column);
+    EXPECT_EQ(5u, cells[0].count);
+    EXPECT_EQ(0u, cells[0].starts);
+
+    ASSERT_EQ(1u, cache.seek("chr2"));
+    cache.next_row(cells);
+    EXPECT_TRUE(cells.empty());
+    EXPECT_EQ(0u, cache.seek("chr3"));
+    EXPECT_THROW(cache.seek("chr4"), std::runtime_error);
+}
+
+TEST_F(TestCountCache, can_answer) {
+    {
+        CountCache::Writer writer(path, key, 100, false, libs, column_keys, seq_names);
+        writer("chr1", 101, {1, 0, 0});
+        writer.finish();
+    }
+
+    CountCache cache(path);
+    EXPECT_FALSE(cache.with_starts());
+
+    std::string reason;
+    EXPECT_TRUE(cache.can_answer(key, {100, 300, 1000}, {"chr1", "chr3"}, reason));
+
+    EXPECT_FALSE(cache.can_answer(key, {100, 250}, seq_names, reason));
+    EXPECT_NE(std::string::npos, reason.find("250"));
+
+    EXPECT_FALSE(cache.can_answer(key, {100}, {"chr1", "chrX"}, reason));
+    EXPECT_NE(std::string::npos, reason.find("chrX"));
+
+    CountCache::Key other(key);
+    other.bam_mtime += 1;
+    EXPECT_FALSE(cache.can_answer(other, {100}, seq_names, reason));
+    other = key;
+    other.settings = "min_mapq 20";
+    EXPECT_FALSE(cache.can_answer(other, {100}, seq_names, reason));
+}
+
+TEST_F(TestCountCache, out_of_order) {
+    CountCache::Writer writer(path, key, 10, false, libs, column_keys, seq_names);
+    writer("chr1", 21, {1});
+    EXPECT_THROW(writer("chr1", 11, {1}), std::runtime_error);
+
+    writer("chr2", 1, {1});
+    EXPECT_THROW(writer("chr1", 31, {1}), std::runtime_error);
+}
+
+TEST_F(TestCountCache, not_a_cache) {
+    {
+        std::ofstream out(path.c_str());
+        out << "Chr\tStart\tCounts\nchr1\t1\t0\n";
+    }
+    EXPECT_THROW(CountCache cache(path), std::runtime_error);
+
+    {
+        CountCache::Writer writer(path, key, 10, false, libs, column_keys, seq_names);
+        writer("chr1", 1, {1});
+        writer.finish();
+    }
+    // cut off the end of the index
+    ASSERT_EQ(0, truncate(path.c_str(), 40));
+    EXPECT_THROW(CountCache cache(path), std::runtime_error);
+}
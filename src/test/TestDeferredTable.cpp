@@ -0,0 +1,67 @@
+#include "DeferredTable.hpp"
+#include "ColumnAssigner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    // Writes a few rows as a TableBuilder would while discovering columns:
+    // later rows are wider than earlier ones.
+    void add_rows(DeferredTable& table, DiscoveringColumnAssigner const& ca) {
+        DeferredRowEncoder encoder(table.rows(), ca);
+        EXPECT_EQ(0, ca.assign_column(0, 100));
+        encoder("chr1", 1, std::vector<uint64_t>{3});
+        encoder("chr1", 11);
+        EXPECT_EQ(1, ca.assign_column(0, 36));
+        encoder("chr1", 21, std::vector<uint64_t>{0, 2});
+
+        std::string chr2("chr2");
+        encoder(chr2.c_str(), 1, std::vector<uint64_t>{1});
+        encoder(chr2.c_str(), 11, std::vector<uint64_t>{4, 5});
+    }
+
+    std::string const expected =
+        "Chr\tStart\t36\t100\n"
+        "chr1\t1\t0\t3\n"
+        "chr1\t11\t0\t0\n"
+        "chr1\t21\t2\t0\n"
+        "chr2\t1\t0\t1\n"
+        "chr2\t11\t5\t4\n"
+        ;
+}
+
+TEST(TestDeferredTable, rows_get_final_columns) {
+    DiscoveringColumnAssigner ca(RgToLibMap(), false);
+    DeferredTable table;
+    add_rows(table, ca);
+
+    std::stringstream ss;
+    table.write(ss, ca);
+    EXPECT_EQ(expected, ss.str());
+}
+
+TEST(TestDeferredTable, spills_to_disk) {
+    DiscoveringColumnAssigner ca(RgToLibMap(), false);
+    DeferredTable table(16);
+    add_rows(table, ca);
+
+    std::stringstream ss;
+    table.write(ss, ca);
+    EXPECT_EQ(expected, ss.str());
+}
+
+TEST(TestDeferredTable, spill_buffer) {
+    SpillBuffer buffer(10);
+    std::ostream out(&buffer);
+    out << "hello";
+    EXPECT_FALSE(buffer.spilled());
+    EXPECT_EQ("hello", std::string(std::istreambuf_iterator<char>(buffer.reader()), {}));
+
+    out << ", world";
+    out.flush();
+    EXPECT_TRUE(buffer.spilled());
+    EXPECT_EQ("hello, world", std::string(std::istreambuf_iterator<char>(buffer.reader()), {}));
+}
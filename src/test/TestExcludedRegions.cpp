@@ -0,0 +1,90 @@
+#include "ExcludedRegions.hpp"
+#include "BamReader.hpp"
+#include "TempBam.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+class TestExcludedRegions : public ::testing::Test {
+public:
+    void SetUp() {
+        bam.reset(new TempBam(make_sam_text({{"chr1", 10000}, {"chr2", 5000}}, 1000, 100)));
+        reader.reset(new BamReader(bam->path()));
+    }
+
+    ExcludedRegions load(std::string const& text) {
+        std::istringstream bed(text);
+        return ExcludedRegions(bed, reader->header());
+    }
+
+    std::unique_ptr<TempBam> bam;
+    std::unique_ptr<BamReader> reader;
+};
+
+TEST_F(TestExcludedRegions, sorts_and_merges) {
+    ExcludedRegions regions = load(
+        "# comment\n"
+        "track name=blacklist\n"
+        "chr1\t500\t600\tname\t0\t+\n"
+        "chr1\t100\t200\n"
+        "chrUn\t0\t10\n"
+        "chr1\t150\t300\n"
+        "chr1\t300\t350\n"
+        "chr1\t700\t700\n"
+        "\n"
+        "chr2 10 20\n"
+        );
+
+    EXPECT_EQ(1u, regions.num_ignored());
+    auto const& chr1 = regions.intervals(0);
+    ASSERT_EQ(2u, chr1.size());
+    EXPECT_EQ(100u, chr1[0].beg);
+    EXPECT_EQ(350u, chr1[0].end);
+    EXPECT_EQ(500u, chr1[1].beg);
+    EXPECT_EQ(600u, chr1[1].end);
+    ASSERT_EQ(1u, regions.intervals(1).size());
+    EXPECT_EQ(10u, regions.intervals(1)[0].beg);
+}
+
+TEST_F(TestExcludedRegions, invalid_lines) {
+    EXPECT_THROW(load("chr1\t100\n"), std::runtime_error);
+    EXPECT_THROW(load("chr1\tx\t100\n"), std::runtime_error);
+    EXPECT_THROW(load("chr1\t200\t100\n"), std::runtime_error);
+    EXPECT_THROW(load("chr1\t-1\t100\n"), std::runtime_error);
+}
+
+TEST_F(TestExcludedRegions, cursor) {
+    ExcludedRegions regions = load(
+        "chr1\t100\t200\n"
+        "chr1\t300\t400\n"
+        "chr1\t500\t600\n"
+        "chr1\t700\t800\n"
+        "chr2\t0\t50\n"
+        );
+
+    ExcludedRegions::Cursor cursor(&regions);
+    EXPECT_FALSE(cursor.overlaps(0, 0, 100));
+    EXPECT_TRUE(cursor.overlaps(0, 50, 101));
+    EXPECT_TRUE(cursor.overlaps(0, 199, 199));
+    EXPECT_FALSE(cursor.overlaps(0, 200, 300));
+    EXPECT_TRUE(cursor.covers(0, 300, 400));
+    EXPECT_FALSE(cursor.covers(0, 350, 450));
+    // past several intervals at once
+    EXPECT_TRUE(cursor.overlaps(0, 750, 751));
+    EXPECT_FALSE(cursor.overlaps(0, 800, 900));
+
+    // going back or to another sequence starts over
+    EXPECT_TRUE(cursor.overlaps(0, 150, 151));
+    EXPECT_TRUE(cursor.covers(1, 0, 50));
+    EXPECT_FALSE(cursor.overlaps(1, 50, 60));
+    EXPECT_TRUE(cursor.overlaps(0, 550, 551));
+    EXPECT_FALSE(cursor.overlaps(2, 0, 100));
+
+    ExcludedRegions::Cursor inactive;
+    EXPECT_FALSE(inactive.active());
+    EXPECT_FALSE(inactive.overlaps(0, 150, 151));
+}
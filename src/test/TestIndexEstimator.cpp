@@ -0,0 +1,133 @@
+#include "IndexEstimator.hpp"
+#include "BamReader.hpp"
+#include "TempBam.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    uint32_t const GAP_BEG = 100000;
+    uint32_t const GAP_END = 180000;
+}
+
+class TestIndexEstimator : public ::testing::Test {
+public:
+    void SetUp() {
+        std::vector<std::pair<std::string, uint32_t>> seqs{
+              {"chr1", 300000}
+            , {"chr2", 50000}
+            };
+
+        // reads on chr1 only, with a hole in the middle
+        std::stringstream in(make_sam_text({seqs[0]}, 10, 100));
+        std::stringstream sam;
+        sam << "@HD\tVN:1.0\tSO:coordinate\n"
+            << "@SQ\tSN:chr1\tLN:300000\n@SQ\tSN:chr2\tLN:50000\n";
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line[0] == '@')
+                continue;
+            std::stringstream fields(line);
+            std::string name, flag, chrom;
+            uint32_t pos;
+            fields >> name >> flag >> chrom >> pos;
+            if (pos > GAP_BEG && pos <= GAP_END)
+                continue;
+            sam << line << "\n";
+            starts.push_back(pos - 1);
+        }
+        bam.reset(new TempBam(sam.str()));
+    }
+
+    std::unique_ptr<TempBam> bam;
+    std::vector<uint32_t> starts;
+};
+
+TEST_F(TestIndexEstimator, tiles_add_up_to_mapped_reads) {
+    BamReader reader(bam->path());
+    IndexEstimator estimator(reader.index());
+
+    std::vector<double> tiles = estimator.tile_counts(0);
+    std::vector<double> exact(tiles.size(), 0.0);
+    for (auto i = starts.begin(); i != starts.end(); ++i) {
+        ASSERT_LT(*i / IndexEstimator::TILE_SIZE, tiles.size());
+        ++exact[*i / IndexEstimator::TILE_SIZE];
+    }
+
+    double total = std::accumulate(tiles.begin(), tiles.end(), 0.0);
+    EXPECT_NEAR(double(starts.size()), total, 1e-6);
+
+    for (std::size_t i = 0; i < tiles.size(); ++i) {
+        // full tiles hold ~1640 reads, a few bgzf blocks worth
+        EXPECT_NEAR(exact[i], tiles[i], 0.15 * 1640) << "tile " << i;
+    }
+
+    EXPECT_TRUE(estimator.tile_counts(1).empty());
+}
+
+TEST_F(TestIndexEstimator, windows_spread_tiles) {
+    BamReader reader(bam->path());
+    IndexEstimator estimator(reader.index());
+
+    std::vector<double> tiles = estimator.tile_counts(0);
+    RowAssigner rows(300000, 1000);
+    std::vector<double> windows = estimator.window_counts(0, rows);
+    ASSERT_EQ(300u, windows.size());
+
+    double total = std::accumulate(windows.begin(), windows.end(), 0.0);
+    EXPECT_NEAR(double(starts.size()), total, 1e-6);
+
+    // windows inside a tile get an even share of it
+    EXPECT_NEAR(tiles[0] * 1000 / IndexEstimator::TILE_SIZE, windows[0], 1e-6);
+    // nothing is placed in tiles entirely inside the hole
+    uint32_t first_empty = GAP_BEG / IndexEstimator::TILE_SIZE + 1;
+    uint32_t last_empty = GAP_END / IndexEstimator::TILE_SIZE - 1;
+    for (uint32_t row = first_empty * IndexEstimator::TILE_SIZE / 1000 + 1;
+        row < last_empty * IndexEstimator::TILE_SIZE / 1000; ++row)
+    {
+        EXPECT_EQ(0.0, windows[row]) << "row " << row;
+    }
+
+    RowAssigner empty_rows(50000, 1000);
+    std::vector<double> empty = estimator.window_counts(1, empty_rows);
+    ASSERT_EQ(50u, empty.size());
+    EXPECT_EQ(0.0, std::accumulate(empty.begin(), empty.end(), 0.0));
+}
+
+TEST(TestIndexEstimatorSmallSequence, one_block_at_end_of_file) {
+    // a small sequence after a long one, all in one well compressed bgzf
+    // block at the end of the file: its reads take fewer compressed bytes
+    // than COMPRESSION_RATIO places them at, so no run of tiles has any
+    std::vector<std::pair<std::string, uint32_t>> seqs{
+          {"chr1", 100000}
+        , {"chr2", 20000}
+        };
+    std::string text = make_sam_text({seqs[0]}, 10, 100);
+    text.insert(text.find("@RG"), "@SQ\tSN:chr2\tLN:20000\n");
+    std::stringstream out;
+    out << text;
+    uint32_t const n_reads = 49;
+    for (uint32_t i = 0; i < n_reads; ++i) {
+        out << "s" << i << "\t0\tchr2\t" << 1001 + 100 * i << "\t60\t100M\t*\t0\t0\t"
+            << std::string(100, 'A') << "\t*\tRG:Z:rg1\n";
+    }
+    TempBam bam(out.str());
+
+    BamReader reader(bam.path());
+    IndexEstimator estimator(reader.index());
+    std::vector<double> tiles = estimator.tile_counts(1);
+    ASSERT_EQ(1u, tiles.size());
+    EXPECT_NEAR(double(n_reads), tiles[0], 1e-6);
+
+    RowAssigner rows(20000, 1000);
+    std::vector<double> windows = estimator.window_counts(1, rows);
+    double total = std::accumulate(windows.begin(), windows.end(), 0.0);
+    EXPECT_NEAR(double(n_reads), total, 1e-6);
+}
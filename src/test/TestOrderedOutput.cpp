@@ -0,0 +1,115 @@
+#include "OrderedOutput.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+    struct SlotWriter {
+        SlotWriter(OrderedOutput& output, std::size_t slot)
+            : output(output)
+            , slot(slot)
+        {
+        }
+
+        void operator()() {
+            for (int i = 0; i < 3; ++i) {
+                std::stringstream ss;
+                ss << slot << "." << i << ";";
+                output.append(slot, ss.str());
+            }
+            output.finish(slot);
+        }
+
+        OrderedOutput& output;
+        std::size_t slot;
+    };
+}
+
+TEST(TestOrderedOutput, writes_slots_in_order) {
+    std::stringstream ss;
+    OrderedOutput output(ss, 4);
+
+    // fill in the slots back to front, the last one from another thread
+    std::thread t(SlotWriter(output, 3));
+    SlotWriter(output, 2)();
+    SlotWriter(output, 1)();
+    output.finish(0); // empty slot
+
+    output.write_all();
+    t.join();
+
+    EXPECT_EQ("1.0;1.1;1.2;2.0;2.1;2.2;3.0;3.1;3.2;", ss.str());
+}
+
+namespace {
+    // Appends 8 byte chunks to a slot, counting those taken
+    struct BulkWriter {
+        BulkWriter(OrderedOutput& output, std::size_t slot, std::atomic<int>& n_taken)
+            : output(output)
+            , slot(slot)
+            , n_taken(n_taken)
+        {
+        }
+
+        void operator()() {
+            for (int i = 0; i < 4; ++i) {
+                output.append(slot, "abcdefg\n");
+                ++n_taken;
+            }
+            output.finish(slot);
+        }
+
+        OrderedOutput& output;
+        std::size_t slot;
+        std::atomic<int>& n_taken;
+    };
+}
+
+TEST(TestOrderedOutput, later_slots_wait_past_max_buffered) {
+    std::stringstream ss;
+    OrderedOutput output(ss, 2, 10);
+
+    // slot 1 can buffer up to the first chunk past 10 bytes
+    std::atomic<int> n_taken(0);
+    std::thread t(BulkWriter(output, 1, n_taken));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(2, n_taken.load());
+
+    // the slot being written always gets its chunks
+    for (int i = 0; i < 4; ++i)
+        output.append(0, "0123456\n");
+    output.finish(0);
+    EXPECT_EQ(2, n_taken.load());
+
+    output.write_all();
+    t.join();
+    EXPECT_EQ(4, n_taken.load());
+    std::string expected;
+    for (int i = 0; i < 4; ++i)
+        expected += "0123456\n";
+    for (int i = 0; i < 4; ++i)
+        expected += "abcdefg\n";
+    EXPECT_EQ(expected, ss.str());
+}
+
+TEST(TestOrderedOutput, abort_rethrows) {
+    std::stringstream ss;
+    OrderedOutput output(ss, 2);
+
+    output.append(0, "x");
+    output.finish(0);
+    try {
+        throw std::runtime_error("worker failed");
+    }
+    catch (...) {
+        output.abort(std::current_exception());
+    }
+
+    EXPECT_THROW(output.write_all(), std::runtime_error);
+}
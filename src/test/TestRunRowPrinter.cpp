@@ -0,0 +1,84 @@
+#include "RunRowPrinter.hpp"
+#include "BamReader.hpp"
+#include "ColumnAssigner.hpp"
+#include "TempBam.hpp"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+class TestRunRowPrinter : public ::testing::Test {
+public:
+    void SetUp() {
+        bam.reset(new TempBam(make_sam_text({{"chr1", 1000}, {"chr2", 250}}, 100, 5)));
+        reader.reset(new BamReader(bam->path()));
+    }
+
+    std::unique_ptr<TempBam> bam;
+    std::unique_ptr<BamReader> reader;
+};
+
+TEST_F(TestRunRowPrinter, header) {
+    std::vector<uint32_t> lens{36, 100};
+    PerLengthColumnAssigner ca(lens);
+    std::stringstream ss;
+    RunRowPrinter::print_header(ss, ca, reader->header(), {1, 0}, 100);
+    EXPECT_EQ(
+        "#window_size\t100\n"
+        "#sequence\tchr2\t250\n"
+        "#sequence\tchr1\t1000\n"
+        "#Chr\tStart\tEnd\t36\t100\n"
+        , ss.str());
+}
+
+TEST_F(TestRunRowPrinter, collapses_runs) {
+    std::vector<uint32_t> lens{36, 100};
+    PerLengthColumnAssigner ca(lens);
+    std::stringstream ss;
+    {
+        RunRowPrinter printer(ss, ca, reader->header(), 100);
+        printer("chr1", 1);
+        printer("chr1", 101, {3, 0});
+        printer("chr1", 201, {3, 0});
+        printer("chr1", 301, {3});
+        printer("chr1", 401, {0, 0});
+        printer("chr1", 501);
+        printer("chr1", 601, {0, 1});
+        printer("chr1", 701);
+        printer("chr1", 801, {2, 2});
+        printer("chr1", 901, {2, 2});
+        // past the end of chr1
+        printer("chr1", 1001, {2, 2});
+        printer("chr1", 1101, {1, 0});
+
+        // the same counts do not continue a run in another sequence
+        printer("chr2", 1, {1, 0});
+        printer("chr2", 101, {1, 0});
+        printer("chr2", 201, {1, 0});
+    }
+
+    EXPECT_EQ(
+        "chr1\t100\t400\t3\t0\n"
+        "chr1\t600\t700\t0\t1\n"
+        "chr1\t800\t1100\t2\t2\n"
+        "chr1\t1100\t1200\t1\t0\n"
+        "chr2\t0\t250\t1\t0\n"
+        , ss.str());
+}
+
+TEST_F(TestRunRowPrinter, flush_ends_run) {
+    SingleColumnAssigner ca;
+    std::stringstream ss;
+    RunRowPrinter printer(ss, ca, reader->header(), 100);
+    printer("chr1", 1, {4});
+    printer("chr1", 101, {4});
+    printer.flush();
+    EXPECT_EQ("chr1\t0\t200\t4\n", ss.str());
+
+    printer("chr1", 201, {4});
+    printer("chr1", 301);
+    printer.flush();
+    EXPECT_EQ("chr1\t0\t200\t4\nchr1\t200\t300\t4\n", ss.str());
+}
@@ -0,0 +1,119 @@
+#include "ShardMerger.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace {
+    typedef ShardRows::Counts Counts;
+
+    Counts row(uint64_t a, uint64_t b) {
+        Counts rv;
+        rv.push_back(a);
+        rv.push_back(b);
+        return rv;
+    }
+
+    std::vector<Counts> all_rows(ShardRows const& rows) {
+        std::vector<Counts> rv(rows.size());
+        for (std::size_t i = 0; i < rows.size(); ++i)
+            rows.get_row(i, rv[i]);
+        return rv;
+    }
+}
+
+TEST(TestShardMerger, rows) {
+    ShardRows rows;
+    rows.push_back(Counts{3});
+    rows.push_back();
+    // wider rows widen the buffer; counts past 32 bits are kept
+    rows.push_back(row(1, 1ull << 40));
+    EXPECT_EQ(3u, rows.size());
+    EXPECT_EQ(2u, rows.stride());
+    EXPECT_EQ(1u, rows.width(0));
+    EXPECT_EQ(0u, rows.width(1));
+
+    std::vector<Counts> expected{Counts{3}, Counts(), row(1, 1ull << 40)};
+    EXPECT_EQ(expected, all_rows(rows));
+
+    ShardRows other;
+    other.push_back(Counts{1, 2, (1ull << 32) - 1});
+    other.push_back();
+    rows.add_row(0, other, 0);
+    rows.add_row(1, other, 1);
+    rows.add_row(2, other, 0);
+    rows.append_row(other, 0);
+    EXPECT_EQ(3u, rows.stride());
+
+    std::vector<Counts> expected_sums{
+          Counts{4, 2, (1ull << 32) - 1}
+        , Counts()
+        , Counts{2, (1ull << 40) + 2, (1ull << 32) - 1}
+        , Counts{1, 2, (1ull << 32) - 1}
+        };
+    EXPECT_EQ(expected_sums, all_rows(rows));
+
+    rows.add_row(3, other, 0);
+    EXPECT_EQ(Counts({2, 4, (1ull << 33) - 2}), all_rows(rows)[3]);
+
+    rows.clear();
+    EXPECT_EQ(0u, rows.size());
+    rows.push_back(Counts{5});
+    EXPECT_EQ(std::vector<Counts>{Counts{5}}, all_rows(rows));
+}
+
+TEST(TestShardMerger, carry_is_added_in_order) {
+    // sequence 1: shards 0, 1, 2 of 2 rows each; sequence 2: shard 3
+    std::vector<bool> ends_sequence{false, false, true, true};
+    ShardMerger merger(ends_sequence);
+    std::vector<ShardMerger::MergedShard> ready;
+
+    // shard 0 has a read running 3 rows past its end, i.e., all of shard 1
+    // and into shard 2
+    ShardCounts s0;
+    s0.rows.push_back(row(1, 0));
+    s0.rows.push_back();
+    s0.carry.push_back(row(1, 0));
+    s0.carry.push_back(row(1, 0));
+    s0.carry.push_back(row(1, 0));
+
+    ShardCounts s1;
+    s1.rows.push_back();
+    s1.rows.push_back(row(0, 2));
+    s1.carry.push_back(row(0, 1));
+
+    // the last shard of a sequence can run past its end
+    ShardCounts s2;
+    s2.rows.push_back();
+    s2.rows.push_back(row(5, 5));
+    s2.carry.push_back(row(0, 3));
+
+    ShardCounts s3;
+    s3.rows.push_back(row(7, 7));
+
+    merger.submit(2, s2, ready);
+    merger.submit(1, s1, ready);
+    EXPECT_TRUE(ready.empty());
+
+    merger.submit(0, s0, ready);
+    ASSERT_EQ(3u, ready.size());
+    EXPECT_EQ(0u, ready[0].slot);
+    EXPECT_EQ(1u, ready[1].slot);
+    EXPECT_EQ(2u, ready[2].slot);
+
+    std::vector<Counts> expected0{row(1, 0), Counts()};
+    std::vector<Counts> expected1{row(1, 0), row(1, 2)};
+    std::vector<Counts> expected2{row(1, 1), row(5, 5), row(0, 3)};
+    EXPECT_EQ(expected0, all_rows(ready[0].rows));
+    EXPECT_EQ(expected1, all_rows(ready[1].rows));
+    EXPECT_EQ(expected2, all_rows(ready[2].rows));
+    EXPECT_EQ(0u, s0.rows.size());
+
+    // nothing carries over into the next sequence
+    ready.clear();
+    merger.submit(3, s3, ready);
+    ASSERT_EQ(1u, ready.size());
+    EXPECT_EQ(3u, ready[0].slot);
+    std::vector<Counts> expected3{row(7, 7)};
+    EXPECT_EQ(expected3, all_rows(ready[0].rows));
+}
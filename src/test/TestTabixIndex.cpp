@@ -0,0 +1,312 @@
+#include "TabixIndex.hpp"
+#include "BgzfOutput.hpp"
+
+#include <bgzf.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+    std::string read_bgzf(std::string const& path) {
+        BGZF* fp = bgzf_open(path.c_str(), "r");
+        if (!fp)
+            throw std::runtime_error("Failed to open " + path);
+        std::string rv;
+        char buf[4096];
+        ssize_t n;
+        while ((n = bgzf_read(fp, buf, sizeof(buf))) > 0)
+            rv.append(buf, n);
+        bgzf_close(fp);
+        return rv;
+    }
+
+    // A .tbi file as it is on disk, and region queries the way tabix does
+    // them: chunks from the bins overlapping the region that end after the
+    // linear index entry of its start, then every line read in them
+    // checked for overlap.
+    struct Tbi {
+        struct Chunk {
+            uint64_t beg;
+            uint64_t end;
+
+            bool operator<(Chunk const& rhs) const { return beg < rhs.beg; }
+        };
+
+        struct Sequence {
+            std::map<uint32_t, std::vector<Chunk>> bins;
+            std::vector<uint64_t> linear;
+        };
+
+        explicit Tbi(std::string const& path)
+            : data(read_bgzf(path))
+            , pos(0)
+        {
+            magic = data.substr(0, 4);
+            pos = 4;
+            int32_t n_ref = i32();
+            preset = i32();
+            col_seq = i32();
+            col_beg = i32();
+            col_end = i32();
+            meta = i32();
+            skip = i32();
+            int32_t l_nm = i32();
+            std::string nm = data.substr(pos, l_nm);
+            pos += l_nm;
+            for (std::size_t i = 0; i < nm.size(); i += names.back().size() + 1)
+                names.push_back(nm.c_str() + i);
+
+            for (int32_t r = 0; r < n_ref; ++r) {
+                seqs.push_back(Sequence());
+                int32_t n_bin = i32();
+                for (int32_t b = 0; b < n_bin; ++b) {
+                    uint32_t bin = i32();
+                    int32_t n_chunk = i32();
+                    for (int32_t c = 0; c < n_chunk; ++c) {
+                        Chunk chunk;
+                        chunk.beg = u64();
+                        chunk.end = u64();
+                        seqs.back().bins[bin].push_back(chunk);
+                    }
+                }
+                int32_t n_intv = i32();
+                for (int32_t i = 0; i < n_intv; ++i)
+                    seqs.back().linear.push_back(u64());
+            }
+            if (pos != data.size())
+                throw std::runtime_error("Trailing data in index");
+        }
+
+        int32_t i32() {
+            int32_t rv;
+            std::memcpy(&rv, data.data() + pos, sizeof(rv));
+            pos += sizeof(rv);
+            return rv;
+        }
+
+        uint64_t u64() {
+            uint64_t rv;
+            std::memcpy(&rv, data.data() + pos, sizeof(rv));
+            pos += sizeof(rv);
+            return rv;
+        }
+
+        // 0 based, half open
+        std::vector<std::string> query(std::string const& table_path,
+            std::string const& name, int64_t beg, int64_t end) const
+        {
+            std::vector<std::string> rv;
+            auto seq_iter = std::find(names.begin(), names.end(), name);
+            if (seq_iter == names.end())
+                return rv;
+            Sequence const& seq = seqs[seq_iter - names.begin()];
+
+            std::vector<uint32_t> bins(1, 0);
+            int64_t last = end - 1;
+            uint32_t const offsets[] = {1, 9, 73, 585, 4681};
+            int const shifts[] = {26, 23, 20, 17, 14};
+            for (int level = 0; level < 5; ++level) {
+                for (int64_t k = offsets[level] + (beg >> shifts[level]);
+                    k <= offsets[level] + (last >> shifts[level]); ++k)
+                {
+                    bins.push_back(k);
+                }
+            }
+
+            std::size_t window = beg >> 14;
+            uint64_t min_offset = window < seq.linear.size() ? seq.linear[window] : 0;
+            std::vector<Chunk> chunks;
+            for (auto b = bins.begin(); b != bins.end(); ++b) {
+                auto found = seq.bins.find(*b);
+                if (found == seq.bins.end())
+                    continue;
+                for (auto c = found->second.begin(); c != found->second.end(); ++c) {
+                    if (c->end > min_offset)
+                        chunks.push_back(*c);
+                }
+            }
+            std::sort(chunks.begin(), chunks.end());
+
+            BGZF* fp = bgzf_open(table_path.c_str(), "r");
+            kstring_t line = {0, 0, 0};
+            for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+                bgzf_seek(fp, c->beg, SEEK_SET);
+                while (uint64_t(bgzf_tell(fp)) < c->end && bgzf_getline(fp, '\n', &line) >= 0) {
+                    std::string text(line.s, line.l);
+                    std::stringstream fields(text);
+                    std::string chr;
+                    int64_t line_beg;
+                    int64_t line_end;
+                    fields >> chr >> line_beg;
+                    if (preset & TabixIndex::PRESET_UCSC) {
+                        fields >> line_end;
+                    }
+                    else {
+                        --line_beg;
+                        line_end = line_beg + 1;
+                    }
+                    if (chr == name && line_beg < end && line_end > beg)
+                        rv.push_back(text);
+                }
+            }
+            free(line.s);
+            bgzf_close(fp);
+            return rv;
+        }
+
+        std::string data;
+        std::size_t pos;
+
+        std::string magic;
+        int32_t preset;
+        int32_t col_seq;
+        int32_t col_beg;
+        int32_t col_end;
+        int32_t meta;
+        int32_t skip;
+        std::vector<std::string> names;
+        std::vector<Sequence> seqs;
+    };
+
+    // The lines of text overlapping a region, found the slow way
+    std::vector<std::string> grep_region(std::string const& text, bool ucsc,
+        std::string const& name, int64_t beg, int64_t end)
+    {
+        std::vector<std::string> rv;
+        std::stringstream in(text);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#' || line.compare(0, 4, "Chr\t") == 0)
+                continue;
+            std::stringstream fields(line);
+            std::string chr;
+            int64_t line_beg;
+            int64_t line_end;
+            fields >> chr >> line_beg;
+            if (ucsc) {
+                fields >> line_end;
+            }
+            else {
+                --line_beg;
+                line_end = line_beg + 1;
+            }
+            if (chr == name && line_beg < end && line_end > beg)
+                rv.push_back(line);
+        }
+        return rv;
+    }
+}
+
+class TestTabixIndex : public ::testing::Test {
+public:
+    void SetUp() {
+        char const* tmpdir = getenv("TMPDIR");
+        path = std::string(tmpdir ? tmpdir : "/tmp") + "/bam-window-test-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        ASSERT_GE(fd, 0);
+        close(fd);
+    }
+
+    void TearDown() {
+        unlink(path.c_str());
+        unlink((path + ".tbi").c_str());
+    }
+
+    // Several blocks' worth of 100bp windows on chr1 and a few rows on chr2
+    std::string tsv_text() const {
+        std::stringstream ss;
+        ss << "Chr\tStart\tcount\n";
+        for (uint32_t pos = 1; pos <= 4000000; pos += 100)
+            ss << "chr1\t" << pos << "\t" << pos % 997 << "\n";
+        for (uint32_t pos = 1; pos <= 1000; pos += 100)
+            ss << "chr2\t" << pos << "\t0\n";
+        return ss.str();
+    }
+
+    void write(std::string const& text, TabixIndex::Format const& format, int n_threads) {
+        BgzfOutput out(path, n_threads);
+        out.set_index(new TabixIndex(format));
+        // in uneven pieces, so that lines are split between them
+        for (std::size_t i = 0; i < text.size(); i += 777)
+            out.stream() << text.substr(i, 777);
+        out.close();
+    }
+
+    std::string path;
+};
+
+TEST_F(TestTabixIndex, tsv_queries) {
+    std::string text = tsv_text();
+    for (int n_threads = 1; n_threads <= 3; n_threads += 2) {
+        write(text, TabixIndex::tsv_format(), n_threads);
+        ASSERT_EQ(text, read_bgzf(path)) << n_threads << " threads";
+
+        Tbi tbi(path + ".tbi");
+        EXPECT_EQ(std::string("TBI\1", 4), tbi.magic);
+        EXPECT_EQ(0, tbi.preset);
+        EXPECT_EQ(1, tbi.col_seq);
+        EXPECT_EQ(2, tbi.col_beg);
+        EXPECT_EQ(2, tbi.col_end);
+        EXPECT_EQ('#', tbi.meta);
+        EXPECT_EQ(1, tbi.skip);
+        std::vector<std::string> names{"chr1", "chr2"};
+        EXPECT_EQ(names, tbi.names);
+
+        int64_t const regions[][2] = {
+              {0, 1}, {0, 1000}, {150, 160}, {16383, 16385}, {99999, 250001}
+            , {1000000, 1131073}, {3999800, 5000000}, {6000000, 6000001}
+            };
+        for (std::size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); ++i) {
+            int64_t beg = regions[i][0];
+            int64_t end = regions[i][1];
+            EXPECT_EQ(grep_region(text, false, "chr1", beg, end),
+                tbi.query(path, "chr1", beg, end)) << beg << "-" << end;
+        }
+        EXPECT_EQ(10u, tbi.query(path, "chr2", 0, 1000).size());
+        EXPECT_TRUE(tbi.query(path, "chr3", 0, 1000).empty());
+    }
+}
+
+TEST_F(TestTabixIndex, bed_queries) {
+    std::stringstream ss;
+    ss << "#window_size\t100\n#Chr\tStart\tEnd\tcount\n";
+    for (uint32_t beg = 0; beg < 3000000; beg += 100 * (beg % 7 + 1))
+        ss << "chr1\t" << beg << "\t" << beg + 100 * (beg % 5 + 1) << "\t" << beg % 13 << "\n";
+    std::string text = ss.str();
+
+    write(text, TabixIndex::bed_format(), 2);
+    ASSERT_EQ(text, read_bgzf(path));
+
+    Tbi tbi(path + ".tbi");
+    EXPECT_EQ(TabixIndex::PRESET_UCSC, tbi.preset);
+    EXPECT_EQ(3, tbi.col_end);
+    EXPECT_EQ(0, tbi.skip);
+    int64_t const regions[][2] = {{0, 1}, {150, 160}, {16300, 16400}, {500000, 800000}, {2999000, 3100000}};
+    for (std::size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); ++i) {
+        int64_t beg = regions[i][0];
+        int64_t end = regions[i][1];
+        EXPECT_EQ(grep_region(text, true, "chr1", beg, end),
+            tbi.query(path, "chr1", beg, end)) << beg << "-" << end;
+    }
+}
+
+TEST_F(TestTabixIndex, rejects_unsorted_text) {
+    std::string text = "Chr\tStart\nchr1\t201\nchr1\t101\n";
+    EXPECT_THROW(write(text, TabixIndex::tsv_format(), 1), std::runtime_error);
+
+    text = "Chr\tStart\nchr1\t1\nchr2\t1\nchr1\t101\n";
+    EXPECT_THROW(write(text, TabixIndex::tsv_format(), 1), std::runtime_error);
+
+    text = "Chr\tStart\nchr1\tx\n";
+    EXPECT_THROW(write(text, TabixIndex::tsv_format(), 1), std::runtime_error);
+}
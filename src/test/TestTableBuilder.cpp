@@ -9,13 +9,14 @@
 #include <functional>
 #include <memory>
 #include <sstream>
+#include <string>
 
 namespace {
     struct RowCollector {
         struct Row {
             std::string seq_name;
             uint32_t pos;
-            std::vector<uint32_t> counts;
+            std::vector<uint64_t> counts;
 
             uint32_t operator[](uint32_t idx) const {
                 return counts[idx];
@@ -29,7 +30,7 @@ namespace {
             rows.push_back(row);
         }
 
-        void operator()(char const* seq, uint32_t p, std::vector<uint32_t> c) {
+        void operator()(char const* seq, uint32_t p, std::vector<uint64_t> c) {
             Row row;
             row.seq_name = seq;
             row.pos = p;
@@ -45,7 +46,8 @@ namespace {
             warnings.emplace_back(rg, len);
         }
 
-        std::vector<std::pair<char const*, uint32_t>> warnings;
+        // copied, as batches reuse their read group names
+        std::vector<std::pair<std::string, uint32_t>> warnings;
     };
 }
 
@@ -153,3 +155,159 @@ TEST_F(TestTableBuilder, build) {
     EXPECT_EQ(badLen.length, warnings.warnings[1].second);
 
 }
+
+TEST_F(TestTableBuilder, recycles_rows) {
+    RowCollector res;
+    MockWarningCollector warnings;
+    RowAssigner rows(400, 5);
+    BuilderType tb("chr1", rows, *col_assigner, res, warnings);
+
+    // a read covering more rows than are allocated up front, then reads
+    // that land in rows recycled from it
+    std::vector<MockEntry> entries{
+          MockEntry{0, 199, 36, "rg1"}
+        , MockEntry{150, 159, 150, "rg3"}
+        , MockEntry{300, 304, 150, "rg2"}
+        , MockEntry{390, 399, 36, "rg2"}
+        };
+    for (auto i = entries.begin(); i != entries.end(); ++i)
+        tb(*i);
+    tb.flush();
+
+    ASSERT_EQ(80u, res.rows.size());
+    for (uint32_t i = 0; i < 80; ++i) {
+        std::vector<uint64_t> expected(3, 0u);
+        if (i < 40)
+            expected[0] = 1;
+        if (i == 30 || i == 31)
+            expected[2] = 1;
+        if (i == 60)
+            expected[1] = 1;
+        if (i >= 78)
+            expected[0] = 1;
+
+        if (res.rows[i].counts.empty())
+            EXPECT_EQ(std::vector<uint64_t>(3, 0u), expected) << "row " << i;
+        else
+            EXPECT_EQ(expected, res.rows[i].counts) << "row " << i;
+    }
+}
+
+TEST_F(TestTableBuilder, batches_match_single_reads) {
+    std::vector<MockEntry> entries{
+          MockEntry{0, 4, 36, "rg1"}
+        , MockEntry{2, 4, 36, "rg1"}
+        , MockEntry{2, 14, 150, "rg2"}
+        , MockEntry{3, 3, 150, "rg2"}
+        , MockEntry{7, 9, 36, "foo"}
+        , MockEntry{7, 29, 150, "rg3"}
+        , MockEntry{8, 12, 37, "rg1"}
+        , MockEntry{30, 50, 150, "rg3"}
+        , MockEntry{31, 33, 36, "rg3"}
+        , MockEntry{55, 61, 36, "rg2"}
+        };
+
+    for (int start_only = 0; start_only < 2; ++start_only) {
+        row_assigner->set_start_only(start_only);
+        RowCollector expected;
+        MockWarningCollector expected_warnings;
+        {
+            BuilderType tb("chr1", *row_assigner, *col_assigner, expected, expected_warnings);
+            tb.set_count_starts(true);
+            for (auto i = entries.begin(); i != entries.end(); ++i)
+                tb(*i);
+        }
+
+        // batches smaller than the input, so some are added mid row
+        RowCollector res;
+        MockWarningCollector warnings;
+        ReadBatch batch(!start_only, true, 3);
+        {
+            BuilderType tb("chr1", *row_assigner, *col_assigner, res, warnings);
+            tb.set_count_starts(true);
+            for (auto i = entries.begin(); i != entries.end(); ++i) {
+                batch.push_back(*i);
+                if (batch.full()) {
+                    tb.add_batch(batch);
+                    batch.clear();
+                }
+            }
+            tb.add_batch(batch);
+        }
+
+        ASSERT_EQ(expected.rows.size(), res.rows.size());
+        for (std::size_t i = 0; i < res.rows.size(); ++i) {
+            EXPECT_EQ(expected.rows[i].pos, res.rows[i].pos);
+            EXPECT_EQ(expected.rows[i].counts, res.rows[i].counts) << "row " << i;
+        }
+
+        // foo is not a read group; rg1 has no 37 bp column, rg3 no 36 bp one
+        ASSERT_EQ(3u, expected_warnings.warnings.size());
+        EXPECT_EQ(expected_warnings.warnings, warnings.warnings);
+    }
+}
+
+TEST_F(TestTableBuilder, promotes_rows_that_overflow) {
+    typedef TableBuilder<RowCollector, MockWarningCollector, int8_t> NarrowBuilderType;
+    MockEntry entry{10, 24, 150, "rg3"};
+
+    {
+        RowCollector res;
+        MockWarningCollector warnings;
+        NarrowBuilderType tb("chr1", *row_assigner, *col_assigner, res, warnings);
+        tb.set_promote_rows(true);
+        // 300 reads start in row 2 and end in row 4, 200 more cover row 6
+        for (int i = 0; i < 300; ++i)
+            tb(entry);
+        MockEntry later{30, 34, 150, "rg3"};
+        for (int i = 0; i < 200; ++i)
+            tb(later);
+        tb.flush();
+
+        ASSERT_EQ(13u, res.rows.size());
+        for (uint32_t i = 2; i <= 4; ++i)
+            EXPECT_EQ(300u, res.rows[i][2]) << "row " << i;
+        EXPECT_TRUE(res.rows[5].counts.empty());
+        EXPECT_EQ(200u, res.rows[6][2]);
+    }
+
+    RowCollector res;
+    MockWarningCollector warnings;
+    NarrowBuilderType tb("chr1", *row_assigner, *col_assigner, res, warnings);
+    for (int i = 0; i < 127; ++i)
+        tb(entry);
+    EXPECT_THROW(tb(entry), std::runtime_error);
+}
+
+TEST(TestDefaultRowPrinter, matches_stream_insertion) {
+    std::vector<uint32_t> lens{10, 20, 30};
+    PerLengthColumnAssigner ca(lens);
+
+    std::vector<uint64_t> values{0, 1, 9, 10, 99, 100, 12345, 4294967295u,
+        10000000000u, 99999999999u, 18446744073709551615u};
+    std::stringstream expected;
+    std::stringstream actual;
+    {
+        DefaultRowPrinter printer(actual, ca);
+        // enough rows for several blocks, and one wider than a block
+        for (uint32_t row = 0; row < 20000; ++row) {
+            uint32_t pos = row * 1000 + 1;
+            char const* name = row < 10000 ? "chr1" : "chrUn_KI270302v1";
+            if (row % 3 == 0) {
+                printer(name, pos);
+                expected << name << "\t" << pos << "\t0\t0\t0\n";
+                continue;
+            }
+
+            std::vector<uint64_t> counts(row == 5 ? DefaultRowPrinter::BLOCK_SIZE : 3);
+            expected << name << "\t" << pos;
+            for (std::size_t i = 0; i < counts.size(); ++i) {
+                counts[i] = values[(row + i) % values.size()];
+                expected << "\t" << counts[i];
+            }
+            expected << "\n";
+            printer(name, pos, counts);
+        }
+    }
+    EXPECT_EQ(expected.str(), actual.str());
+}
@@ -0,0 +1,33 @@
+#include "WorkStealingQueue.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+TEST(TestWorkStealingQueue, own_work_first_then_steal_from_back) {
+    WorkStealingQueue<int> queue(3);
+    for (int i = 0; i < 6; ++i)
+        queue.push(i % 3, i);
+
+    // worker 0 owns 0 and 3
+    std::vector<int> taken;
+    int x;
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(queue.pop(0, x));
+        taken.push_back(x);
+    }
+    // then steals the most recent items from workers 1 and 2
+    ASSERT_TRUE(queue.pop(0, x));
+    taken.push_back(x);
+    ASSERT_TRUE(queue.pop(0, x));
+    taken.push_back(x);
+
+    std::vector<int> expected{0, 3, 4, 1};
+    EXPECT_EQ(expected, taken);
+
+    ASSERT_TRUE(queue.pop(2, x));
+    EXPECT_EQ(2, x);
+    queue.cancel();
+    EXPECT_FALSE(queue.pop(2, x));
+    EXPECT_FALSE(queue.pop(1, x));
+}